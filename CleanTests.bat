@@ -3,3 +3,22 @@ echo Removing test output files.
 if exist err del err
 if exist errs del errs
 if exist *.wrl del *.wrl
+if exist *.gz del *.gz
+if exist *.wrz del *.wrz
+if exist *.x3d del *.x3d
+if exist *.x3dv del *.x3dv
+if exist *.x3dz del *.x3dz
+if exist *.x3dvz del *.x3dvz
+if exist *.glb del *.glb
+if exist *.ply del *.ply
+if exist *_binary.stl del *_binary.stl
+if exist testcache rmdir /s /q testcache
+if exist batch.txt del batch.txt
+if exist serialbatch.txt del serialbatch.txt
+if exist workerbatch.txt del workerbatch.txt
+if exist service.log del service.log
+if exist watchdir rmdir /s /q watchdir
+if exist batchdir rmdir /s /q batchdir
+rem The build's stl2vrml.obj is left alone.
+if exist DoomKeyCard.obj del DoomKeyCard.obj
+if exist conifer.obj del conifer.obj
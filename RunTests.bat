@@ -1,6 +1,7 @@
 @echo off
 if exist *.wrl del *.wrl
 if exist err del err
+set failed=
 
 echo ---
 echo Running tests.  This may take a minute...
@@ -18,6 +19,129 @@ rem #### Test with very large STL files.
 stl2vrml.exe testdata\yowanehaku20130114_002.stl yowanehaku20130114_002.wrl >> err
 stl2vrml.exe testdata\CraterLake3.2480_1290_117.stl CraterLake3.2480_1290_117.wrl >> err
 
+rem #### Test merging of coplanar triangles.
+stl2vrml.exe --merge-coplanar testdata\space_invader_3.stl space_invader_3_merged.wrl >> err
+stl2vrml.exe --merge-coplanar testdata\doomkeycard.stl doomkeycard_merged.wrl >> err
+
+rem #### Test instancing of repeated parts.
+stl2vrml.exe --instance testdata\conifer.stl conifer_instanced.wrl >> err
+stl2vrml.exe --instance --merge-coplanar testdata\space_invader_4.stl space_invader_4_instanced.wrl >> err
+
+rem #### Test splitting into separate components.
+stl2vrml.exe --components testdata\yowanehaku20130114_002.stl yowanehaku20130114_002_components.wrl >> err
+
+rem #### Test output of normals.
+stl2vrml.exe --normals testdata\grandcanyon.stl grandcanyon_normals.wrl >> err
+stl2vrml.exe --smooth-normals 30 testdata\conifer.stl conifer_smooth.wrl >> err
+
+rem #### Test winding check.
+stl2vrml.exe --orient --merge-coplanar testdata\space_invader_2.stl space_invader_2_oriented.wrl >> err
+rem #### The hollow cube's cavity should stay facing inward, with no faces
+rem #### turned over.
+stl2vrml.exe --orient testdata\hollow_cube.stl hollow_cube_oriented.wrl >> err
+
+rem #### Test quantized coordinates.
+stl2vrml.exe --quantize 1e-6 testdata\grandcanyon.stl grandcanyon_quantized.wrl >> err
+stl2vrml.exe --quantize 1e-5 --instance --components testdata\conifer.stl conifer_quantized.wrl >> err
+
+rem #### Test compressed output.
+stl2vrml.exe testdata\grandcanyon.stl grandcanyon.wrl.gz >> err
+stl2vrml.exe --merge-coplanar testdata\space_invader_1.stl space_invader_1.wrz >> err
+
+rem #### Test compressed input.
+stl2vrml.exe testdata\space_invader_1.stl.gz space_invader_1_fromgz.wrl >> err
+stl2vrml.exe testdata\DoomKeyCard.stl.gz DoomKeyCard_fromgz.wrl >> err
+
+rem #### Test X3D output.
+stl2vrml.exe --smooth-normals 30 --orient testdata\conifer.stl conifer.x3d >> err
+stl2vrml.exe --quantize 1e-5 --instance --components testdata\conifer.stl conifer.x3dv >> err
+stl2vrml.exe --normals --merge-coplanar testdata\space_invader_1.stl space_invader_1.x3dz >> err
+
+rem #### Test GLB output.
+stl2vrml.exe testdata\grandcanyon.stl grandcanyon.glb >> err
+stl2vrml.exe --smooth-normals 30 --instance --components testdata\conifer.stl conifer.glb >> err
+
+rem #### Test PLY and OBJ output, and writing several files at once.
+stl2vrml.exe testdata\DoomKeyCard.stl DoomKeyCard_fanout.wrl DoomKeyCard.ply DoomKeyCard.obj >> err
+stl2vrml.exe --smooth-normals 30 --instance testdata\conifer.stl conifer.ply conifer.obj >> err
+
+rem #### Test binary STL output, and reading it back.
+stl2vrml.exe testdata\conifer.stl conifer_binary.stl >> err
+stl2vrml.exe conifer_binary.stl conifer_frombinary.wrl >> err
+stl2vrml.exe --merge-coplanar testdata\space_invader_3.stl space_invader_3_binary.stl >> err
+
+rem #### Test the mesh cache.  The second conversion reads the cache.
+rem #### Both should come out the same as without the cache.
+stl2vrml.exe --mesh-cache testcache testdata\conifer.stl conifer_cached.wrl >> err
+stl2vrml.exe --mesh-cache testcache --instance testdata\conifer.stl conifer_cached_instanced.wrl >> err
+call :same conifer_cached.wrl conifer.wrl
+call :same conifer_cached_instanced.wrl conifer_instanced.wrl
+
+rem #### Test the output cache.  The second conversion copies the first.
+stl2vrml.exe --output-cache testcache --merge-coplanar testdata\space_invader_2.stl space_invader_2_cached.wrl >> err
+stl2vrml.exe --output-cache testcache --merge-coplanar testdata\space_invader_2.stl space_invader_2_fromcache.wrl >> err
+call :same space_invader_2_fromcache.wrl space_invader_2_cached.wrl
+
+rem #### Test reading and writing without the file cache.
+stl2vrml.exe --direct-io testdata\CraterLake3.2480_1290_117.stl CraterLake3_direct.wrl CraterLake3_direct.glb >> err
+
+rem #### Test converting a model in slices and joining them up.
+stl2vrml.exe --facet-range 0:10000 testdata\grandcanyon.stl grandcanyon_part1.wrl >> err
+stl2vrml.exe --facet-range 10000:30000 testdata\grandcanyon.stl grandcanyon_part2.wrl >> err
+stl2vrml.exe --merge grandcanyon_merged.wrl grandcanyon_part1.wrl grandcanyon_part2.wrl >> err
+call :same grandcanyon_merged.wrl grandcanyon.wrl
+
+rem #### Test a slice that starts more than 2GB into a binary STL file.
+rem #### The file is all zeros apart from its facet count and its last
+rem #### facet.  It's marked sparse before it's made longer, so that the
+rem #### zeros aren't written out; where it can't be, the test is skipped.
+type nul > big_binary.stl
+fsutil sparse setflag big_binary.stl > nul
+if errorlevel 1 goto nobigbinary
+powershell -NoProfile -Command "$f = [IO.File]::Open('big_binary.stl', 'Open'); $f.SetLength(2500000084); $f.Position = 80; $f.Write([BitConverter]::GetBytes([uint32]50000000), 0, 4); $r = @(); foreach ($v in 0,0,1, 0,0,0, 1,0,0, 0,1,0) { $r += [BitConverter]::GetBytes([single]$v) }; $f.Position = 2500000034; $f.Write([byte[]]$r, 0, 48); $f.Close()"
+stl2vrml.exe --facet-range 49999000:50000000 big_binary.stl big_binary_slice.wrl >> err
+:nobigbinary
+if exist big_binary.stl del big_binary.stl
+
+rem #### Test batch conversion, from a list file and from a directory.
+echo testdata\space_invader_1.stl space_invader_1_batch.wrl space_invader_1_batch.glb > batch.txt
+echo testdata\DoomKeyCard.stl.gz DoomKeyCard_batch.wrl >> batch.txt
+stl2vrml.exe --merge-coplanar --batch batch.txt >> err
+if exist batchdir rmdir /s /q batchdir
+mkdir batchdir
+copy testdata\space_invader_*.stl batchdir > nul
+stl2vrml.exe --instance --batch batchdir --batch-extension x3d >> err
+
+rem #### Test that face sets formatted on several threads come out the
+rem #### same as ones formatted on one thread.  In a batch with a much
+rem #### bigger file, the small file's face sets are formatted one at a
+rem #### time.
+echo testdata\CraterLake3.2480_1290_117.stl CraterLake3_serial.wrl > serialbatch.txt
+echo testdata\grandcanyon.stl grandcanyon_serial.wrl >> serialbatch.txt
+stl2vrml.exe --batch serialbatch.txt >> err
+call :same grandcanyon_serial.wrl grandcanyon.wrl
+
+rem #### Test batch conversion in worker processes.  The bad file
+rem #### fails without stopping the other one.
+echo testdata\conifer.stl conifer_worker.wrl > workerbatch.txt
+echo testdata\badfile.stl badfile_worker.wrl >> workerbatch.txt
+stl2vrml.exe --batch workerbatch.txt --batch-processes 2 --batch-timeout 600 >> err
+
+rem #### Test watching a directory for a few seconds.
+if exist watchdir rmdir /s /q watchdir
+mkdir watchdir
+copy testdata\space_invader_2.stl watchdir > nul
+stl2vrml.exe --watch watchdir --watch-interval 0.5 --watch-time 3 >> err
+
+rem #### Test the conversion service, with a client converting a file
+rem #### through it and then stopping it.
+start "stl2vrml service" /b stl2vrml.exe --serve testservice.sock > service.log
+timeout /t 2 > nul
+stl2vrml.exe --client testservice.sock --merge-coplanar testdata\space_invader_4.stl space_invader_4_service.wrl >> err
+stl2vrml.exe --client testservice.sock --stop >> err
+timeout /t 2 > nul
+type service.log >> err
+
 rem #### Test intentionally bad STL file.
 rem #### This should fail with an error.
 echo --- >> err
@@ -30,4 +154,15 @@ echo Done running tests.
 echo Done running tests. >> err
 
 if exist err type err
+if defined failed exit /b 1
+exit /b 0
 
+rem #### Compares two output files that should be the same, and fails
+rem #### the run if they aren't.
+:same
+fc /b %1 %2 > nul
+if errorlevel 1 (
+   echo %1 and %2 should be the same, but they differ. >> err
+   set failed=1
+)
+goto :eof
@@ -0,0 +1,295 @@
+//--------------------------------------------------------------------
+// asyncfile.h - File classes that read ahead of the reader and write
+// behind the writer, on threads of their own.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#include "SimpleFile.h"
+#include "parallel.h"
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <algorithm>
+
+//--------------------------------------------------------------------
+// ReadAheadFile:  A File that reads another File in large blocks on a
+// thread of its own, a few blocks ahead of what has been asked for, so
+// that the disk (or the network, for a file on a share) is kept busy
+// while the data before it is being parsed.  Reading starts at the
+// beginning of the file, and only once Read is first called.  Seeking
+// within the current block is free; seeking anywhere else stops the
+// reading ahead and starts it again from there.  The other File must
+// not be used directly while this one is in use.
+//--------------------------------------------------------------------
+class ReadAheadFile : public File
+{
+public:
+   ReadAheadFile() = delete;
+   ReadAheadFile(const ReadAheadFile &) = delete;
+   explicit ReadAheadFile(File &in) : m_in(in), m_length(in.Length())
+   {
+      m_in.Seek(0);
+   }
+
+   ~ReadAheadFile() { StopReading(); }
+
+   bool IsOpen() override { return m_in.IsOpen(); }
+   void Close() override { StopReading(); m_in.Close(); }
+   bool Write(const void *, size_t) override { return false; }
+   size_t Length() override { return m_length; }
+
+   bool Seek(size_t position) override
+   {
+      if (position >= m_blockStart && position <= m_blockStart + m_block.size())
+      {
+         m_offset = position - m_blockStart;
+         return true;
+      }
+      StopReading();
+      m_block.clear();
+      m_blockStart = position;
+      m_offset = 0;
+      return m_in.Seek(position);
+   }
+
+   //--------------------------------------------------------------------
+   // Reads numbytes of data, waiting for the reading thread if it
+   // hasn't got that far yet.  Returns the number of bytes actually
+   // read.  An exception thrown by the other File's Read is passed on.
+   //--------------------------------------------------------------------
+   size_t Read(void *data, size_t numbytes) override
+   {
+      char *p = static_cast<char *>(data);
+      size_t total = 0;
+      while (total < numbytes)
+      {
+         if (m_offset == m_block.size() && !NextBlock())
+            break;
+         const size_t n = std::min(numbytes - total, m_block.size() - m_offset);
+         memcpy(p + total, m_block.data() + m_offset, n);
+         m_offset += n;
+         total += n;
+      }
+      return total;
+   }
+
+private:
+   // Amount read at a time, and the most blocks read ahead.
+   static constexpr size_t blockSize = 1 << 20;
+   static constexpr size_t maxBlocksAhead = 4;
+
+   //--------------------------------------------------------------------
+   // Moves on to the next block, starting the reading thread if need
+   // be.  Returns false at the end of the file.
+   //--------------------------------------------------------------------
+   bool NextBlock()
+   {
+      if (!m_thread.joinable())
+         m_thread = std::thread([this]() { ReadBlocks(); });
+
+      m_blockStart += m_block.size();
+      m_block.clear();
+      m_offset = 0;
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_blockRead.wait(lock, [this]() { return !m_blocks.empty() || m_ended; });
+      if (m_blocks.empty())
+      {
+         if (m_error)
+            std::rethrow_exception(m_error);
+         return false;
+      }
+      m_block = std::move(m_blocks.front());
+      m_blocks.pop_front();
+      lock.unlock();
+      m_blockTaken.notify_one();
+      return true;
+   }
+
+   // Runs on the reading thread until the end of the file, or until
+   // StopReading is called.
+   void ReadBlocks()
+   {
+      for (;;)
+      {
+         std::vector<char> block(blockSize);
+         std::exception_ptr error;
+         try
+         {
+            block.resize(m_in.Read(block.data(), block.size()));
+         }
+         catch (...)
+         {
+            block.clear();
+            error = std::current_exception();
+         }
+         const bool end = block.size() < blockSize;
+
+         std::unique_lock<std::mutex> lock(m_mutex);
+         if (!block.empty())
+            m_blocks.push_back(std::move(block));
+         m_ended = end;
+         m_error = error;
+         m_blockRead.notify_one();
+         if (end)
+            return;
+         m_blockTaken.wait(lock, [this]() { return m_blocks.size() < maxBlocksAhead || m_stopping; });
+         if (m_stopping)
+            return;
+      }
+   }
+
+   // Stops the reading thread and throws away what it read ahead.
+   void StopReading()
+   {
+      if (!m_thread.joinable())
+         return;
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stopping = true;
+      }
+      m_blockTaken.notify_one();
+      m_thread.join();
+      m_blocks.clear();
+      m_stopping = m_ended = false;
+      m_error = nullptr;
+   }
+
+private:
+   File &m_in;
+   const size_t m_length;
+   std::vector<char> m_block;          // The block being read from.
+   size_t m_blockStart = 0;            // Position of the block in the file.
+   size_t m_offset = 0;                // Position within the block.
+
+   // Shared with the reading thread.
+   std::mutex m_mutex;
+   std::condition_variable m_blockRead;
+   std::condition_variable m_blockTaken;
+   std::deque<std::vector<char>> m_blocks;   // Blocks read ahead, oldest first.
+   bool m_ended = false;
+   bool m_stopping = false;
+   std::exception_ptr m_error;
+
+   std::thread m_thread;
+};
+
+//--------------------------------------------------------------------
+// WriteBehindFile:  A File that gathers what's written to it into
+// large blocks, and writes them to another File on a thread of its
+// own, so that the writer carries on while the disk catches up.  A
+// few blocks may wait to be written; Write blocks when there are more.
+// Seeking, reading and getting the length wait for everything to be
+// written first, so the file may be finished by going back to the
+// start, as GLB, PLY and STL files are.  A failed write is reported by
+// a later Write, or by Finish, which must be called to be sure that
+// everything has been written.  The other File must not be used
+// directly while this one is in use.
+//--------------------------------------------------------------------
+class WriteBehindFile : public File
+{
+public:
+   WriteBehindFile() = delete;
+   WriteBehindFile(const WriteBehindFile &) = delete;
+   explicit WriteBehindFile(File &out) : m_out(out) { }
+
+   ~WriteBehindFile() { Finish(); }
+
+   bool IsOpen() override { return m_out.IsOpen(); }
+   void Close() override { Finish(); m_out.Close(); }
+   bool Seek(size_t position) override { Finish(); return m_out.Seek(position); }
+   size_t Read(void *data, size_t numbytes) override { Finish(); return m_out.Read(data, numbytes); }
+   size_t Length() override { Finish(); return m_out.Length(); }
+
+   // Adds numbytes of data to be written.  Returns false if an
+   // earlier write failed.
+   bool Write(const void *data, size_t numbytes) override
+   {
+      const char *p = static_cast<const char *>(data);
+      m_block.insert(m_block.end(), p, p + numbytes);
+      if (m_block.size() >= blockSize)
+         SubmitBlock();
+      return !m_failed;
+   }
+
+   //--------------------------------------------------------------------
+   // Waits for everything written so far to reach the other File.
+   // Returns true if it was all written successfully.
+   //--------------------------------------------------------------------
+   bool Finish()
+   {
+      if (!m_block.empty())
+         SubmitBlock();
+      if (m_writer)
+      {
+         m_writer->Finish();
+         m_writer.reset();
+      }
+      return !m_failed;
+   }
+
+private:
+   // Amount written at a time, and the most blocks waiting.
+   static constexpr size_t blockSize = 1 << 20;
+   static constexpr size_t maxBlocksBehind = 4;
+
+   // Hands the current block to the writing thread.
+   void SubmitBlock()
+   {
+      if (!m_writer)
+         m_writer.reset(new WorkerThread(maxBlocksBehind));
+      auto block = std::make_shared<std::vector<char>>();
+      block->swap(m_block);
+      m_block.reserve(blockSize);
+      m_writer->Post([this, block]()
+      {
+         if (!m_failed && !m_out.Write(block->data(), block->size()))
+            m_failed = true;
+      });
+   }
+
+private:
+   File &m_out;
+   std::vector<char> m_block;                // Data waiting to be handed over.
+   std::unique_ptr<WorkerThread> m_writer;   // Started when there's a block to write.
+   std::atomic<bool> m_failed{false};
+};
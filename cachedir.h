@@ -0,0 +1,186 @@
+//--------------------------------------------------------------------
+// cachedir.h - Helpers for a directory of cache files that are named
+// after hashes and kept under a size budget.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <direct.h>
+#include <sys/utime.h>
+#include <process.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+
+//--------------------------------------------------------------------
+// CacheDirectory:  A directory of cache files, each named after the
+// 64-bit hash that's its key.  A new file is written under a temporary
+// name and renamed when it's finished, so that an interrupted program
+// can't leave a partial file in the cache, and so that threads or
+// processes adding the same file at once don't get in each other's
+// way.  Each time a cache file is used its time is updated, and when
+// a new one is added, the least recently used files are deleted until
+// the total size fits in the budget.  Several caches can share a
+// directory if their files have different extensions.
+//--------------------------------------------------------------------
+class CacheDirectory
+{
+public:
+   CacheDirectory() = delete;
+   CacheDirectory(const std::wstring &directory, const wchar_t *extension, std::uint64_t budget)
+      : m_directory(directory), m_extension(extension), m_budget(budget)
+   {
+      if (!m_directory.empty() && m_directory.back() != L'\\' && m_directory.back() != L'/')
+         m_directory += L'\\';
+   }
+
+   // Returns the name of the cache file for a key.
+   std::wstring EntryName(std::uint64_t key) const
+      { return m_directory + KeyName(key) + m_extension; }
+
+   // Returns a temporary name for a new cache file for a key, which no
+   // other thread or process will use.
+   std::wstring NewTempName(std::uint64_t key) const
+   {
+      static std::atomic<unsigned> counter(0);
+      return m_directory + KeyName(key) + L"." + std::to_wstring(_getpid()) + L"." +
+             std::to_wstring(counter++) + L".tmp";
+   }
+
+   // Creates the directory if it doesn't exist yet.
+   void Create() const { _wmkdir(m_directory.c_str()); }
+
+   // Marks a cache file as recently used.
+   static void Touch(const std::wstring &name) { _wutime(name.c_str(), nullptr); }
+
+   //--------------------------------------------------------------------
+   // Puts a finished cache file, written under its temporary name, into
+   // the cache, and trims the cache back to its budget.  Returns false
+   // if the file can't be renamed, in which case it's deleted.
+   //--------------------------------------------------------------------
+   bool Add(std::uint64_t key, const std::wstring &tempName) const
+   {
+      const std::wstring name = EntryName(key);
+      _wremove(name.c_str());
+      if (_wrename(tempName.c_str(), name.c_str()) != 0)
+      {
+         _wremove(tempName.c_str());
+         return false;
+      }
+      Trim(name);
+      return true;
+   }
+
+private:
+   //--------------------------------------------------------------------
+   // Deletes the least recently used cache files, other than the one
+   // named "keep", until the rest fit in the budget.
+   //--------------------------------------------------------------------
+   void Trim(const std::wstring &keep) const
+   {
+      struct Entry
+      {
+         std::wstring name;
+         std::uint64_t size;
+         __time64_t time;
+      };
+      std::vector<Entry> entries;
+      std::uint64_t total = 0;
+
+      _wfinddata64_t found;
+      const std::wstring pattern = m_directory + L"*" + m_extension;
+      const intptr_t search = _wfindfirst64(pattern.c_str(), &found);
+      if (search == -1)
+         return;
+      do
+      {
+         entries.push_back({ m_directory + found.name, static_cast<std::uint64_t>(found.size),
+                             found.time_write });
+         total += static_cast<std::uint64_t>(found.size);
+      }
+      while (_wfindnext64(search, &found) == 0);
+      _findclose(search);
+
+      std::sort(entries.begin(), entries.end(),
+                [](const Entry &a, const Entry &b) { return a.time < b.time; });
+      for (const auto &entry : entries)
+      {
+         if (total <= m_budget)
+            break;
+         if (entry.name != keep && _wremove(entry.name.c_str()) == 0)
+            total -= entry.size;
+      }
+   }
+
+   // The file name for a key, as 16 hex digits.
+   static std::wstring KeyName(std::uint64_t key)
+   {
+      wchar_t name[17];
+      for (int i = 15; i >= 0; --i, key >>= 4)
+         name[i] = L"0123456789abcdef"[key & 15];
+      name[16] = L'\0';
+      return name;
+   }
+
+   std::wstring m_directory;
+   std::wstring m_extension;
+   std::uint64_t m_budget = 0;
+};
+
+//--------------------------------------------------------------------
+// Copies a file with CopyFileW, which lets the system copy it in the
+// most efficient way, e.g. on the server for a network share, and
+// replaces any file already at the destination.  The copy is given the
+// current time, as if it had just been written.  Returns false if the
+// copy fails.
+//--------------------------------------------------------------------
+inline bool CopyWholeFile(const wchar_t *from, const wchar_t *to)
+{
+   if (!CopyFileW(from, to, FALSE))
+      return false;
+   _wutime(to, nullptr);
+   return true;
+}
@@ -0,0 +1,201 @@
+//--------------------------------------------------------------------
+// contenthash.h - Fast 64-bit hash of a file's contents, for
+// recognizing an input file that has been seen before.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "SimpleFile.h"
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+//--------------------------------------------------------------------
+// ContentHash:  Calculates the XXH64 hash of a stream of bytes that
+// is given in pieces of any size.  The four lanes of the hash are
+// independent of each other, so the processor can work on them at
+// the same time, and hashing runs at about the speed of memory.  It
+// isn't a cryptographic hash; it's only meant to tell files apart.
+//--------------------------------------------------------------------
+class ContentHash
+{
+public:
+   explicit ContentHash(std::uint64_t seed = 0)
+   {
+      m_lanes[0] = seed + prime1 + prime2;
+      m_lanes[1] = seed + prime2;
+      m_lanes[2] = seed;
+      m_lanes[3] = seed - prime1;
+      m_seed = seed;
+   }
+
+   //--------------------------------------------------------------------
+   // Adds the next numbytes bytes of the stream to the hash.
+   //--------------------------------------------------------------------
+   void Update(const void *data, size_t numbytes)
+   {
+      const std::uint8_t *p = static_cast<const std::uint8_t *>(data);
+      m_length += numbytes;
+
+      // Top up a partial stripe left over from last time.
+      if (m_buffered > 0)
+      {
+         const size_t n = std::min(numbytes, sizeof(m_buffer) - m_buffered);
+         memcpy(m_buffer + m_buffered, p, n);
+         m_buffered += n;
+         p += n;
+         numbytes -= n;
+         if (m_buffered < sizeof(m_buffer))
+            return;
+         Stripe(m_buffer);
+         m_buffered = 0;
+      }
+
+      // Hash whole 32 byte stripes straight from the caller's data.
+      for (; numbytes >= sizeof(m_buffer); p += sizeof(m_buffer), numbytes -= sizeof(m_buffer))
+         Stripe(p);
+
+      memcpy(m_buffer, p, numbytes);
+      m_buffered = numbytes;
+   }
+
+   //--------------------------------------------------------------------
+   // Returns the hash of everything given to Update so far.
+   //--------------------------------------------------------------------
+   std::uint64_t Digest() const
+   {
+      std::uint64_t h = 0;
+      if (m_length >= sizeof(m_buffer))
+      {
+         h = Rotate(m_lanes[0], 1) + Rotate(m_lanes[1], 7) +
+             Rotate(m_lanes[2], 12) + Rotate(m_lanes[3], 18);
+         for (const auto lane : m_lanes)
+            h = (h ^ Round(0, lane)) * prime1 + prime4;
+      }
+      else
+         h = m_seed + prime5;
+      h += m_length;
+
+      // Fold in the bytes that don't make a whole stripe.
+      const std::uint8_t *p = m_buffer;
+      size_t remaining = m_buffered;
+      for (; remaining >= 8; p += 8, remaining -= 8)
+         h = Rotate(h ^ Round(0, Load64(p)), 27) * prime1 + prime4;
+      if (remaining >= 4)
+      {
+         h = Rotate(h ^ (Load32(p) * prime1), 23) * prime2 + prime3;
+         p += 4;
+         remaining -= 4;
+      }
+      for (; remaining > 0; ++p, --remaining)
+         h = Rotate(h ^ (*p * prime5), 11) * prime1;
+
+      // Mix the bits so that every input bit affects every output bit.
+      h ^= h >> 33;
+      h *= prime2;
+      h ^= h >> 29;
+      h *= prime3;
+      h ^= h >> 32;
+      return h;
+   }
+
+private:
+   static constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ull;
+   static constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+   static constexpr std::uint64_t prime3 = 0x165667B19E3779F9ull;
+   static constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+   static constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+   static std::uint64_t Rotate(std::uint64_t x, int bits)
+      { return (x << bits) | (x >> (64 - bits)); }
+
+   static std::uint64_t Round(std::uint64_t lane, std::uint64_t input)
+      { return Rotate(lane + input * prime2, 31) * prime1; }
+
+   // The hash is defined on little-endian words.
+   static std::uint64_t Load64(const std::uint8_t *p)
+   {
+      std::uint64_t value = 0;
+      for (int i = 7; i >= 0; --i)
+         value = (value << 8) | p[i];
+      return value;
+   }
+
+   static std::uint64_t Load32(const std::uint8_t *p)
+      { return static_cast<std::uint64_t>(p[0]) | (static_cast<std::uint64_t>(p[1]) << 8) |
+               (static_cast<std::uint64_t>(p[2]) << 16) | (static_cast<std::uint64_t>(p[3]) << 24); }
+
+   void Stripe(const std::uint8_t *p)
+   {
+      for (int i = 0; i < 4; ++i)
+         m_lanes[i] = Round(m_lanes[i], Load64(p + 8 * i));
+   }
+
+   std::uint64_t m_lanes[4];
+   std::uint64_t m_seed = 0;
+   std::uint64_t m_length = 0;
+   std::uint8_t m_buffer[32];
+   size_t m_buffered = 0;
+};
+
+//--------------------------------------------------------------------
+// Hashes the whole of a file, reading it in large blocks.  The file
+// is left positioned at the start.  Throws if the file can't be read.
+//--------------------------------------------------------------------
+inline std::uint64_t HashFileContents(File &file, std::uint64_t seed = 0)
+{
+   // cppcheck-suppress assertWithSideEffect
+   assert(file.IsOpen());
+   if (!file.Seek(0))
+      throw "Failed seeking in input file.";
+
+   ContentHash hash(seed);
+   std::vector<std::uint8_t> block(1 << 20);
+   size_t numbytes = 0;
+   while ((numbytes = file.Read(block.data(), block.size())) > 0)
+      hash.Update(block.data(), numbytes);
+
+   if (!file.Seek(0))
+      throw "Failed seeking in input file.";
+   return hash.Digest();
+}
@@ -0,0 +1,1036 @@
+//--------------------------------------------------------------------
+// deflate.h - Compression and decompression in the "deflate" format
+// (RFC 1951) used by gzip files, plus the CRC-32 checksum that gzip
+// files carry.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Limitations / Bugs:
+// * The compressor is tuned for speed on text, roughly like gzip's
+//   default level.  It doesn't try fixed Huffman codes, so it does
+//   a little worse than gzip on very small inputs.
+//
+// Reference Material:
+//
+//  * https://www.ietf.org/rfc/rfc1951.txt
+//  * https://www.ietf.org/rfc/rfc1952.txt
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+//--------------------------------------------------------------------
+// Returns the CRC-32 of a block of data, as used by gzip and zip
+// files.  To checksum data that arrives in pieces, pass the CRC of
+// the earlier pieces as crc.
+//--------------------------------------------------------------------
+inline std::uint32_t Crc32(const void *data, size_t size, std::uint32_t crc = 0)
+{
+   struct Table
+   {
+      std::uint32_t m_entries[256];
+      Table()
+      {
+         for (std::uint32_t n = 0; n < 256; ++n)
+         {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+               c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            m_entries[n] = c;
+         }
+      }
+   };
+   static const Table table;
+
+   const std::uint8_t *p = static_cast<const std::uint8_t *>(data);
+   crc = ~crc;
+   for (size_t i = 0; i < size; ++i)
+      crc = table.m_entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+   return ~crc;
+}
+
+//--------------------------------------------------------------------
+// Given the CRC-32 of two pieces of data, and the length of the
+// second piece, returns the CRC-32 of the two pieces joined together.
+// This lets separate threads checksum separate pieces.  It works by
+// multiplying by matrices over GF(2), as described in zlib.
+//--------------------------------------------------------------------
+inline std::uint32_t Crc32Combine(std::uint32_t crc1, std::uint32_t crc2, std::uint64_t len2)
+{
+   if (len2 == 0)
+      return crc1;
+
+   auto times = [](const std::uint32_t *matrix, std::uint32_t vec)
+   {
+      std::uint32_t sum = 0;
+      for (; vec != 0; vec >>= 1, ++matrix)
+         if (vec & 1)
+            sum ^= *matrix;
+      return sum;
+   };
+   auto square = [&times](std::uint32_t *result, const std::uint32_t *matrix)
+   {
+      for (int n = 0; n < 32; ++n)
+         result[n] = times(matrix, matrix[n]);
+   };
+
+   // odd is the operator for one zero bit; square it to get the
+   // operators for two and four zero bits.
+   std::uint32_t even[32], odd[32];
+   odd[0] = 0xEDB88320u;
+   for (int n = 1; n < 32; ++n)
+      odd[n] = 1u << (n - 1);
+   square(even, odd);
+   square(odd, even);
+
+   // Apply len2 zero bytes to crc1, one bit of len2 at a time.
+   do
+   {
+      square(even, odd);
+      if (len2 & 1)
+         crc1 = times(even, crc1);
+      len2 >>= 1;
+      if (len2 == 0)
+         break;
+
+      square(odd, even);
+      if (len2 & 1)
+         crc1 = times(odd, crc1);
+      len2 >>= 1;
+   }
+   while (len2 != 0);
+
+   return crc1 ^ crc2;
+}
+
+//--------------------------------------------------------------------
+// Tables and helpers shared by the deflate compressor and
+// decompressor.
+//--------------------------------------------------------------------
+namespace DeflateFormat
+{
+   // Size of the window that distances can reach back into.
+   constexpr size_t windowSize = 32768;
+
+   // Shortest and longest matches.
+   constexpr size_t minMatch = 3;
+   constexpr size_t maxMatch = 258;
+
+   // Longest Huffman code for literals, lengths and distances, and for
+   // the code length alphabet.
+   constexpr unsigned maxCodeBits = 15;
+   constexpr unsigned maxCodeLengthBits = 7;
+
+   // Base values and extra bits for the length codes 257..285 and the
+   // distance codes 0..29.
+   constexpr std::uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
+      15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+   constexpr std::uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+      1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+   constexpr std::uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
+      33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+      4097, 6145, 8193, 12289, 16385, 24577 };
+   constexpr std::uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3,
+      4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+   // Order in which the code length code lengths are stored.
+   constexpr std::uint8_t codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6,
+      10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+   //--------------------------------------------------------------------
+   // Returns the lowest "bits" bits of code in reverse order, since
+   // Huffman codes are packed starting from their most significant bit.
+   //--------------------------------------------------------------------
+   inline std::uint32_t ReverseBits(std::uint32_t code, unsigned bits)
+   {
+      std::uint32_t result = 0;
+      for (unsigned i = 0; i < bits; ++i, code >>= 1)
+         result = (result << 1) | (code & 1);
+      return result;
+   }
+
+   //--------------------------------------------------------------------
+   // Assigns canonical Huffman codes to symbols with the given code
+   // lengths.  The codes are returned bit reversed, ready to write.
+   //--------------------------------------------------------------------
+   inline void HuffmanCodes(const std::uint8_t *lengths, size_t numSymbols, std::uint16_t *codes)
+   {
+      unsigned count[maxCodeBits + 1] = {};
+      for (size_t s = 0; s < numSymbols; ++s)
+         ++count[lengths[s]];
+      count[0] = 0;
+
+      unsigned next[maxCodeBits + 1] = {};
+      unsigned code = 0;
+      for (unsigned bits = 1; bits <= maxCodeBits; ++bits)
+      {
+         code = (code + count[bits - 1]) << 1;
+         next[bits] = code;
+      }
+
+      for (size_t s = 0; s < numSymbols; ++s)
+         codes[s] = lengths[s] ? static_cast<std::uint16_t>(ReverseBits(next[lengths[s]]++, lengths[s])) : 0;
+   }
+}
+
+//--------------------------------------------------------------------
+// Compresses data in the deflate format.
+//
+// The data is given as a buffer of dictionarySize bytes that were
+// already compressed (which matches may refer back to), followed by
+// size bytes to compress now.  The compressed blocks are appended to
+// out and end on a byte boundary with an empty stored block, like
+// zlib's Z_SYNC_FLUSH, and none is marked as the final block.  That
+// lets separately compressed pieces be joined into one stream, which
+// is then finished with DeflateFinish.
+//--------------------------------------------------------------------
+class Deflater
+{
+public:
+   Deflater(const Deflater &) = delete;
+   explicit Deflater(std::vector<std::uint8_t> &out) : m_out(out) { }
+
+   void Compress(const std::uint8_t *data, size_t dictionarySize, size_t size)
+   {
+      FindMatches(data, dictionarySize, dictionarySize + size);
+
+      // Write the matches in blocks, each with its own Huffman codes.
+      const std::uint8_t *raw = data + dictionarySize;
+      for (size_t begin = 0; begin < m_symbols.size(); )
+      {
+         const size_t end = std::min(begin + maxSymbolsPerBlock, m_symbols.size());
+         size_t rawSize = 0;
+         for (size_t i = begin; i < end; ++i)
+            rawSize += m_symbols[i].m_dist ? m_symbols[i].m_litLen : 1;
+
+         WriteBlock(begin, end, raw, rawSize);
+         raw += rawSize;
+         begin = end;
+      }
+
+      // Align to a byte with an empty stored block.
+      PutBits(0, 3);
+      PutStored(nullptr, 0);
+   }
+
+private:
+   // A literal byte (m_dist is zero) or a match of m_litLen bytes.
+   struct Symbol
+   {
+      std::uint16_t m_litLen;
+      std::uint16_t m_dist;
+   };
+
+   static constexpr size_t maxSymbolsPerBlock = 32768;
+   static constexpr unsigned hashBits = 15;
+   static constexpr size_t maxChain = 128;     // Most match candidates to try.
+   static constexpr size_t niceMatch = 128;    // Stop looking after a match this long.
+   static constexpr size_t lazyMatch = 32;     // Look one byte ahead for shorter matches.
+
+   //--------------------------------------------------------------------
+   // Runs the LZ77 match finder over data[begin, end), recording the
+   // literals and matches in m_symbols.  Uses hash chains with one
+   // byte of lazy evaluation, like zlib.
+   //--------------------------------------------------------------------
+   void FindMatches(const std::uint8_t *data, size_t begin, size_t end)
+   {
+      m_symbols.clear();
+      m_head.assign(size_t(1) << hashBits, -1);
+      m_prev.assign(end, -1);
+
+      size_t inserted = 0;
+      auto insertUpTo = [&](size_t pos)
+      {
+         for (; inserted < pos && inserted + 2 < end; ++inserted)
+         {
+            const std::uint32_t h = Hash(data + inserted);
+            m_prev[inserted] = m_head[h];
+            m_head[h] = static_cast<std::int32_t>(inserted);
+         }
+         inserted = std::max(inserted, pos);
+      };
+
+      size_t pos = begin;
+      size_t len = 0, dist = 0;
+      bool haveMatch = false;
+      while (pos < end)
+      {
+         if (!haveMatch)
+         {
+            insertUpTo(pos);
+            FindLongestMatch(data, pos, end, len, dist);
+         }
+         haveMatch = false;
+
+         if (len >= DeflateFormat::minMatch && len < lazyMatch && pos + 1 < end)
+         {
+            // A longer match starting at the next byte beats this one.
+            size_t nextLen = 0, nextDist = 0;
+            insertUpTo(pos + 1);
+            FindLongestMatch(data, pos + 1, end, nextLen, nextDist);
+            if (nextLen > len)
+            {
+               AddSymbol(data[pos], 0);
+               ++pos;
+               len = nextLen;
+               dist = nextDist;
+               haveMatch = true;
+               continue;
+            }
+         }
+
+         if (len >= DeflateFormat::minMatch)
+         {
+            AddSymbol(len, dist);
+            pos += len;
+         }
+         else
+         {
+            AddSymbol(data[pos], 0);
+            ++pos;
+         }
+      }
+   }
+
+   // Returns the hash of the three bytes at p.
+   static std::uint32_t Hash(const std::uint8_t *p)
+   {
+      const std::uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+      return (v * 2654435761u) >> (32 - hashBits);
+   }
+
+   //--------------------------------------------------------------------
+   // Finds the longest earlier match for the bytes at pos, following
+   // the hash chain.  Returns a length of zero if there is none.
+   //--------------------------------------------------------------------
+   void FindLongestMatch(const std::uint8_t *data, size_t pos, size_t end, size_t &len, size_t &dist)
+   {
+      len = dist = 0;
+      const size_t maxLen = std::min(DeflateFormat::maxMatch, end - pos);
+      if (maxLen < DeflateFormat::minMatch)
+         return;
+
+      size_t best = DeflateFormat::minMatch - 1;
+      size_t chain = maxChain;
+      for (std::int32_t cand = m_head[Hash(data + pos)];
+           cand >= 0 && pos - static_cast<size_t>(cand) <= DeflateFormat::windowSize && chain-- > 0;
+           cand = m_prev[static_cast<size_t>(cand)])
+      {
+         const std::uint8_t *a = data + cand;
+         const std::uint8_t *b = data + pos;
+         if (a[best] != b[best])
+            continue;
+
+         size_t n = 0;
+         while (n < maxLen && a[n] == b[n])
+            ++n;
+         if (n > best)
+         {
+            best = n;
+            dist = pos - static_cast<size_t>(cand);
+            if (n >= niceMatch || n == maxLen)
+               break;
+         }
+      }
+
+      if (best >= DeflateFormat::minMatch)
+         len = best;
+      else
+         dist = 0;
+   }
+
+   void AddSymbol(size_t litLen, size_t dist)
+   {
+      Symbol symbol;
+      symbol.m_litLen = static_cast<std::uint16_t>(litLen);
+      symbol.m_dist = static_cast<std::uint16_t>(dist);
+      m_symbols.push_back(symbol);
+   }
+
+   //--------------------------------------------------------------------
+   // Returns the length code (0..28, for symbols 257..285) and the
+   // distance code for a match.
+   //--------------------------------------------------------------------
+   static unsigned LengthCode(size_t len)
+   {
+      unsigned code = 28;
+      while (DeflateFormat::lengthBase[code] > len)
+         --code;
+      return code;
+   }
+   static unsigned DistCode(size_t dist)
+   {
+      unsigned code = 29;
+      while (DeflateFormat::distBase[code] > dist)
+         --code;
+      return code;
+   }
+
+   //--------------------------------------------------------------------
+   // Calculates Huffman code lengths, no longer than maxBits, for
+   // symbols with the given frequencies.  Always gives at least two
+   // symbols a code, since some decoders reject a code with only one.
+   //--------------------------------------------------------------------
+   static void HuffmanLengths(const std::uint32_t *freq, size_t numSymbols, unsigned maxBits, std::uint8_t *lengths)
+   {
+      std::vector<std::uint32_t> symbols;
+      for (size_t s = 0; s < numSymbols; ++s)
+      {
+         lengths[s] = 0;
+         if (freq[s] != 0)
+            symbols.push_back(static_cast<std::uint32_t>(s));
+      }
+      for (std::uint32_t s = 0; symbols.size() < 2; ++s)
+         if (freq[s] == 0)
+            symbols.push_back(s);
+      std::sort(symbols.begin(), symbols.end(), [freq](std::uint32_t a, std::uint32_t b)
+         { return freq[a] != freq[b] ? freq[a] < freq[b] : a < b; });
+
+      // Build the tree with two queues:  the sorted leaves, and the
+      // internal nodes, which are made in order of increasing weight.
+      const size_t n = symbols.size();
+      std::vector<std::uint64_t> weight(2 * n - 1);
+      std::vector<size_t> parent(2 * n - 1, 0);
+      for (size_t i = 0; i < n; ++i)
+         weight[i] = freq[symbols[i]];
+      size_t leaf = 0, node = n;
+      for (size_t next = n; next < 2 * n - 1; ++next)
+      {
+         size_t pick[2];
+         for (auto &p : pick)
+            p = (leaf < n && (node >= next || weight[leaf] <= weight[node])) ? leaf++ : node++;
+         weight[next] = weight[pick[0]] + weight[pick[1]];
+         parent[pick[0]] = parent[pick[1]] = next;
+      }
+
+      // Children always come before their parents, so depths can be
+      // worked out from the root down.
+      std::vector<unsigned> depth(2 * n - 1, 0);
+      std::vector<unsigned> count(n + 1, 0);
+      for (size_t i = 2 * n - 2; i-- > 0; )
+         depth[i] = depth[parent[i]] + 1;
+      for (size_t i = 0; i < n; ++i)
+         ++count[depth[i]];
+
+      // Squeeze codes that are too long down to maxBits, then lengthen
+      // shorter codes until the lengths describe a complete code again.
+      if (count.size() <= maxBits)
+         count.resize(maxBits + 1, 0);
+      for (size_t bits = maxBits + 1; bits < count.size(); ++bits)
+      {
+         count[maxBits] += count[bits];
+         count[bits] = 0;
+      }
+      std::uint64_t total = 0;
+      for (unsigned bits = 1; bits <= maxBits; ++bits)
+         total += static_cast<std::uint64_t>(count[bits]) << (maxBits - bits);
+      while (total > (std::uint64_t(1) << maxBits))
+      {
+         --count[maxBits];
+         for (unsigned bits = maxBits - 1; bits > 0; --bits)
+         {
+            if (count[bits] != 0)
+            {
+               --count[bits];
+               count[bits + 1] += 2;
+               break;
+            }
+         }
+         --total;
+      }
+
+      // The least frequent symbols get the longest codes.
+      size_t i = 0;
+      for (unsigned bits = maxBits; bits > 0; --bits)
+         for (unsigned c = 0; c < count[bits]; ++c)
+            lengths[symbols[i++]] = static_cast<std::uint8_t>(bits);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes m_symbols[begin, end) as one block with dynamic Huffman
+   // codes, or as stored blocks if that turns out smaller.  raw points
+   // to the rawSize bytes of input that the symbols encode.
+   //--------------------------------------------------------------------
+   void WriteBlock(size_t begin, size_t end, const std::uint8_t *raw, size_t rawSize)
+   {
+      using namespace DeflateFormat;
+
+      std::uint32_t litFreq[286] = {}, distFreq[30] = {};
+      for (size_t i = begin; i < end; ++i)
+      {
+         const Symbol &s = m_symbols[i];
+         if (s.m_dist == 0)
+            ++litFreq[s.m_litLen];
+         else
+         {
+            ++litFreq[257 + LengthCode(s.m_litLen)];
+            ++distFreq[DistCode(s.m_dist)];
+         }
+      }
+      litFreq[256] = 1;
+
+      std::uint8_t litLengths[286], distLengths[30];
+      HuffmanLengths(litFreq, 286, maxCodeBits, litLengths);
+      HuffmanLengths(distFreq, 30, maxCodeBits, distLengths);
+
+      size_t numLit = 286, numDist = 30;
+      while (numLit > 257 && litLengths[numLit - 1] == 0)
+         --numLit;
+      while (numDist > 1 && distLengths[numDist - 1] == 0)
+         --numDist;
+
+      // Run-length encode the code lengths with symbols 16, 17 and 18.
+      std::uint8_t lengths[286 + 30];
+      std::memcpy(lengths, litLengths, numLit);
+      std::memcpy(lengths + numLit, distLengths, numDist);
+      const size_t numLengths = numLit + numDist;
+      std::vector<std::uint8_t> clSymbols, clExtra;
+      for (size_t i = 0; i < numLengths; )
+      {
+         const std::uint8_t len = lengths[i];
+         size_t run = 1;
+         while (i + run < numLengths && lengths[i + run] == len)
+            ++run;
+         i += run;
+
+         if (len == 0)
+         {
+            while (run >= 11)
+            {
+               const size_t n = std::min<size_t>(run, 138);
+               clSymbols.push_back(18);
+               clExtra.push_back(static_cast<std::uint8_t>(n - 11));
+               run -= n;
+            }
+            if (run >= 3)
+            {
+               clSymbols.push_back(17);
+               clExtra.push_back(static_cast<std::uint8_t>(run - 3));
+               run = 0;
+            }
+         }
+         else
+         {
+            clSymbols.push_back(len);
+            clExtra.push_back(0);
+            --run;
+            while (run >= 3)
+            {
+               const size_t n = std::min<size_t>(run, 6);
+               clSymbols.push_back(16);
+               clExtra.push_back(static_cast<std::uint8_t>(n - 3));
+               run -= n;
+            }
+         }
+         for (; run > 0; --run)
+         {
+            clSymbols.push_back(len);
+            clExtra.push_back(0);
+         }
+      }
+
+      std::uint32_t clFreq[19] = {};
+      for (auto s : clSymbols)
+         ++clFreq[s];
+      std::uint8_t clLengths[19];
+      HuffmanLengths(clFreq, 19, maxCodeLengthBits, clLengths);
+      size_t numCl = 19;
+      while (numCl > 4 && clLengths[codeLengthOrder[numCl - 1]] == 0)
+         --numCl;
+
+      // Work out the size of the block to compare with storing it.
+      static const std::uint8_t clExtraBits[19] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+      std::uint64_t bits = 3 + 5 + 5 + 4 + 3 * numCl;
+      for (auto s : clSymbols)
+         bits += clLengths[s] + clExtraBits[s];
+      for (size_t s = 0; s < 286; ++s)
+         bits += static_cast<std::uint64_t>(litFreq[s]) * (litLengths[s] + (s > 256 ? lengthExtra[s - 257] : 0));
+      for (size_t s = 0; s < 30; ++s)
+         bits += static_cast<std::uint64_t>(distFreq[s]) * (distLengths[s] + distExtra[s]);
+      const std::uint64_t storedBits = (rawSize / 65535 + 1) * (3 + 7 + 32) + 8 * static_cast<std::uint64_t>(rawSize);
+      if (storedBits < bits)
+      {
+         for (size_t done = 0; done < rawSize; )
+         {
+            const size_t n = std::min<size_t>(rawSize - done, 65535);
+            PutBits(0, 3);
+            PutStored(raw + done, n);
+            done += n;
+         }
+         return;
+      }
+
+      std::uint16_t litCodes[286], distCodes[30], clCodes[19];
+      HuffmanCodes(litLengths, 286, litCodes);
+      HuffmanCodes(distLengths, 30, distCodes);
+      HuffmanCodes(clLengths, 19, clCodes);
+
+      // Block header:  not final, dynamic Huffman codes.
+      PutBits(2 << 1, 3);
+      PutBits(static_cast<std::uint32_t>(numLit - 257), 5);
+      PutBits(static_cast<std::uint32_t>(numDist - 1), 5);
+      PutBits(static_cast<std::uint32_t>(numCl - 4), 4);
+      for (size_t i = 0; i < numCl; ++i)
+         PutBits(clLengths[codeLengthOrder[i]], 3);
+      for (size_t i = 0; i < clSymbols.size(); ++i)
+      {
+         const std::uint8_t s = clSymbols[i];
+         PutBits(clCodes[s], clLengths[s]);
+         if (clExtraBits[s] != 0)
+            PutBits(clExtra[i], clExtraBits[s]);
+      }
+
+      for (size_t i = begin; i < end; ++i)
+      {
+         const Symbol &s = m_symbols[i];
+         if (s.m_dist == 0)
+         {
+            PutBits(litCodes[s.m_litLen], litLengths[s.m_litLen]);
+            continue;
+         }
+         const unsigned lc = LengthCode(s.m_litLen);
+         PutBits(litCodes[257 + lc], litLengths[257 + lc]);
+         PutBits(s.m_litLen - lengthBase[lc], lengthExtra[lc]);
+         const unsigned dc = DistCode(s.m_dist);
+         PutBits(distCodes[dc], distLengths[dc]);
+         PutBits(s.m_dist - distBase[dc], distExtra[dc]);
+      }
+      PutBits(litCodes[256], litLengths[256]);
+   }
+
+   // Appends bits to the output, least significant bit first.
+   void PutBits(std::uint32_t bits, unsigned count)
+   {
+      m_bits |= static_cast<std::uint64_t>(bits) << m_numBits;
+      m_numBits += count;
+      while (m_numBits >= 8)
+      {
+         m_out.push_back(static_cast<std::uint8_t>(m_bits));
+         m_bits >>= 8;
+         m_numBits -= 8;
+      }
+   }
+
+   // Finishes a stored block whose header has been written.
+   void PutStored(const std::uint8_t *data, size_t size)
+   {
+      if (m_numBits > 0)
+         PutBits(0, 8 - m_numBits);
+      const std::uint8_t header[4] = { static_cast<std::uint8_t>(size), static_cast<std::uint8_t>(size >> 8),
+                                       static_cast<std::uint8_t>(~size), static_cast<std::uint8_t>(~size >> 8) };
+      m_out.insert(m_out.end(), header, header + 4);
+      if (size > 0)
+         m_out.insert(m_out.end(), data, data + size);
+   }
+
+private:
+   std::vector<std::uint8_t> &m_out;
+   std::uint64_t m_bits = 0;
+   unsigned m_numBits = 0;
+   std::vector<Symbol> m_symbols;
+   std::vector<std::int32_t> m_head;
+   std::vector<std::int32_t> m_prev;
+};
+
+//--------------------------------------------------------------------
+// Appends the end of a deflate stream made of pieces written by
+// Deflater:  an empty final block with fixed Huffman codes.
+//--------------------------------------------------------------------
+inline void DeflateFinish(std::vector<std::uint8_t> &out)
+{
+   out.push_back(0x03);
+   out.push_back(0x00);
+}
+
+//--------------------------------------------------------------------
+// Inflater:  Decompresses a deflate stream.  The compressed data is
+// pulled in as needed through a read function, and the decompressed
+// data is handed out in pieces of whatever size the caller asks for,
+// so that neither has to fit in memory.  Corrupt data throws a string.
+//--------------------------------------------------------------------
+class Inflater
+{
+public:
+   // Reads up to size bytes of compressed data into data, returning
+   // the number read, which is zero at the end of the input.
+   typedef std::function<size_t(void *data, size_t size)> ReadFunction;
+
+   Inflater() = delete;
+   Inflater(const Inflater &) = delete;
+   explicit Inflater(const ReadFunction &read) : m_read(read), m_window(DeflateFormat::windowSize) { }
+
+   //--------------------------------------------------------------------
+   // Decompresses up to size bytes into out.  Returns the number of
+   // bytes produced, which is less than size only at the end of the
+   // deflate stream.
+   //--------------------------------------------------------------------
+   size_t Inflate(std::uint8_t *out, size_t size)
+   {
+      using namespace DeflateFormat;
+      size_t produced = 0;
+      while (produced < size)
+      {
+         // Finish copying a match.
+         if (m_copyLength > 0)
+         {
+            const size_t n = std::min(m_copyLength, size - produced);
+            for (size_t i = 0; i < n; ++i)
+               out[produced++] = Put(m_window[(m_windowPos - m_copyDistance) & windowMask]);
+            m_copyLength -= n;
+            continue;
+         }
+
+         if (m_state == State::Done)
+            break;
+         else if (m_state == State::BlockHeader)
+            ReadBlockHeader();
+         else if (m_state == State::Stored)
+         {
+            if (m_storedLeft == 0)
+            {
+               m_state = State::BlockHeader;
+               continue;
+            }
+            const size_t n = std::min(m_storedLeft, size - produced);
+            for (size_t i = 0; i < n; ++i)
+               out[produced++] = Put(ReadByte());
+            m_storedLeft -= n;
+         }
+         else
+         {
+            const unsigned symbol = Decode(m_litTable);
+            if (symbol < 256)
+               out[produced++] = Put(static_cast<std::uint8_t>(symbol));
+            else if (symbol == 256)
+               m_state = State::BlockHeader;
+            else
+            {
+               if (symbol > 285)
+                  throw "Bad length code in compressed data.";
+               const unsigned lc = symbol - 257;
+               m_copyLength = lengthBase[lc] + GetBits(lengthExtra[lc]);
+               const unsigned dc = Decode(m_distTable);
+               if (dc > 29)
+                  throw "Bad distance code in compressed data.";
+               m_copyDistance = distBase[dc] + GetBits(distExtra[dc]);
+               if (m_copyDistance > m_totalOut)
+                  throw "Distance too far back in compressed data.";
+            }
+         }
+      }
+      return produced;
+   }
+
+   // Returns true once the final block of the stream has been read.
+   bool Finished() const { return m_state == State::Done && m_copyLength == 0; }
+
+   //--------------------------------------------------------------------
+   // Skips to the next byte boundary and returns the next byte of
+   // input, for reading what follows the deflate stream (such as a
+   // gzip trailer).  Throws if there are no more bytes.
+   //--------------------------------------------------------------------
+   std::uint8_t ReadAlignedByte()
+   {
+      DropBits(m_numBits % 8);
+      return ReadByte();
+   }
+
+   // Returns true if all of the input has been used up.
+   bool AtEndOfInput()
+   {
+      DropBits(m_numBits % 8);
+      return m_numBits == 0 && !FillInput();
+   }
+
+   // Gets ready to decompress another deflate stream that follows the
+   // current one in the input.
+   void Restart()
+   {
+      m_state = State::BlockHeader;
+      m_final = false;
+      m_totalOut = 0;
+      m_copyLength = 0;
+   }
+
+private:
+   static constexpr size_t windowMask = DeflateFormat::windowSize - 1;
+
+   // A table for decoding a Huffman code with one lookup.  Each entry,
+   // indexed by the next m_bits bits of input, holds the symbol shifted
+   // left by four plus the length of its code (zero if invalid).
+   struct HuffmanTable
+   {
+      std::vector<std::uint16_t> m_entries;
+      unsigned m_bits = 0;
+   };
+
+   enum class State { BlockHeader, Stored, Huffman, Done };
+
+   // Records an output byte in the window and returns it.
+   std::uint8_t Put(std::uint8_t byte)
+   {
+      m_window[m_windowPos++ & windowMask] = byte;
+      ++m_totalOut;
+      return byte;
+   }
+
+   //--------------------------------------------------------------------
+   // Builds a decoding table from code lengths.  Incomplete codes are
+   // allowed, since a stream with at most one distance may use one.
+   //--------------------------------------------------------------------
+   static void BuildTable(const std::uint8_t *lengths, size_t numSymbols, HuffmanTable &table)
+   {
+      unsigned count[DeflateFormat::maxCodeBits + 1] = {};
+      unsigned maxLength = 0;
+      for (size_t s = 0; s < numSymbols; ++s)
+      {
+         ++count[lengths[s]];
+         maxLength = std::max<unsigned>(maxLength, lengths[s]);
+      }
+
+      int left = 1;
+      for (unsigned bits = 1; bits <= DeflateFormat::maxCodeBits; ++bits)
+      {
+         left = (left << 1) - static_cast<int>(count[bits]);
+         if (left < 0)
+            throw "Bad Huffman code in compressed data.";
+      }
+
+      std::vector<std::uint16_t> codes(numSymbols);
+      DeflateFormat::HuffmanCodes(lengths, numSymbols, codes.data());
+      table.m_bits = std::max(maxLength, 1u);
+      table.m_entries.assign(size_t(1) << table.m_bits, 0);
+      for (size_t s = 0; s < numSymbols; ++s)
+      {
+         const unsigned length = lengths[s];
+         if (length == 0)
+            continue;
+         const std::uint16_t entry = static_cast<std::uint16_t>((s << 4) | length);
+         for (size_t i = codes[s]; i < table.m_entries.size(); i += size_t(1) << length)
+            table.m_entries[i] = entry;
+      }
+   }
+
+   // Decodes one symbol using a Huffman table.
+   unsigned Decode(const HuffmanTable &table)
+   {
+      NeedBits(table.m_bits);
+      const std::uint16_t entry = table.m_entries[m_bits & ((std::uint64_t(1) << table.m_bits) - 1)];
+      const unsigned length = entry & 15;
+      if (length == 0)
+         throw "Bad Huffman code in compressed data.";
+      DropBits(length);
+      return entry >> 4;
+   }
+
+   //--------------------------------------------------------------------
+   // Reads the header of the next block, and its Huffman codes if it
+   // has any.
+   //--------------------------------------------------------------------
+   void ReadBlockHeader()
+   {
+      if (m_final)
+      {
+         m_state = State::Done;
+         return;
+      }
+      m_final = GetBits(1) != 0;
+
+      switch (GetBits(2))
+      {
+         case 0:
+         {
+            DropBits(m_numBits % 8);
+            const unsigned len = GetBits(16);
+            const unsigned nlen = GetBits(16);
+            if ((len ^ 0xFFFF) != nlen)
+               throw "Bad stored block length in compressed data.";
+            m_storedLeft = len;
+            m_state = State::Stored;
+            break;
+         }
+
+         case 1:
+         {
+            std::uint8_t lengths[288 + 32];
+            std::fill(lengths, lengths + 144, std::uint8_t(8));
+            std::fill(lengths + 144, lengths + 256, std::uint8_t(9));
+            std::fill(lengths + 256, lengths + 280, std::uint8_t(7));
+            std::fill(lengths + 280, lengths + 288, std::uint8_t(8));
+            std::fill(lengths + 288, lengths + 320, std::uint8_t(5));
+            BuildTable(lengths, 288, m_litTable);
+            BuildTable(lengths + 288, 32, m_distTable);
+            m_state = State::Huffman;
+            break;
+         }
+
+         case 2:
+            ReadDynamicTables();
+            m_state = State::Huffman;
+            break;
+
+         default:
+            throw "Bad block type in compressed data.";
+      }
+   }
+
+   // Reads the Huffman codes at the start of a dynamic block.
+   void ReadDynamicTables()
+   {
+      const unsigned numLit = GetBits(5) + 257;
+      const unsigned numDist = GetBits(5) + 1;
+      const unsigned numCl = GetBits(4) + 4;
+      if (numLit > 286 || numDist > 30)
+         throw "Bad code counts in compressed data.";
+
+      std::uint8_t clLengths[19] = {};
+      for (unsigned i = 0; i < numCl; ++i)
+         clLengths[DeflateFormat::codeLengthOrder[i]] = static_cast<std::uint8_t>(GetBits(3));
+      HuffmanTable clTable;
+      BuildTable(clLengths, 19, clTable);
+
+      std::uint8_t lengths[286 + 30] = {};
+      for (unsigned i = 0; i < numLit + numDist; )
+      {
+         const unsigned symbol = Decode(clTable);
+         unsigned repeat = 1;
+         std::uint8_t value = static_cast<std::uint8_t>(symbol);
+         if (symbol == 16)
+         {
+            if (i == 0)
+               throw "Bad code lengths in compressed data.";
+            value = lengths[i - 1];
+            repeat = 3 + GetBits(2);
+         }
+         else if (symbol == 17)
+         {
+            value = 0;
+            repeat = 3 + GetBits(3);
+         }
+         else if (symbol == 18)
+         {
+            value = 0;
+            repeat = 11 + GetBits(7);
+         }
+         if (i + repeat > numLit + numDist)
+            throw "Bad code lengths in compressed data.";
+         for (; repeat > 0; --repeat)
+            lengths[i++] = value;
+      }
+      if (lengths[256] == 0)
+         throw "Missing end of block code in compressed data.";
+
+      BuildTable(lengths, numLit, m_litTable);
+      BuildTable(lengths + numLit, numDist, m_distTable);
+   }
+
+   //--------------------------------------------------------------------
+   // Bit level input.  Bits come out least significant first.  Past the
+   // end of the input, zero bytes are supplied so that a code near the
+   // end can be looked up, but using any of them is an error.
+   //--------------------------------------------------------------------
+   bool FillInput()
+   {
+      if (m_inputPos < m_inputSize)
+         return true;
+      m_input.resize(65536);
+      m_inputSize = m_read(m_input.data(), m_input.size());
+      m_inputPos = 0;
+      return m_inputSize > 0;
+   }
+
+   void NeedBits(unsigned count)
+   {
+      while (m_numBits < count)
+      {
+         std::uint64_t byte = 0;
+         if (FillInput())
+            byte = m_input[m_inputPos++];
+         else
+            ++m_padding;
+         m_bits |= byte << m_numBits;
+         m_numBits += 8;
+      }
+   }
+
+   void DropBits(unsigned count)
+   {
+      m_bits >>= count;
+      m_numBits -= count;
+      if (m_numBits < 8 * m_padding)
+         throw "Unexpected end of compressed data.";
+   }
+
+   unsigned GetBits(unsigned count)
+   {
+      if (count == 0)
+         return 0;
+      NeedBits(count);
+      const unsigned value = static_cast<unsigned>(m_bits & ((std::uint64_t(1) << count) - 1));
+      DropBits(count);
+      return value;
+   }
+
+   std::uint8_t ReadByte()
+   {
+      return static_cast<std::uint8_t>(GetBits(8));
+   }
+
+private:
+   ReadFunction m_read;
+   std::vector<std::uint8_t> m_input;     // Buffered compressed data.
+   size_t m_inputSize = 0;
+   size_t m_inputPos = 0;
+   std::uint64_t m_bits = 0;              // Bits taken from m_input but not used yet.
+   unsigned m_numBits = 0;
+   unsigned m_padding = 0;                // Zero bytes added past the end of the input.
+
+   State m_state = State::BlockHeader;
+   bool m_final = false;                  // Current block is the last one.
+   size_t m_storedLeft = 0;               // Bytes left in a stored block.
+   size_t m_copyLength = 0;               // Bytes left to copy from a match.
+   size_t m_copyDistance = 0;
+   HuffmanTable m_litTable;
+   HuffmanTable m_distTable;
+
+   std::vector<std::uint8_t> m_window;    // The last 32KB of output.
+   size_t m_windowPos = 0;
+   std::uint64_t m_totalOut = 0;
+};
@@ -0,0 +1,251 @@
+//--------------------------------------------------------------------
+// directfile.h - File class that reads and writes without going
+// through the system's file cache.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#include <string.h>
+#include <algorithm>
+#include "SimpleFile.h"
+
+//--------------------------------------------------------------------
+// DirectFile:  A File that's opened with FILE_FLAG_NO_BUFFERING, so
+// that reading or writing a huge file doesn't push everything else out
+// of the system's file cache.  Windows then only reads and writes
+// whole sectors, at positions that are a multiple of the sector size,
+// from memory that's aligned the same way, so the data goes through a
+// large aligned buffer here instead.
+//
+// A file opened for reading may seek anywhere.  A file created for
+// writing is written from start to end only; it can't seek or be read
+// back, so it can't be used for formats that go back to their header
+// at the end.  The last part of it, which usually doesn't fill a whole
+// sector, is written padded out to one, and the file is then cut back
+// to its true length.  Finish must be called to write that part.
+//--------------------------------------------------------------------
+class DirectFile : public File
+{
+public:
+   DirectFile() = default;
+   DirectFile(const DirectFile &) = delete;
+   ~DirectFile() { Close(); }
+
+   // Open file for reading.
+   bool Open(const wchar_t *filename)
+   {
+      Close();
+      m_handle = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      LARGE_INTEGER size = {};
+      if (m_handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_handle, &size) || !AllocateBuffer())
+      {
+         Close();
+         return false;
+      }
+      m_length = static_cast<size_t>(size.QuadPart);
+      m_writing = false;
+      return true;
+   }
+
+   // Open file for writing, from start to end.
+   bool Create(const wchar_t *filename)
+   {
+      Close();
+      m_handle = CreateFileW(filename, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                             FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (m_handle == INVALID_HANDLE_VALUE || !AllocateBuffer())
+      {
+         Close();
+         return false;
+      }
+      m_writing = true;
+      return true;
+   }
+
+   bool IsOpen() override { return m_handle != INVALID_HANDLE_VALUE; }
+
+   void Close() override
+   {
+      if (m_handle != INVALID_HANDLE_VALUE)
+      {
+         Finish();
+         CloseHandle(m_handle);
+         m_handle = INVALID_HANDLE_VALUE;
+      }
+      _aligned_free(m_buffer);
+      m_buffer = nullptr;
+      m_bufferStart = m_bufferUsed = m_position = m_length = 0;
+      m_writing = m_failed = m_finished = false;
+   }
+
+   // Seek to specific position in a file opened for reading.
+   bool Seek(size_t position) override
+   {
+      if (m_writing || !IsOpen())
+         return false;
+      m_position = position;
+      return true;
+   }
+
+   // Read numbytes of data from file.  Returns number of bytes actually read.
+   size_t Read(void *data, size_t numbytes) override
+   {
+      if (m_writing || !IsOpen())
+         return 0;
+      char *p = static_cast<char *>(data);
+      size_t total = 0;
+      while (total < numbytes)
+      {
+         if (m_position < m_bufferStart || m_position >= m_bufferStart + m_bufferUsed)
+         {
+            if (!FillBuffer())
+               break;
+         }
+         const size_t offset = m_position - m_bufferStart;
+         const size_t n = std::min(numbytes - total, m_bufferUsed - offset);
+         memcpy(p + total, m_buffer + offset, n);
+         m_position += n;
+         total += n;
+      }
+      return total;
+   }
+
+   // Write numbytes of data to file.  Returns true if successful.
+   bool Write(const void *data, size_t numbytes) override
+   {
+      if (!m_writing || m_finished || m_failed)
+         return false;
+      const char *p = static_cast<const char *>(data);
+      m_length += numbytes;
+      while (numbytes > 0 && !m_failed)
+      {
+         const size_t n = std::min(numbytes, bufferSize - m_bufferUsed);
+         memcpy(m_buffer + m_bufferUsed, p, n);
+         m_bufferUsed += n;
+         p += n;
+         numbytes -= n;
+         if (m_bufferUsed == bufferSize)
+         {
+            m_failed = !WriteBuffer(bufferSize);
+            m_bufferUsed = 0;
+         }
+      }
+      return !m_failed;
+   }
+
+   // Retrieve length of file in bytes.
+   size_t Length() override { return m_length; }
+
+   //--------------------------------------------------------------------
+   // Writes the last part of a file that's being written, and cuts the
+   // file back to the length of what was written.  Returns true if
+   // everything was written successfully.
+   //--------------------------------------------------------------------
+   bool Finish()
+   {
+      if (!m_writing || m_finished)
+         return !m_failed;
+      m_finished = true;
+      if (m_bufferUsed > 0 && !m_failed)
+      {
+         const size_t padded = (m_bufferUsed + alignment - 1) / alignment * alignment;
+         memset(m_buffer + m_bufferUsed, 0, padded - m_bufferUsed);
+         m_failed = !WriteBuffer(padded);
+         m_bufferUsed = 0;
+      }
+      LARGE_INTEGER end = {};
+      end.QuadPart = static_cast<LONGLONG>(m_length);
+      if (!m_failed && !(SetFilePointerEx(m_handle, end, nullptr, FILE_BEGIN) && SetEndOfFile(m_handle)))
+         m_failed = true;
+      return !m_failed;
+   }
+
+private:
+   // Sector sizes are at most this, and the others divide it evenly.
+   static constexpr size_t alignment = 4096;
+
+   // Amount read or written at a time.  A multiple of the alignment.
+   static constexpr size_t bufferSize = 1 << 20;
+
+   bool AllocateBuffer()
+   {
+      m_buffer = static_cast<char *>(_aligned_malloc(bufferSize, alignment));
+      return m_buffer != nullptr;
+   }
+
+   // Reads the aligned block that holds the current position.
+   // Returns false at the end of the file or if the read fails.
+   bool FillBuffer()
+   {
+      LARGE_INTEGER start = {};
+      start.QuadPart = static_cast<LONGLONG>(m_position / alignment * alignment);
+      DWORD got = 0;
+      if (!SetFilePointerEx(m_handle, start, nullptr, FILE_BEGIN) ||
+          !ReadFile(m_handle, m_buffer, static_cast<DWORD>(bufferSize), &got, nullptr))
+         got = 0;
+      m_bufferStart = static_cast<size_t>(start.QuadPart);
+      m_bufferUsed = got;
+      return m_position < m_bufferStart + m_bufferUsed;
+   }
+
+   // Writes the first numbytes of the buffer, a multiple of the
+   // alignment, at the end of what's been written so far.
+   bool WriteBuffer(size_t numbytes)
+   {
+      DWORD wrote = 0;
+      return WriteFile(m_handle, m_buffer, static_cast<DWORD>(numbytes), &wrote, nullptr) &&
+             wrote == numbytes;
+   }
+
+private:
+   HANDLE m_handle = INVALID_HANDLE_VALUE;
+   bool m_writing = false;
+   bool m_failed = false;
+   bool m_finished = false;
+   char *m_buffer = nullptr;           // Aligned; bufferSize bytes.
+   size_t m_bufferStart = 0;           // File position of the buffer, when reading.
+   size_t m_bufferUsed = 0;            // Bytes of the buffer in use.
+   size_t m_position = 0;              // Current position, when reading.
+   size_t m_length = 0;                // Length of the file, or of what's been written.
+};
@@ -0,0 +1,623 @@
+//--------------------------------------------------------------------
+// glbwriter.h - Class that writes a 3D model as a binary glTF (.GLB)
+// file.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "meshsink.h"
+#include <algorithm>
+#include <float.h>
+
+//--------------------------------------------------------------------
+// GlbWriter:  Writes a 3D model as a binary glTF file.  A GLB file is
+// a small header, then a chunk of JSON that describes the scene, then
+// a chunk of binary data holding the vertex positions, normals and
+// triangle indexes that the JSON refers to.  Since the JSON has to
+// come first, but can't be finished until all of the binary data has
+// been written, we leave space for it at the start of the file, write
+// the binary data straight to the file as each face set arrives, and
+// go back to fill in the JSON and the lengths at the end.  If the JSON
+// turns out to be too big for the space we left, the binary data is
+// moved along to make room.
+//
+// Each face set becomes a glTF mesh primitive, and the transforms,
+// groups and instanced parts become nodes, with the copies of a part
+// sharing one mesh.  The member functions of this class generally
+// throw a string in the event of an error.
+//--------------------------------------------------------------------
+class GlbWriter : public MeshSink
+{
+public:
+   GlbWriter() = delete;
+   GlbWriter(const GlbWriter &) = delete;
+
+   // Face sets of up to 65535 points let the triangles use 16-bit
+   // indexes, unless normals split the points into more vertices.
+   explicit GlbWriter(File &file) : MeshSink(file, 65535) { }
+
+   //--------------------------------------------------------------------
+   // Writes the beginning portion of the GLB file, which is only the
+   // space for the header and the JSON until WriteTrailer fills it in.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      const std::string space(headerSize + chunkHeaderSize + m_jsonSpace, ' ');
+      WriteText(space);
+
+      // Everything goes under a root node, which moves the model from
+      // m_origin back to where it belongs.
+      m_nodes.assign(1, Node());
+      m_nodeStack.assign(1, 0);
+   }
+
+protected:
+
+   //--------------------------------------------------------------------
+   // Writes a piece of a mesh to the binary chunk as a mesh primitive of
+   // the current node.
+   //--------------------------------------------------------------------
+   void WriteFaceSet(const Mesh &faceSet) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (faceSet.NumFaces() < 1)
+         return;  // Nothing to write.
+
+      // Positions outside of any transform are in model coordinates,
+      // which can be far from zero.  We make them relative to m_origin,
+      // so that they keep their precision as 32-bit floats.
+      const bool relative = (m_transformDepth == 0);
+      if (relative && !m_haveOrigin)
+         SetOrigin(LocalCoordinate(faceSet.m_points[0]));
+
+      // A glTF normal belongs to a vertex, not to a corner of a face.
+      std::vector<Point> normals;
+      std::vector<std::uint32_t> vertexPoints, vertexNormals, cornerVertex;
+      SplitVerticesByNormal(faceSet, normals, vertexPoints, vertexNormals, cornerVertex);
+
+      // The faces are convex, so each one is split into a fan of
+      // triangles.
+      std::vector<std::uint32_t> triangles;
+      triangles.reserve(faceSet.m_indexes.size() * 3);
+      for (size_t face = 0; face < faceSet.NumFaces(); ++face)
+      {
+         const std::uint32_t *v = cornerVertex.data() + faceSet.m_faceStart[face];
+         for (size_t i = 1; i + 1 < faceSet.FaceSize(face); ++i)
+         {
+            triangles.push_back(v[0]);
+            triangles.push_back(v[i]);
+            triangles.push_back(v[i + 1]);
+         }
+      }
+
+      // Pack the positions, the normals and the indexes one after the
+      // other, each starting on a four byte boundary.
+      std::vector<std::uint8_t> data;
+      data.reserve(vertexPoints.size() * 24 + triangles.size() * 4);
+      Primitive primitive;
+
+      Accessor positions;
+      positions.type = floatType;
+      positions.target = vertexTarget;
+      positions.byteOffset = m_binaryLength;
+      positions.count = vertexPoints.size();
+      positions.hasBounds = true;
+      for (int i = 0; i < 3; ++i)
+      {
+         positions.min[i] = FLT_MAX;
+         positions.max[i] = -FLT_MAX;
+      }
+      for (const auto point : vertexPoints)
+      {
+         Point local = LocalCoordinate(faceSet.m_points[point]);
+         if (relative)
+            local = local - m_origin;
+         const float xyz[3] = { static_cast<float>(local.x), static_cast<float>(local.y),
+                                static_cast<float>(local.z) };
+         for (int i = 0; i < 3; ++i)
+         {
+            positions.min[i] = std::min(positions.min[i], xyz[i]);
+            positions.max[i] = std::max(positions.max[i], xyz[i]);
+            AppendFloat(data, xyz[i]);
+         }
+      }
+      positions.byteLength = data.size();
+      primitive.position = AddAccessor(positions);
+
+      if (!vertexNormals.empty())
+      {
+         Accessor normalAccessor;
+         normalAccessor.type = floatType;
+         normalAccessor.target = vertexTarget;
+         normalAccessor.byteOffset = m_binaryLength + data.size();
+         normalAccessor.count = vertexNormals.size();
+         for (const auto normal : vertexNormals)
+         {
+            const Point &n = normals[normal];
+            AppendFloat(data, static_cast<float>(n.x));
+            AppendFloat(data, static_cast<float>(n.y));
+            AppendFloat(data, static_cast<float>(n.z));
+         }
+         normalAccessor.byteLength = m_binaryLength + data.size() - normalAccessor.byteOffset;
+         primitive.normal = AddAccessor(normalAccessor);
+      }
+
+      // The largest value of an index type is reserved, so 16-bit
+      // indexes can only number 65535 vertices.
+      Accessor indexes;
+      indexes.type = vertexPoints.size() <= 0xFFFF ? ushortType : uintType;
+      indexes.target = indexTarget;
+      indexes.byteOffset = m_binaryLength + data.size();
+      indexes.count = triangles.size();
+      for (const auto index : triangles)
+      {
+         data.push_back(static_cast<std::uint8_t>(index));
+         data.push_back(static_cast<std::uint8_t>(index >> 8));
+         if (indexes.type == uintType)
+         {
+            data.push_back(static_cast<std::uint8_t>(index >> 16));
+            data.push_back(static_cast<std::uint8_t>(index >> 24));
+         }
+      }
+      indexes.byteLength = m_binaryLength + data.size() - indexes.byteOffset;
+      while (data.size() % 4 != 0)
+         data.push_back(0);
+      primitive.indexes = AddAccessor(indexes);
+
+      // The binary chunk's header goes before its first data, and gets
+      // its length at the end.
+      if (m_binaryLength == 0)
+      {
+         std::vector<std::uint8_t> chunkHeader;
+         AppendUint32(chunkHeader, 0);
+         AppendUint32(chunkHeader, binaryChunkType);
+         WriteBytes(chunkHeader);
+      }
+      WriteBytes(data);
+      m_binaryLength += data.size();
+
+      // Add the primitive to the current node's mesh.
+      Node &node = m_nodes[m_nodeStack.back()];
+      if (node.mesh < 0)
+      {
+         node.mesh = static_cast<int>(m_meshes.size());
+         m_meshes.emplace_back();
+      }
+      m_meshes[node.mesh].push_back(primitive);
+   }
+
+   //--------------------------------------------------------------------
+   // Start a node that moves its children, or one that also scales
+   // them, and end either one.
+   //--------------------------------------------------------------------
+   void BeginTransform(const Point &translation) override
+   {
+      BeginScaledTransform(translation, 1.);
+   }
+
+   void BeginScaledTransform(const Point &translation, double scale) override
+   {
+      Node node;
+      node.hasTransform = true;
+      node.translation = translation;
+      node.scale = scale;
+      if (m_transformDepth == 0)
+      {
+         if (!m_haveOrigin)
+            SetOrigin(translation);
+         node.translation = translation - m_origin;
+      }
+      BeginNode(node);
+      ++m_transformDepth;
+   }
+
+   void EndTransform() override
+   {
+      EndNode();
+      --m_transformDepth;
+   }
+
+   //--------------------------------------------------------------------
+   // Start and end a group.  glTF gets the bounding box from the
+   // positions, so it isn't written.
+   //--------------------------------------------------------------------
+   void BeginBoundedGroup(const Point &, const Point &) override
+   {
+      BeginNode(Node());
+   }
+
+   void EndBoundedGroup() override
+   {
+      EndNode();
+   }
+
+   //--------------------------------------------------------------------
+   // Start and end the node that holds the first copy of an instanced
+   // part, and add a node that shows the same mesh again.
+   //--------------------------------------------------------------------
+   void BeginPartDefinition(size_t) override
+   {
+      BeginNode(Node());
+   }
+
+   void EndPartDefinition() override
+   {
+      m_partMeshes.push_back(m_nodes[m_nodeStack.back()].mesh);
+      EndNode();
+   }
+
+   void UsePart(size_t partNumber) override
+   {
+      assert(partNumber >= 1 && partNumber <= m_partMeshes.size());
+      Node node;
+      node.mesh = m_partMeshes[partNumber - 1];
+      BeginNode(node);
+      EndNode();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the JSON that describes the scene, and the lengths of the
+   // file and its chunks, into the space left at the start of the file.
+   //--------------------------------------------------------------------
+   void WriteTrailer(const Point &, const Point &) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      assert(m_nodeStack.size() == 1);
+
+      std::string json = SceneJson();
+      if (json.size() < m_jsonSpace)
+         json.resize(m_jsonSpace, ' ');
+      while (json.size() % 4 != 0)
+         json += ' ';
+
+      // Make room for the JSON if it's bigger than the space we left.
+      const size_t binaryChunkSize = m_binaryLength > 0 ? chunkHeaderSize + m_binaryLength : 0;
+      const size_t oldBinaryStart = headerSize + chunkHeaderSize + m_jsonSpace;
+      const size_t binaryStart = headerSize + chunkHeaderSize + json.size();
+
+      // The lengths in the header are 32-bit.
+      if (binaryStart + binaryChunkSize > 0xFFFFFFFF)
+         throw L"GLB output exceeds 4GB, the most that a GLB file can hold.";
+      if (binaryStart > oldBinaryStart)
+         MoveData(oldBinaryStart, binaryStart, binaryChunkSize);
+
+      std::vector<std::uint8_t> header;
+      AppendUint32(header, glbMagic);
+      AppendUint32(header, 2);
+      AppendUint32(header, static_cast<std::uint32_t>(binaryStart + binaryChunkSize));
+      AppendUint32(header, static_cast<std::uint32_t>(json.size()));
+      AppendUint32(header, jsonChunkType);
+      SeekTo(0);
+      WriteBytes(header);
+      WriteText(json);
+
+      if (m_binaryLength > 0)
+      {
+         std::vector<std::uint8_t> chunkHeader;
+         AppendUint32(chunkHeader, static_cast<std::uint32_t>(m_binaryLength));
+         AppendUint32(chunkHeader, binaryChunkType);
+         WriteBytes(chunkHeader);
+      }
+   }
+
+private:
+   // Component types, and the kinds of data, in glTF's numbering.
+   static constexpr int ushortType = 5123;
+   static constexpr int uintType = 5125;
+   static constexpr int floatType = 5126;
+   static constexpr int vertexTarget = 34962;
+   static constexpr int indexTarget = 34963;
+
+   // Sizes and tags of the parts of a GLB file.
+   static constexpr size_t headerSize = 12;
+   static constexpr size_t chunkHeaderSize = 8;
+   static constexpr std::uint32_t glbMagic = 0x46546C67;        // "glTF"
+   static constexpr std::uint32_t jsonChunkType = 0x4E4F534A;   // "JSON"
+   static constexpr std::uint32_t binaryChunkType = 0x004E4942; // "BIN"
+
+   // A view of part of the binary chunk, as a list of numbers or of
+   // XYZ vectors.  Each accessor has its own buffer view.
+   struct Accessor
+   {
+      size_t byteOffset = 0;
+      size_t byteLength = 0;
+      size_t count = 0;
+      int type = floatType;
+      int target = vertexTarget;
+      bool hasBounds = false;
+      float min[3] = { 0.f, 0.f, 0.f };
+      float max[3] = { 0.f, 0.f, 0.f };
+   };
+
+   // The accessors that make up one face set.
+   struct Primitive
+   {
+      size_t position = 0;
+      int normal = -1;
+      size_t indexes = 0;
+   };
+
+   // A node of the scene, with an optional mesh and transform.
+   struct Node
+   {
+      std::vector<size_t> children;
+      int mesh = -1;
+      bool hasTransform = false;
+      Point translation;
+      double scale = 1.;
+   };
+
+   //--------------------------------------------------------------------
+   // Sets the point that positions outside of transforms are relative
+   // to, and moves the root node there.
+   //--------------------------------------------------------------------
+   void SetOrigin(const Point &origin)
+   {
+      m_origin = origin;
+      m_haveOrigin = true;
+      m_nodes[0].hasTransform = true;
+      m_nodes[0].translation = origin;
+   }
+
+   // Adds a node as a child of the current node, and makes it current.
+   void BeginNode(const Node &node)
+   {
+      const size_t index = m_nodes.size();
+      m_nodes.push_back(node);
+      m_nodes[m_nodeStack.back()].children.push_back(index);
+      m_nodeStack.push_back(index);
+   }
+
+   void EndNode()
+   {
+      assert(m_nodeStack.size() > 1);
+      m_nodeStack.pop_back();
+   }
+
+   size_t AddAccessor(const Accessor &accessor)
+   {
+      m_accessors.push_back(accessor);
+      return m_accessors.size() - 1;
+   }
+
+   void WriteBytes(const std::vector<std::uint8_t> &data)
+   {
+      if (!data.empty() && !m_file.Write(data.data(), data.size()))
+         throw writeError;
+   }
+
+   void SeekTo(size_t position)
+   {
+      if (!m_file.Seek(position))
+         throw L"Failed seeking in output file.";
+   }
+
+   //--------------------------------------------------------------------
+   // Moves size bytes of the file from one position to a later one,
+   // starting from the end so that nothing is overwritten before it has
+   // been copied.
+   //--------------------------------------------------------------------
+   void MoveData(size_t from, size_t to, size_t size)
+   {
+      assert(to > from);
+      std::vector<std::uint8_t> block(1 << 20);
+      size_t remaining = size;
+      while (remaining > 0)
+      {
+         const size_t blockSize = std::min(block.size(), remaining);
+         remaining -= blockSize;
+         SeekTo(from + remaining);
+         if (m_file.Read(block.data(), blockSize) != blockSize)
+            throw L"Failed reading back output file.";
+         SeekTo(to + remaining);
+         if (!m_file.Write(block.data(), blockSize))
+            throw writeError;
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Helpers for writing JSON.
+   //--------------------------------------------------------------------
+   static void AppendNumber(std::string &text, double value, int digits)
+   {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.*G", digits, value);
+      text += buffer;
+   }
+
+   static void AppendArray(std::string &text, const double *values, size_t count, int digits)
+   {
+      text += '[';
+      for (size_t i = 0; i < count; ++i)
+      {
+         if (i > 0)
+            text += ',';
+         AppendNumber(text, values[i], digits);
+      }
+      text += ']';
+   }
+
+   //--------------------------------------------------------------------
+   // Returns the JSON that describes the scene:  its nodes, meshes and
+   // material, and where their data is in the binary chunk.
+   //--------------------------------------------------------------------
+   std::string SceneJson() const
+   {
+      std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"stl2vrml\"},"
+                         "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[";
+      for (size_t i = 0; i < m_nodes.size(); ++i)
+      {
+         const Node &node = m_nodes[i];
+         json += i > 0 ? ",{" : "{";
+         const size_t length = json.size();
+         if (!node.children.empty())
+         {
+            json += "\"children\":[";
+            for (size_t child = 0; child < node.children.size(); ++child)
+            {
+               if (child > 0)
+                  json += ',';
+               AppendInteger(json, static_cast<std::int64_t>(node.children[child]));
+            }
+            json += ']';
+         }
+         if (node.mesh >= 0)
+         {
+            json += json.size() > length ? ",\"mesh\":" : "\"mesh\":";
+            AppendInteger(json, node.mesh);
+         }
+         if (node.hasTransform)
+         {
+            const double translation[3] = { node.translation.x, node.translation.y,
+                                            node.translation.z };
+            json += json.size() > length ? ",\"translation\":" : "\"translation\":";
+            AppendArray(json, translation, 3, 17);
+            if (node.scale != 1.)
+            {
+               const double scale[3] = { node.scale, node.scale, node.scale };
+               json += ",\"scale\":";
+               AppendArray(json, scale, 3, 17);
+            }
+         }
+         json += '}';
+      }
+      json += ']';
+
+      if (!m_meshes.empty())
+      {
+         json += ",\"meshes\":[";
+         for (size_t i = 0; i < m_meshes.size(); ++i)
+         {
+            json += i > 0 ? ",{\"primitives\":[" : "{\"primitives\":[";
+            for (size_t j = 0; j < m_meshes[i].size(); ++j)
+            {
+               const Primitive &primitive = m_meshes[i][j];
+               json += j > 0 ? ",{\"attributes\":{\"POSITION\":" : "{\"attributes\":{\"POSITION\":";
+               AppendInteger(json, static_cast<std::int64_t>(primitive.position));
+               if (primitive.normal >= 0)
+               {
+                  json += ",\"NORMAL\":";
+                  AppendInteger(json, primitive.normal);
+               }
+               json += "},\"indices\":";
+               AppendInteger(json, static_cast<std::int64_t>(primitive.indexes));
+               json += ",\"material\":0}";
+            }
+            json += "]}";
+         }
+         json += ']';
+
+         // We don't have any color information about this model, so
+         // we're using a light gray color.  Unless the model is known
+         // to be a closed solid with its faces wound outwards, the back
+         // faces need to be drawn too.
+         json += ",\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorFactor\":[0.8,0.8,0.8,1],"
+                 "\"metallicFactor\":0}";
+         if (!(m_writeHints && m_solid))
+            json += ",\"doubleSided\":true";
+         json += "}]";
+
+         json += ",\"accessors\":[";
+         for (size_t i = 0; i < m_accessors.size(); ++i)
+         {
+            const Accessor &accessor = m_accessors[i];
+            json += i > 0 ? ",{\"bufferView\":" : "{\"bufferView\":";
+            AppendInteger(json, static_cast<std::int64_t>(i));
+            json += ",\"componentType\":";
+            AppendInteger(json, accessor.type);
+            json += ",\"count\":";
+            AppendInteger(json, static_cast<std::int64_t>(accessor.count));
+            json += accessor.target == vertexTarget ? ",\"type\":\"VEC3\"" : ",\"type\":\"SCALAR\"";
+            if (accessor.hasBounds)
+            {
+               const double min[3] = { accessor.min[0], accessor.min[1], accessor.min[2] };
+               const double max[3] = { accessor.max[0], accessor.max[1], accessor.max[2] };
+               json += ",\"min\":";
+               AppendArray(json, min, 3, 9);
+               json += ",\"max\":";
+               AppendArray(json, max, 3, 9);
+            }
+            json += '}';
+         }
+         json += "],\"bufferViews\":[";
+         for (size_t i = 0; i < m_accessors.size(); ++i)
+         {
+            const Accessor &accessor = m_accessors[i];
+            json += i > 0 ? ",{\"buffer\":0,\"byteOffset\":" : "{\"buffer\":0,\"byteOffset\":";
+            AppendInteger(json, static_cast<std::int64_t>(accessor.byteOffset));
+            json += ",\"byteLength\":";
+            AppendInteger(json, static_cast<std::int64_t>(accessor.byteLength));
+            json += ",\"target\":";
+            AppendInteger(json, accessor.target);
+            json += '}';
+         }
+         json += "],\"buffers\":[{\"byteLength\":";
+         AppendInteger(json, static_cast<std::int64_t>(m_binaryLength));
+         json += "}]";
+      }
+      json += '}';
+      return json;
+   }
+
+   // Space left for the JSON at the start of the file.
+   const size_t m_jsonSpace = 65536;
+
+   // How much has been written to the binary chunk.
+   size_t m_binaryLength = 0;
+
+   // The point that positions outside of transforms are relative to.
+   Point m_origin;
+   bool m_haveOrigin = false;
+
+   // The scene so far, and the nodes that haven't been ended yet.
+   std::vector<Node> m_nodes;
+   std::vector<size_t> m_nodeStack;
+   size_t m_transformDepth = 0;
+   std::vector<std::vector<Primitive>> m_meshes;
+   std::vector<Accessor> m_accessors;
+
+   // The mesh of each instanced part, by part number less one.
+   std::vector<int> m_partMeshes;
+};
@@ -0,0 +1,388 @@
+//--------------------------------------------------------------------
+// gzipfile.h - File classes that compress data into the gzip format
+// on its way to another File, or decompress it on its way from one.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Limitations / Bugs:
+// * The compressed output can't be read back or seeked.
+// * Seeking backward in compressed input starts decompressing over
+//   from the beginning, so it's only cheap near the start.
+// * The length of compressed input comes from the gzip trailer, which
+//   only records it modulo 4GB, and only for the last member of a
+//   file made of several gzip streams joined together.
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "SimpleFile.h"
+#include "deflate.h"
+#include "parallel.h"
+#include <deque>
+#include <future>
+#include <memory>
+
+//--------------------------------------------------------------------
+// GzipOutputFile:  A File that compresses everything written to it
+// and writes the result, in gzip format, to another File.
+//
+// The data is cut into blocks that are compressed at the same time on
+// separate threads, the way pigz does it.  Each block is compressed
+// with the end of the block before it as a dictionary, so the result
+// is nearly as small as compressing everything in one piece.  Finish
+// must be called to write the end of the gzip file.
+//--------------------------------------------------------------------
+class GzipOutputFile : public File
+{
+public:
+   GzipOutputFile() = delete;
+   GzipOutputFile(const GzipOutputFile &) = delete;
+   explicit GzipOutputFile(File &out) : m_out(out)
+   {
+      // Header:  ID bytes, deflate, no flags, no time, unknown OS.
+      static const std::uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+      m_failed = !m_out.Write(header, sizeof(header));
+   }
+
+   ~GzipOutputFile()
+   {
+      try
+      {
+         Finish();
+      }
+      catch (...)
+      {
+      }
+   }
+
+   bool IsOpen() override { return !m_finished && m_out.IsOpen(); }
+   void Close() override { Finish(); m_out.Close(); }
+   bool Seek(size_t) override { return false; }
+   size_t Read(void *, size_t) override { return 0; }
+
+   // Returns the number of bytes written so far, before compression.
+   size_t Length() override { return m_length; }
+
+   //--------------------------------------------------------------------
+   // Compresses data into the file.  Returns true if successful.
+   //--------------------------------------------------------------------
+   bool Write(const void *data, size_t numbytes) override
+   {
+      const std::uint8_t *p = static_cast<const std::uint8_t *>(data);
+      m_length += numbytes;
+      while (numbytes > 0 && !m_failed)
+      {
+         const size_t n = std::min(numbytes, blockSize - m_block.size());
+         m_block.insert(m_block.end(), p, p + n);
+         p += n;
+         numbytes -= n;
+         if (m_block.size() == blockSize)
+            SubmitBlock();
+      }
+      return !m_failed;
+   }
+
+   //--------------------------------------------------------------------
+   // Compresses anything that's left and writes the end of the gzip
+   // file.  Returns true if everything was written successfully.
+   //--------------------------------------------------------------------
+   bool Finish()
+   {
+      if (m_finished)
+         return !m_failed;
+      m_finished = true;
+
+      if (!m_block.empty())
+         SubmitBlock();
+      while (!m_pending.empty())
+         WriteOldestBlock();
+
+      // End the deflate stream, then write the trailer:  the CRC and
+      // size of the uncompressed data.
+      std::vector<std::uint8_t> trailer;
+      DeflateFinish(trailer);
+      for (int i = 0; i < 4; ++i)
+         trailer.push_back(static_cast<std::uint8_t>(m_crc >> (8 * i)));
+      for (int i = 0; i < 4; ++i)
+         trailer.push_back(static_cast<std::uint8_t>(m_length >> (8 * i)));
+      if (!m_failed && !m_out.Write(trailer.data(), trailer.size()))
+         m_failed = true;
+      return !m_failed;
+   }
+
+private:
+   // Amount of data compressed at a time by one thread.
+   static constexpr size_t blockSize = 128 * 1024;
+
+   // A block after compression.
+   struct CompressedBlock
+   {
+      std::vector<std::uint8_t> m_data;
+      std::uint32_t m_crc = 0;
+      size_t m_size = 0;
+   };
+
+   //--------------------------------------------------------------------
+   // Starts compressing the current block.  If too many blocks are
+   // already in progress, waits for the oldest and writes it first, so
+   // that memory use stays bounded.
+   //--------------------------------------------------------------------
+   void SubmitBlock()
+   {
+      while (m_pending.size() >= 2 * NumWorkerThreads())
+         WriteOldestBlock();
+
+      const size_t dictionarySize = m_dictionary.size();
+      std::vector<std::uint8_t> input;
+      input.reserve(dictionarySize + m_block.size());
+      input.insert(input.end(), m_dictionary.begin(), m_dictionary.end());
+      input.insert(input.end(), m_block.begin(), m_block.end());
+      m_block.clear();
+
+      // The end of this block is the dictionary for the next one.
+      const size_t keep = std::min(input.size(), DeflateFormat::windowSize);
+      m_dictionary.assign(input.end() - static_cast<std::ptrdiff_t>(keep), input.end());
+
+      // With only one core, compress when the result is needed.
+      const auto policy = NumWorkerThreads() > 1 ? std::launch::async : std::launch::deferred;
+      m_pending.push_back(std::async(policy, [dictionarySize](const std::vector<std::uint8_t> &data)
+      {
+         CompressedBlock block;
+         block.m_size = data.size() - dictionarySize;
+         block.m_crc = Crc32(data.data() + dictionarySize, block.m_size);
+         Deflater deflater(block.m_data);
+         deflater.Compress(data.data(), dictionarySize, block.m_size);
+         return block;
+      }, std::move(input)));
+   }
+
+   //--------------------------------------------------------------------
+   // Waits for the oldest block in progress and writes it out.
+   //--------------------------------------------------------------------
+   void WriteOldestBlock()
+   {
+      CompressedBlock block = m_pending.front().get();
+      m_pending.pop_front();
+      m_crc = Crc32Combine(m_crc, block.m_crc, block.m_size);
+      if (!m_failed && !m_out.Write(block.m_data.data(), block.m_data.size()))
+         m_failed = true;
+   }
+
+private:
+   File &m_out;
+   bool m_failed = false;
+   bool m_finished = false;
+   size_t m_length = 0;                              // Bytes given to Write.
+   std::uint32_t m_crc = 0;                          // CRC of the blocks written so far.
+   std::vector<std::uint8_t> m_block;                // Data waiting to be compressed.
+   std::vector<std::uint8_t> m_dictionary;           // End of the previous block.
+   std::deque<std::future<CompressedBlock>> m_pending;  // Blocks being compressed, oldest first.
+};
+
+//--------------------------------------------------------------------
+// GzipInputFile:  A File that reads the decompressed contents of a
+// gzip file from another File, decompressing as it goes.  Files made
+// of several gzip streams joined together (as from "cat a.gz b.gz")
+// read as one.  Reading corrupt data throws a string.
+//--------------------------------------------------------------------
+class GzipInputFile : public File
+{
+public:
+   GzipInputFile() = delete;
+   GzipInputFile(const GzipInputFile &) = delete;
+   explicit GzipInputFile(File &in) : m_in(in)
+   {
+      // The uncompressed length is in the last four bytes of the file.
+      const size_t compressedLength = m_in.Length();
+      std::uint8_t size[4] = {};
+      if (compressedLength >= 18 && m_in.Seek(compressedLength - 4) && m_in.Read(size, 4) == 4)
+         m_length = size[0] | (size[1] << 8) | (size[2] << 16) | (static_cast<size_t>(size[3]) << 24);
+      Rewind();
+   }
+
+   //--------------------------------------------------------------------
+   // Returns true if the file looks like a gzip file.  Leaves the file
+   // positioned at its beginning.
+   //--------------------------------------------------------------------
+   static bool IsGzipFile(File &file)
+   {
+      std::uint8_t id[3] = {};
+      const bool isGzip = file.Seek(0) && file.Read(id, 3) == 3 &&
+                          id[0] == 0x1F && id[1] == 0x8B && id[2] == 8;
+      file.Seek(0);
+      return isGzip;
+   }
+
+   bool IsOpen() override { return m_in.IsOpen(); }
+   void Close() override { m_in.Close(); }
+   bool Write(const void *, size_t) override { return false; }
+
+   // Returns the length of the decompressed data, modulo 4GB.
+   size_t Length() override { return m_length; }
+
+   //--------------------------------------------------------------------
+   // Reads decompressed data.  Returns the number of bytes read.
+   //--------------------------------------------------------------------
+   size_t Read(void *data, size_t numbytes) override
+   {
+      std::uint8_t *out = static_cast<std::uint8_t *>(data);
+      size_t done = 0;
+      while (done < numbytes)
+      {
+         if (m_bufferPos == m_buffer.size() && !FillBuffer())
+            break;
+         const size_t n = std::min(numbytes - done, m_buffer.size() - m_bufferPos);
+         memcpy(out + done, m_buffer.data() + m_bufferPos, n);
+         m_bufferPos += n;
+         done += n;
+      }
+      m_position += done;
+      return done;
+   }
+
+   //--------------------------------------------------------------------
+   // Moves to a position in the decompressed data, by decompressing
+   // up to it.
+   //--------------------------------------------------------------------
+   bool Seek(size_t position) override
+   {
+      if (position < m_position)
+         Rewind();
+      std::vector<std::uint8_t> skipped(65536);
+      while (m_position < position)
+         if (Read(skipped.data(), std::min(skipped.size(), position - m_position)) == 0)
+            return false;
+      return true;
+   }
+
+private:
+   //--------------------------------------------------------------------
+   // Starts decompressing again from the beginning of the file.
+   //--------------------------------------------------------------------
+   void Rewind()
+   {
+      m_in.Seek(0);
+      m_inflater.reset(new Inflater([this](void *data, size_t size) { return m_in.Read(data, size); }));
+      m_position = 0;
+      m_buffer.clear();
+      m_bufferPos = 0;
+      m_atEnd = false;
+      ReadHeader();
+   }
+
+   //--------------------------------------------------------------------
+   // Reads the header at the start of a gzip stream and gets ready to
+   // decompress what follows it.
+   //--------------------------------------------------------------------
+   void ReadHeader()
+   {
+      std::uint8_t header[10];
+      for (auto &byte : header)
+         byte = m_inflater->ReadAlignedByte();
+      if (header[0] != 0x1F || header[1] != 0x8B || header[2] != 8)
+         throw "Input file is not a gzip file.";
+
+      // Skip the optional fields.
+      const std::uint8_t flags = header[3];
+      if (flags & 4)
+      {
+         const unsigned extraLength = m_inflater->ReadAlignedByte() | (m_inflater->ReadAlignedByte() << 8);
+         for (unsigned i = 0; i < extraLength; ++i)
+            m_inflater->ReadAlignedByte();
+      }
+      if (flags & 8)       // File name.
+         while (m_inflater->ReadAlignedByte() != 0) { }
+      if (flags & 16)      // Comment.
+         while (m_inflater->ReadAlignedByte() != 0) { }
+      if (flags & 2)
+      {
+         m_inflater->ReadAlignedByte();
+         m_inflater->ReadAlignedByte();
+      }
+
+      m_inflater->Restart();
+      m_crc = 0;
+      m_size = 0;
+   }
+
+   //--------------------------------------------------------------------
+   // Decompresses the next piece of data into m_buffer.  Checks each
+   // gzip stream's CRC and size at its end, and moves on to the next
+   // stream if there is one.  Returns false at the end of the file.
+   //--------------------------------------------------------------------
+   bool FillBuffer()
+   {
+      m_buffer.resize(bufferSize);
+      m_bufferPos = 0;
+      while (!m_atEnd)
+      {
+         const size_t n = m_inflater->Inflate(m_buffer.data(), m_buffer.size());
+         m_crc = Crc32(m_buffer.data(), n, m_crc);
+         m_size += n;
+         if (n > 0)
+         {
+            m_buffer.resize(n);
+            return true;
+         }
+
+         std::uint32_t trailer[2] = {};
+         for (auto &word : trailer)
+            for (int i = 0; i < 4; ++i)
+               word |= static_cast<std::uint32_t>(m_inflater->ReadAlignedByte()) << (8 * i);
+         if (trailer[0] != m_crc || trailer[1] != static_cast<std::uint32_t>(m_size))
+            throw "Compressed input file is corrupt (CRC or length mismatch).";
+
+         if (m_inflater->AtEndOfInput())
+            m_atEnd = true;
+         else
+            ReadHeader();
+      }
+      m_buffer.clear();
+      return false;
+   }
+
+private:
+   static constexpr size_t bufferSize = 65536;
+
+   File &m_in;
+   std::unique_ptr<Inflater> m_inflater;
+   std::vector<std::uint8_t> m_buffer;        // Decompressed data not read yet.
+   size_t m_bufferPos = 0;
+   size_t m_position = 0;                     // Position in the decompressed data.
+   size_t m_length = 0;                       // Length from the gzip trailer.
+   bool m_atEnd = false;
+   std::uint32_t m_crc = 0;                   // CRC of the current gzip stream so far.
+   std::uint64_t m_size = 0;                  // Size of the current gzip stream so far.
+};
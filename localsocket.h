@@ -0,0 +1,222 @@
+//--------------------------------------------------------------------
+// localsocket.h - Helpers for a local stream socket, named by a path,
+// that a service listens on and its clients connect to.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#include <windows.h>
+#ifndef IO_REPARSE_TAG_AF_UNIX
+#define IO_REPARSE_TAG_AF_UNIX 0x80000023L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+//--------------------------------------------------------------------
+// LocalSocket:  One end of a connection on a local (AF_UNIX) socket,
+// which is closed when the object goes away.  Windows 10 has these
+// sockets too, in Winsock, named by a path in the file system like
+// they are on Unix.
+//--------------------------------------------------------------------
+class LocalSocket
+{
+public:
+   LocalSocket() = default;
+   explicit LocalSocket(SOCKET s) : m_socket(s) {}
+   LocalSocket(LocalSocket &&other) : m_socket(other.m_socket) { other.m_socket = INVALID_SOCKET; }
+   LocalSocket &operator=(LocalSocket &&other)
+   {
+      std::swap(m_socket, other.m_socket);
+      return *this;
+   }
+   LocalSocket(const LocalSocket &) = delete;
+   LocalSocket &operator=(const LocalSocket &) = delete;
+   ~LocalSocket() { Close(); }
+
+   bool IsOpen() const { return m_socket != INVALID_SOCKET; }
+
+   //--------------------------------------------------------------------
+   // Starts Winsock, once for the whole program.  Returns false if it
+   // can't be started.
+   //--------------------------------------------------------------------
+   static bool Startup()
+   {
+      static const bool started = []()
+      {
+         WSADATA data;
+         return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+      }();
+      return started;
+   }
+
+   //--------------------------------------------------------------------
+   // Connects to the socket at a path that a service is listening on.
+   // Returns false if there's nothing listening there.
+   //--------------------------------------------------------------------
+   bool Connect(const std::wstring &path)
+   {
+      Close();
+      sockaddr_un address;
+      if (!Startup() || !MakeAddress(path, address))
+         return false;
+      m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (m_socket == INVALID_SOCKET)
+         return false;
+      if (connect(m_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+      {
+         Close();
+         return false;
+      }
+      return true;
+   }
+
+   //--------------------------------------------------------------------
+   // Returns true if there's something other than a socket at a path,
+   // such as an ordinary file named by mistake.  On Windows, a socket
+   // shows up in the file system as a reparse point with its own tag,
+   // which FindFirstFileW gives; other reparse points, like symbolic
+   // links and junctions, count as other files.
+   //--------------------------------------------------------------------
+   static bool IsOtherFile(const std::wstring &path)
+   {
+      WIN32_FIND_DATAW found;
+      const HANDLE search = FindFirstFileW(path.c_str(), &found);
+      if (search == INVALID_HANDLE_VALUE)
+         return false;
+      FindClose(search);
+      return !(found.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ||
+             found.dwReserved0 != IO_REPARSE_TAG_AF_UNIX;
+   }
+
+   //--------------------------------------------------------------------
+   // Makes a socket at a path and listens on it, replacing any socket
+   // left there by a service that didn't stop cleanly.  Fails if there's
+   // anything else at the path, rather than deleting it.  Up to
+   // "backlog" connections wait to be accepted.
+   //--------------------------------------------------------------------
+   bool Listen(const std::wstring &path, int backlog)
+   {
+      Close();
+      sockaddr_un address;
+      if (!Startup() || !MakeAddress(path, address) || IsOtherFile(path))
+         return false;
+      _wremove(path.c_str());
+      m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (m_socket == INVALID_SOCKET)
+         return false;
+      if (bind(m_socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+          listen(m_socket, backlog) != 0)
+      {
+         Close();
+         return false;
+      }
+      return true;
+   }
+
+   // Waits for a client to connect to a listening socket.
+   LocalSocket Accept() { return LocalSocket(accept(m_socket, nullptr, nullptr)); }
+
+   // Reads exactly size bytes.  Returns false if the other end closed
+   // the connection first.
+   bool Read(void *data, size_t size)
+   {
+      char *p = static_cast<char *>(data);
+      while (size > 0)
+      {
+         const int got = recv(m_socket, p, static_cast<int>(std::min<size_t>(size, 65536)), 0);
+         if (got <= 0)
+            return false;
+         p += got;
+         size -= static_cast<size_t>(got);
+      }
+      return true;
+   }
+
+   // Writes exactly size bytes.  Returns false if the other end is gone.
+   bool Write(const void *data, size_t size)
+   {
+      const char *p = static_cast<const char *>(data);
+      while (size > 0)
+      {
+         const int put = send(m_socket, p, static_cast<int>(std::min<size_t>(size, 65536)), 0);
+         if (put <= 0)
+            return false;
+         p += put;
+         size -= static_cast<size_t>(put);
+      }
+      return true;
+   }
+
+   void Close()
+   {
+      if (m_socket != INVALID_SOCKET)
+         closesocket(m_socket);
+      m_socket = INVALID_SOCKET;
+   }
+
+private:
+   //--------------------------------------------------------------------
+   // Fills in the address of the socket at a path.  The path is passed
+   // to Winsock as UTF-8.  Returns false if it's too long to fit, or
+   // isn't valid UTF-16.
+   //--------------------------------------------------------------------
+   static bool MakeAddress(const std::wstring &path, sockaddr_un &address)
+   {
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      if (path.empty() || path.size() >= sizeof(address.sun_path))
+         return false;
+      const int length = static_cast<int>(path.size());
+      const int size = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, path.data(), length,
+                                           nullptr, 0, nullptr, nullptr);
+      if (size <= 0 || static_cast<size_t>(size) >= sizeof(address.sun_path))
+         return false;
+      return WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, path.data(), length,
+                                 address.sun_path, size, nullptr, nullptr) == size;
+   }
+
+   SOCKET m_socket = INVALID_SOCKET;
+};
@@ -0,0 +1,250 @@
+//--------------------------------------------------------------------
+// mesh.h - Indexed polygon mesh used by stl2vrml when a conversion
+// needs to look at the whole model at once (rather than streaming
+// triangles straight through from the STL file to the WRL file).
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Limitations / Bugs:
+// * Vertex indexes are 32-bit, so a single mesh is limited to about
+//   four billion unique vertices.
+// * Vertices are welded only when their coordinates match exactly.
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+//--------------------------------------------------------------------
+// Simple container for a 3D coordinate.
+//--------------------------------------------------------------------
+struct Point
+{
+   double x = 0., y = 0., z = 0.;
+};
+
+// Vector arithmetic on points.
+inline Point operator-(const Point &a, const Point &b)
+   { Point p; p.x = a.x - b.x; p.y = a.y - b.y; p.z = a.z - b.z; return p; }
+inline Point Cross(const Point &a, const Point &b)
+{
+   Point p;
+   p.x = a.y * b.z - a.z * b.y;
+   p.y = a.z * b.x - a.x * b.z;
+   p.z = a.x * b.y - a.y * b.x;
+   return p;
+}
+inline double Dot(const Point &a, const Point &b)
+   { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline double Length(const Point &a)
+   { return sqrt(Dot(a, a)); }
+
+//--------------------------------------------------------------------
+// Mesh:  A 3D model stored as a list of unique vertex coordinates
+// plus a list of polygonal faces that refer to those vertices by
+// index.  The faces are stored back-to-back in a single array of
+// indexes, with a second array giving the offset where each face
+// starts, which keeps very large models compact in memory.
+//--------------------------------------------------------------------
+struct Mesh
+{
+   std::vector<Point>         m_points;         // Unique vertex coordinates.
+   std::vector<std::uint32_t> m_indexes;        // Vertex indexes of all faces.
+   std::vector<std::uint32_t> m_faceStart{0};   // Start of each face in m_indexes, plus end.
+
+   // Optional surface normals.  A mesh may have a normal for each face,
+   // or a normal for each corner of each face (one per entry in
+   // m_indexes), or neither, in which case these are empty.
+   std::vector<Point>         m_faceNormals;
+   std::vector<Point>         m_cornerNormals;
+
+   // Returns the number of faces in the mesh.
+   size_t NumFaces() const { return m_faceStart.size() - 1; }
+
+   // Returns the number of vertexes in the given face.
+   size_t FaceSize(size_t face) const
+      { return m_faceStart[face + 1] - m_faceStart[face]; }
+
+   // Returns the vertex indexes of the given face.
+   const std::uint32_t *Face(size_t face) const
+      { return m_indexes.data() + m_faceStart[face]; }
+   std::uint32_t *Face(size_t face)
+      { return m_indexes.data() + m_faceStart[face]; }
+
+   // Appends a face made of the given vertex indexes.
+   void AddFace(const std::uint32_t *indexes, size_t count)
+   {
+      m_indexes.insert(m_indexes.end(), indexes, indexes + count);
+      m_faceStart.push_back(static_cast<std::uint32_t>(m_indexes.size()));
+   }
+
+   // Removes all vertices and faces.
+   void Clear()
+   {
+      m_points.clear();
+      m_indexes.clear();
+      m_faceStart.assign(1, 0);
+      m_faceNormals.clear();
+      m_cornerNormals.clear();
+   }
+};
+
+//--------------------------------------------------------------------
+// Hash and exact comparison of points, for hash tables keyed by
+// coordinates.
+//--------------------------------------------------------------------
+struct PointHash
+{
+   size_t operator()(const Point &pt) const
+   {
+      // Adding zero turns negative zero into positive zero so
+      // that both hash the same, since they compare equal.
+      const double xyz[3] = { pt.x + 0., pt.y + 0., pt.z + 0. };
+      std::uint64_t h = 14695981039346656037ull;
+      for (double d : xyz)
+      {
+         std::uint64_t bits = 0;
+         memcpy(&bits, &d, sizeof(bits));
+         h = (h ^ bits) * 1099511628211ull;
+         h ^= h >> 29;
+      }
+      return static_cast<size_t>(h);
+   }
+};
+struct PointEqual
+{
+   bool operator()(const Point &a, const Point &b) const
+      { return a.x == b.x && a.y == b.y && a.z == b.z; }
+};
+
+//--------------------------------------------------------------------
+// MeshBuilder:  Accumulates triangles into a Mesh, welding together
+// vertices that have identical coordinates so that neighboring
+// faces share vertex indexes.  Triangles that collapse to fewer than
+// three distinct vertices are dropped.  If keepNormals is true, the
+// facet normals are kept as the mesh's face normals.
+//--------------------------------------------------------------------
+class MeshBuilder
+{
+public:
+   MeshBuilder() = delete;
+   MeshBuilder(const MeshBuilder &) = delete;
+   explicit MeshBuilder(Mesh &mesh, bool keepNormals = false)
+      : m_mesh(mesh), m_keepNormals(keepNormals) { }
+
+   //--------------------------------------------------------------------
+   // Adds a triangle, given as three vertex coordinates, to the mesh.
+   // The normal is the one that came with the facet in the STL file.
+   // If it's missing (all zero) it's calculated from the vertices.
+   //--------------------------------------------------------------------
+   void AddFacet(const std::vector<Point> &coords, const Point &normal)
+   {
+      std::uint32_t tri[3];
+      for (size_t i = 0; i < 3; ++i)
+         tri[i] = AddPoint(coords[i]);
+
+      if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0])
+      {
+         ++m_numDegenerate;
+         return;
+      }
+      m_mesh.AddFace(tri, 3);
+
+      if (m_keepNormals)
+      {
+         Point n = normal;
+         if (Length(n) == 0.)
+            n = Cross(coords[1] - coords[0], coords[2] - coords[0]);
+         const double len = Length(n);
+         if (len > 0.)
+         {
+            n.x /= len;  n.y /= len;  n.z /= len;
+         }
+         m_mesh.m_faceNormals.push_back(n);
+      }
+   }
+
+   // Returns the number of triangles dropped because they were degenerate.
+   size_t NumDegenerate() const { return m_numDegenerate; }
+
+private:
+
+   //--------------------------------------------------------------------
+   // Returns the index of the given vertex, adding it to the mesh if
+   // we haven't seen it before.
+   //--------------------------------------------------------------------
+   std::uint32_t AddPoint(const Point &pt)
+   {
+      auto result = m_pointIndex.emplace(pt, static_cast<std::uint32_t>(m_mesh.m_points.size()));
+      if (result.second)
+         m_mesh.m_points.push_back(pt);
+      return result.first->second;
+   }
+
+private:
+   Mesh &m_mesh;
+   bool m_keepNormals = false;
+   std::unordered_map<Point, std::uint32_t, PointHash, PointEqual> m_pointIndex;
+   size_t m_numDegenerate = 0;
+};
+
+//--------------------------------------------------------------------
+// Returns a key identifying the directed edge from vertex a to
+// vertex b, for use in edge lookup tables.
+//--------------------------------------------------------------------
+inline std::uint64_t EdgeKey(std::uint32_t a, std::uint32_t b)
+{
+   return (static_cast<std::uint64_t>(a) << 32) | b;
+}
+
+//--------------------------------------------------------------------
+// MeshPart:  A piece of a model that may appear more than once.  If
+// the part has placements, its mesh is stored relative to the origin
+// and the part appears once at each of the translations listed in
+// m_placements.  Otherwise the mesh is already in the model's own
+// coordinates and appears just once.
+//--------------------------------------------------------------------
+struct MeshPart
+{
+   Mesh               m_mesh;         // Geometry of the part.
+   std::vector<Point> m_placements;   // Where copies of the part go.
+
+   // Returns true if the part is placed by translations.
+   bool IsInstanced() const { return !m_placements.empty(); }
+};
@@ -0,0 +1,289 @@
+//--------------------------------------------------------------------
+// meshcache.h - Cache of parsed STL models, so that a model which
+// is converted again doesn't have to be parsed again.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#include "SimpleFile.h"
+#include "contenthash.h"
+#include "cachedir.h"
+#include "meshsink.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+//--------------------------------------------------------------------
+// MeshCache:  Keeps the facets of STL models that have been read
+// before in a cache directory, one file per model, keyed by a hash of
+// the STL file's contents.  A cache file holds the header below
+// followed by fixed-size facet records in the machine's own layout,
+// so it's read straight into memory in large blocks with no parsing,
+// and could just as well be mapped.  A model that's in the cache is
+// read from there instead of from the STL file, which saves most of
+// the time for an ASCII STL file.
+//
+// The cache files are kept under a size budget, and the least
+// recently used ones are deleted to make room for new ones.
+//
+// The member functions of this class generally throw a string in the
+// event of an error reading the cache.  Not being able to add to the
+// cache isn't an error; Begin or Finish returns false and the model
+// just isn't cached.
+//--------------------------------------------------------------------
+class MeshCache
+{
+public:
+   MeshCache() = delete;
+   MeshCache(const MeshCache &) = delete;
+   MeshCache(const std::wstring &directory, std::uint64_t budget)
+      : m_cache(directory, L".stlmesh", budget) { }
+
+   ~MeshCache()
+   {
+      // A cache file that wasn't finished is thrown away.
+      if (m_writing)
+      {
+         m_file.Close();
+         _wremove(m_tempName.c_str());
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Looks for a model in the cache, given the HashFileContents hash and
+   // the length of its STL file.  Returns true if it's there, in which
+   // case ReadFacet gives its facets.  Otherwise the facets should be
+   // given to AddFacet as they're read from the STL file, between Begin
+   // and Finish.
+   //--------------------------------------------------------------------
+   bool Find(std::uint64_t inputHash, std::uint64_t inputLength)
+   {
+      ContentHash key(version);
+      key.Update(&inputHash, sizeof(inputHash));
+      m_key = key.Digest();
+      m_inputHash = inputHash;
+      m_inputLength = inputLength;
+      m_hit = OpenEntry();
+      if (m_hit)
+         CacheDirectory::Touch(m_cache.EntryName(m_key));
+      return m_hit;
+   }
+
+   // Returns true if Find found the model in the cache.
+   bool Found() const { return m_hit; }
+
+   // Returns the number of facets in the cached model.
+   std::uint64_t NumFacets() const { return m_header.numFacets; }
+
+   //--------------------------------------------------------------------
+   // Reads the next facet of a model that Find found in the cache.
+   // Returns false if there are no more facets.
+   //--------------------------------------------------------------------
+   bool ReadFacet(Facet &facet)
+   {
+      assert(m_hit);
+      if (m_next == m_records.size())
+      {
+         const std::uint64_t remaining = m_header.numFacets - m_numRead;
+         if (remaining == 0)
+            return false;
+         m_records.resize(static_cast<size_t>(std::min(remaining, static_cast<std::uint64_t>(recordsPerBlock))));
+         const size_t numbytes = m_records.size() * sizeof(Record);
+         if (m_file.Read(m_records.data(), numbytes) != numbytes)
+            throw "Failed reading mesh cache file.";
+         m_next = 0;
+      }
+
+      const Record &record = m_records[m_next++];
+      for (int i = 0; i < 3; ++i)
+      {
+         facet.points[i].x = record.points[3 * i];
+         facet.points[i].y = record.points[3 * i + 1];
+         facet.points[i].z = record.points[3 * i + 2];
+      }
+      facet.normal.x = record.normal[0];
+      facet.normal.y = record.normal[1];
+      facet.normal.z = record.normal[2];
+      facet.attribute = record.attribute;
+      ++m_numRead;
+      return true;
+   }
+
+   //--------------------------------------------------------------------
+   // Starts a new cache file for a model that Find didn't find.  It's
+   // written under a temporary name until it's finished, so that an
+   // interrupted conversion can't leave a partial model in the cache.
+   // Returns false if the cache file can't be created.
+   //--------------------------------------------------------------------
+   bool Begin()
+   {
+      assert(!m_hit && !m_writing);
+      m_cache.Create();
+      m_tempName = m_cache.NewTempName(m_key);
+      if (!m_file.Create(m_tempName.c_str()))
+         return false;
+      m_writing = true;
+      m_header = Header();
+      m_header.inputHash = m_inputHash;
+      m_header.inputLength = m_inputLength;
+      Write(&m_header, sizeof(m_header));
+      return !m_failed;
+   }
+
+   //--------------------------------------------------------------------
+   // Adds a facet of the model to the new cache file.  Once writing the
+   // file has failed, the facets are ignored.
+   //--------------------------------------------------------------------
+   void AddFacet(const Facet &facet)
+   {
+      assert(m_writing);
+      if (m_failed)
+         return;
+      Record record;
+      for (int i = 0; i < 3; ++i)
+      {
+         record.points[3 * i] = facet.points[i].x;
+         record.points[3 * i + 1] = facet.points[i].y;
+         record.points[3 * i + 2] = facet.points[i].z;
+      }
+      record.normal[0] = facet.normal.x;
+      record.normal[1] = facet.normal.y;
+      record.normal[2] = facet.normal.z;
+      record.attribute = facet.attribute;
+      m_records.push_back(record);
+      ++m_header.numFacets;
+      if (m_records.size() >= recordsPerBlock)
+      {
+         Write(m_records.data(), m_records.size() * sizeof(Record));
+         m_records.clear();
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Finishes the new cache file, puts it in the cache, and trims the
+   // cache back to its budget.  Returns false if the file couldn't be
+   // written or added to the cache, e.g. because the disk is full or
+   // another process has the old entry open; the file is deleted.
+   //--------------------------------------------------------------------
+   bool Finish()
+   {
+      assert(m_writing);
+      Write(m_records.data(), m_records.size() * sizeof(Record));
+      m_records.clear();
+      if (!m_failed && !m_file.Seek(0))
+         m_failed = true;
+      Write(&m_header, sizeof(m_header));
+      m_file.Close();
+      m_writing = false;
+      if (m_failed)
+      {
+         _wremove(m_tempName.c_str());
+         return false;
+      }
+      return m_cache.Add(m_key, m_tempName);
+   }
+
+private:
+   static constexpr std::uint32_t version = 1;
+   static constexpr size_t recordsPerBlock = 4096;
+
+   // The start of a cache file.  The hash and length of the STL file
+   // guard against the unlikely event of two files with the same hash.
+   struct Header
+   {
+      char magic[8] = { 'S', 'T', 'L', 'M', 'E', 'S', 'H', '\0' };
+      std::uint32_t version = MeshCache::version;
+      std::uint32_t recordSize = sizeof(MeshCache::Record);
+      std::uint64_t inputHash = 0;
+      std::uint64_t inputLength = 0;
+      std::uint64_t numFacets = 0;
+   };
+
+   // A facet in a cache file.  The coordinates are kept as doubles, as
+   // parsed from the STL file, so a cached model converts exactly as
+   // the STL file itself does.
+   struct Record
+   {
+      double points[9];
+      double normal[3];
+      std::uint16_t attribute;
+      std::uint16_t reserved[3];
+      Record() : attribute(0), reserved{0, 0, 0} { }
+   };
+
+   //--------------------------------------------------------------------
+   // Opens the cache file for the current key, and checks that it's a
+   // complete cache file for the same STL file.
+   //--------------------------------------------------------------------
+   bool OpenEntry()
+   {
+      if (!m_file.Open(m_cache.EntryName(m_key).c_str()))
+         return false;
+      const Header expected;
+      const std::uint64_t length = m_file.Length();
+      if (m_file.Read(&m_header, sizeof(m_header)) != sizeof(m_header) ||
+          memcmp(m_header.magic, expected.magic, sizeof(expected.magic)) != 0 ||
+          m_header.version != expected.version || m_header.recordSize != expected.recordSize ||
+          m_header.inputHash != m_inputHash || m_header.inputLength != m_inputLength ||
+          length != sizeof(Header) + m_header.numFacets * sizeof(Record))
+      {
+         m_file.Close();
+         m_header = Header();
+         return false;
+      }
+      return true;
+   }
+
+   // Writes to the new cache file, unless writing it has already
+   // failed.
+   void Write(const void *data, size_t numbytes)
+   {
+      if (!m_failed && numbytes > 0 && !m_file.Write(data, numbytes))
+         m_failed = true;
+   }
+
+   CacheDirectory m_cache;
+   std::uint64_t m_key = 0;
+   std::uint64_t m_inputHash = 0;
+   std::uint64_t m_inputLength = 0;
+   std::wstring m_tempName;
+   bool m_hit = false, m_writing = false, m_failed = false;
+   File m_file;
+   Header m_header;
+   std::vector<Record> m_records;
+   size_t m_next = 0;
+   std::uint64_t m_numRead = 0;
+};
@@ -0,0 +1,986 @@
+//--------------------------------------------------------------------
+// meshops.h - Operations that stl2vrml can apply to a whole Mesh
+// before writing it out.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#include "mesh.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cfloat>
+
+//--------------------------------------------------------------------
+// Finds the bounding box of all of the mesh's vertices.
+//--------------------------------------------------------------------
+inline void MeshBounds(const Mesh &mesh, Point &emin, Point &emax)
+{
+   emin = emax = Point();
+   if (mesh.m_points.empty())
+      return;
+
+   emin = emax = mesh.m_points[0];
+   for (const auto &pt : mesh.m_points)
+   {
+      emin.x = std::min(emin.x, pt.x);  emax.x = std::max(emax.x, pt.x);
+      emin.y = std::min(emin.y, pt.y);  emax.y = std::max(emax.y, pt.y);
+      emin.z = std::min(emin.z, pt.z);  emax.z = std::max(emax.z, pt.z);
+   }
+}
+
+//--------------------------------------------------------------------
+// Returns the length of the diagonal of the mesh's bounding box.
+// Used to scale the tolerances of geometric comparisons to the size
+// of the model.
+//--------------------------------------------------------------------
+inline double MeshExtent(const Mesh &mesh)
+{
+   Point emin, emax;
+   MeshBounds(mesh, emin, emax);
+   return Length(emax - emin);
+}
+
+//--------------------------------------------------------------------
+// Joins adjacent coplanar triangles of the mesh into larger convex
+// polygons.  Two triangles are joined only when they share an edge,
+// lie in the same plane, and face the same way, and only when the
+// polygon they form stays convex.  Vertices are never removed, so
+// the result has exactly the same shape and the same vertices as
+// the input.  Faces that aren't triangles are left as they are.
+// A merged polygon keeps the face normal of the triangle it grew
+// from.  Should be done before computing corner normals, which
+// aren't kept.  Returns the number of faces in the merged mesh.
+//--------------------------------------------------------------------
+inline size_t MergeCoplanarFaces(Mesh &mesh)
+{
+   // Longest polygon we'll build.  Keeps the boundary searches below
+   // cheap on big flat areas, and keeps the output lines reasonable.
+   constexpr size_t maxPolygonVertices = 256;
+
+   const size_t numFaces = mesh.NumFaces();
+   const std::vector<Point> &pts = mesh.m_points;
+
+   // Tolerances for deciding that two triangles are in the same plane.
+   // STL coordinates are single precision floats, so points that were
+   // coplanar in the modelling program wander off the plane by about
+   // one part in ten million of the model's size.
+   const double maxDistance = MeshExtent(mesh) * 1e-6;
+   const double minNormalDot = 1. - 1e-8;
+
+   // Compute the unit normal of each triangle.  Degenerate triangles
+   // get a zero normal and are never merged.
+   std::vector<Point> normals(numFaces);
+   for (size_t f = 0; f < numFaces; ++f)
+   {
+      if (mesh.FaceSize(f) != 3)
+         continue;
+      const std::uint32_t *v = mesh.Face(f);
+      Point n = Cross(pts[v[1]] - pts[v[0]], pts[v[2]] - pts[v[0]]);
+      const double len = Length(n);
+      if (len > 0.)
+      {
+         n.x /= len;  n.y /= len;  n.z /= len;
+         normals[f] = n;
+      }
+   }
+
+   // Build a table that finds the triangle containing a given directed
+   // edge.  Edges that are used by more than one triangle in the same
+   // direction (non-manifold geometry) are marked so we don't merge
+   // across them.
+   constexpr std::uint32_t ambiguous = UINT32_MAX;
+   std::unordered_map<std::uint64_t, std::uint32_t> edgeFace;
+   edgeFace.reserve(numFaces * 3);
+   for (size_t f = 0; f < numFaces; ++f)
+   {
+      if (mesh.FaceSize(f) != 3)
+         continue;
+      const std::uint32_t *v = mesh.Face(f);
+      for (size_t i = 0; i < 3; ++i)
+      {
+         auto result = edgeFace.emplace(EdgeKey(v[i], v[(i + 1) % 3]), static_cast<std::uint32_t>(f));
+         if (!result.second)
+            result.first->second = ambiguous;
+      }
+   }
+
+   // Returns true if the turn a -> b -> c doesn't bend the wrong way
+   // (clockwise) when seen from the side the normal points to.
+   // Straight lines are allowed.
+   auto isConvexTurn = [&pts](std::uint32_t a, std::uint32_t b, std::uint32_t c, const Point &normal)
+   {
+      const Point ab = pts[b] - pts[a];
+      const Point bc = pts[c] - pts[b];
+      return Dot(Cross(ab, bc), normal) >= -1e-9 * Length(ab) * Length(bc);
+   };
+
+   Mesh merged;
+   merged.m_indexes.reserve(mesh.m_indexes.size());
+   merged.m_faceStart.reserve(numFaces + 1);
+
+   std::vector<bool> used(numFaces, false);
+   std::vector<std::uint32_t> polygon;
+   for (size_t seed = 0; seed < numFaces; ++seed)
+   {
+      if (used[seed])
+         continue;
+      used[seed] = true;
+
+      const std::uint32_t *v = mesh.Face(seed);
+      polygon.assign(v, v + mesh.FaceSize(seed));
+      if (!mesh.m_faceNormals.empty())
+         merged.m_faceNormals.push_back(mesh.m_faceNormals[seed]);
+
+      const Point normal = normals[seed];
+      if (polygon.size() != 3 || Length(normal) == 0.)
+      {
+         merged.AddFace(polygon.data(), polygon.size());
+         continue;
+      }
+      const double planeOffset = Dot(normal, pts[polygon[0]]);
+
+      // Walk around the polygon's boundary, absorbing any neighboring
+      // triangle that keeps the polygon flat and convex.  Each time a
+      // triangle is absorbed its outer vertex is inserted into the
+      // boundary and we look at the new edge before moving on.  We're
+      // done when we've gone all the way around without a change.
+      size_t edge = 0, edgesUnchanged = 0;
+      while (edgesUnchanged < polygon.size() && polygon.size() < maxPolygonVertices)
+      {
+         const size_t n = polygon.size();
+         const std::uint32_t a = polygon[edge];
+         const std::uint32_t b = polygon[(edge + 1) % n];
+
+         // A neighbor facing the same way runs along our edge in the
+         // opposite direction.
+         bool absorbed = false;
+         auto found = edgeFace.find(EdgeKey(b, a));
+         if (found != edgeFace.end() && found->second != ambiguous && !used[found->second])
+         {
+            const std::uint32_t nbr = found->second;
+            const std::uint32_t *nv = mesh.Face(nbr);
+            std::uint32_t c = nv[0];
+            if (c == a || c == b)
+               c = (nv[1] == a || nv[1] == b) ? nv[2] : nv[1];
+
+            if (Dot(normals[nbr], normal) >= minNormalDot &&
+                fabs(Dot(normal, pts[c]) - planeOffset) <= maxDistance &&
+                std::find(polygon.begin(), polygon.end(), c) == polygon.end() &&
+                isConvexTurn(polygon[(edge + n - 1) % n], a, c, normal) &&
+                isConvexTurn(c, b, polygon[(edge + 2) % n], normal))
+            {
+               polygon.insert(polygon.begin() + static_cast<std::ptrdiff_t>(edge + 1), c);
+               used[nbr] = true;
+               absorbed = true;
+            }
+         }
+
+         if (absorbed)
+         {
+            edgesUnchanged = 0;
+         }
+         else
+         {
+            edge = (edge + 1) % polygon.size();
+            ++edgesUnchanged;
+         }
+      }
+
+      merged.AddFace(polygon.data(), polygon.size());
+   }
+
+   merged.m_points = std::move(mesh.m_points);
+   mesh = std::move(merged);
+   return mesh.NumFaces();
+}
+
+//--------------------------------------------------------------------
+// Finds the connected components of the mesh, that is, the groups of
+// faces that are joined to each other through shared vertices (and
+// so also through shared edges).  On return faceComponent gives the
+// component number of each face.  Components are numbered from zero
+// in the order of their first face.  Returns the number of
+// components.
+//
+// The faces are joined using a lock-free union-find spread across
+// all of the cores.  Each set is always linked under the root with
+// the lower vertex index, so the threads can't form a cycle and the
+// final roots don't depend on the order the threads ran in.
+//--------------------------------------------------------------------
+inline size_t LabelConnectedComponents(const Mesh &mesh, std::vector<std::uint32_t> &faceComponent)
+{
+   const size_t numPoints = mesh.m_points.size();
+   std::unique_ptr<std::atomic<std::uint32_t>[]> parent(new std::atomic<std::uint32_t>[numPoints]);
+   ParallelFor(numPoints, [&parent](size_t begin, size_t end)
+   {
+      for (size_t i = begin; i < end; ++i)
+         parent[i].store(static_cast<std::uint32_t>(i), std::memory_order_relaxed);
+   });
+
+   // Finds the root of a vertex's set, halving the path as it goes.
+   // A failed path-halving update just means another thread got
+   // there first, which is harmless.
+   auto find = [&parent](std::uint32_t v)
+   {
+      for (;;)
+      {
+         std::uint32_t p = parent[v].load(std::memory_order_relaxed);
+         if (p == v)
+            return v;
+         const std::uint32_t grandparent = parent[p].load(std::memory_order_relaxed);
+         if (grandparent != p)
+            parent[v].compare_exchange_weak(p, grandparent, std::memory_order_relaxed);
+         v = grandparent;
+      }
+   };
+
+   // Joins the sets of two vertices.  Linking only succeeds if the
+   // higher root is still a root, otherwise we look again.
+   auto unite = [&parent, &find](std::uint32_t a, std::uint32_t b)
+   {
+      for (;;)
+      {
+         a = find(a);
+         b = find(b);
+         if (a == b)
+            return;
+         if (a < b)
+            std::swap(a, b);
+         std::uint32_t expected = a;
+         if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+            return;
+      }
+   };
+
+   const size_t numFaces = mesh.NumFaces();
+   ParallelFor(numFaces, [&mesh, &unite](size_t begin, size_t end)
+   {
+      for (size_t face = begin; face < end; ++face)
+      {
+         const std::uint32_t *v = mesh.Face(face);
+         for (size_t i = 1; i < mesh.FaceSize(face); ++i)
+            unite(v[0], v[i]);
+      }
+   });
+
+   // Find the root of each face, then number the roots in order of
+   // their first face.
+   faceComponent.resize(numFaces);
+   ParallelFor(numFaces, [&mesh, &find, &faceComponent](size_t begin, size_t end)
+   {
+      for (size_t face = begin; face < end; ++face)
+         faceComponent[face] = find(mesh.Face(face)[0]);
+   });
+
+   constexpr std::uint32_t unlabeled = UINT32_MAX;
+   std::vector<std::uint32_t> rootLabel(numPoints, unlabeled);
+   std::uint32_t numComponents = 0;
+   for (auto &component : faceComponent)
+   {
+      std::uint32_t &label = rootLabel[component];
+      if (label == unlabeled)
+         label = numComponents++;
+      component = label;
+   }
+   return numComponents;
+}
+
+//--------------------------------------------------------------------
+// Sorts the faces of a mesh by component number, keeping them in
+// their original order within each component.  On return the faces
+// of component c are componentFaces[componentStart[c]] up to
+// componentFaces[componentStart[c + 1]].
+//--------------------------------------------------------------------
+inline void SortFacesByComponent(const std::vector<std::uint32_t> &faceComponent, size_t numComponents,
+                                 std::vector<std::uint32_t> &componentStart,
+                                 std::vector<std::uint32_t> &componentFaces)
+{
+   componentStart.assign(numComponents + 1, 0);
+   for (auto c : faceComponent)
+      ++componentStart[c + 1];
+   for (size_t c = 0; c < numComponents; ++c)
+      componentStart[c + 1] += componentStart[c];
+
+   componentFaces.resize(faceComponent.size());
+   std::vector<std::uint32_t> next(componentStart.begin(), componentStart.end() - 1);
+   for (size_t face = 0; face < faceComponent.size(); ++face)
+      componentFaces[next[faceComponent[face]]++] = static_cast<std::uint32_t>(face);
+}
+
+//--------------------------------------------------------------------
+// Finds the bounding box of the vertices used by the listed faces.
+//--------------------------------------------------------------------
+inline void FacesBounds(const Mesh &mesh, const std::uint32_t *faces, size_t numFaces,
+                        Point &emin, Point &emax)
+{
+   emin = emax = mesh.m_points[mesh.Face(faces[0])[0]];
+   for (size_t f = 0; f < numFaces; ++f)
+   {
+      const std::uint32_t *v = mesh.Face(faces[f]);
+      for (size_t i = 0; i < mesh.FaceSize(faces[f]); ++i)
+      {
+         const Point &pt = mesh.m_points[v[i]];
+         emin.x = std::min(emin.x, pt.x);  emax.x = std::max(emax.x, pt.x);
+         emin.y = std::min(emin.y, pt.y);  emax.y = std::max(emax.y, pt.y);
+         emin.z = std::min(emin.z, pt.z);  emax.z = std::max(emax.z, pt.z);
+      }
+   }
+}
+
+//--------------------------------------------------------------------
+// Copies the listed faces of a mesh, and the vertices and normals
+// they use, into a new mesh.  The vertices are translated by
+// subtracting "origin".
+//--------------------------------------------------------------------
+inline void ExtractFaces(const Mesh &mesh, const std::uint32_t *faces, size_t numFaces,
+                         const Point &origin, Mesh &part)
+{
+   part.Clear();
+   std::unordered_map<std::uint32_t, std::uint32_t> localIndex;
+   std::vector<std::uint32_t> indexes;
+   for (size_t f = 0; f < numFaces; ++f)
+   {
+      indexes.clear();
+      const std::uint32_t *v = mesh.Face(faces[f]);
+      for (size_t i = 0; i < mesh.FaceSize(faces[f]); ++i)
+      {
+         auto result = localIndex.emplace(v[i], static_cast<std::uint32_t>(part.m_points.size()));
+         if (result.second)
+            part.m_points.push_back(mesh.m_points[v[i]] - origin);
+         indexes.push_back(result.first->second);
+         if (!mesh.m_cornerNormals.empty())
+            part.m_cornerNormals.push_back(mesh.m_cornerNormals[mesh.m_faceStart[faces[f]] + i]);
+      }
+      part.AddFace(indexes.data(), indexes.size());
+      if (!mesh.m_faceNormals.empty())
+         part.m_faceNormals.push_back(mesh.m_faceNormals[faces[f]]);
+   }
+}
+
+//--------------------------------------------------------------------
+// Returns a canonical description of a part's geometry that doesn't
+// depend on the order of its faces or vertices:  each face is written
+// as its vertex coordinates, starting from its smallest vertex but
+// keeping its winding, and the faces are sorted.  Two parts have the
+// same shape exactly when their canonical forms are equal.
+//--------------------------------------------------------------------
+inline std::vector<double> CanonicalForm(const Mesh &part)
+{
+   auto less = [](const Point &a, const Point &b)
+   {
+      if (a.x != b.x) return a.x < b.x;
+      if (a.y != b.y) return a.y < b.y;
+      return a.z < b.z;
+   };
+
+   // Rotate each face so that it starts at its smallest vertex.
+   const size_t numFaces = part.NumFaces();
+   std::vector<std::vector<double>> faces(numFaces);
+   for (size_t face = 0; face < numFaces; ++face)
+   {
+      const std::uint32_t *v = part.Face(face);
+      const size_t n = part.FaceSize(face);
+      size_t first = 0;
+      for (size_t i = 1; i < n; ++i)
+         if (less(part.m_points[v[i]], part.m_points[v[first]]))
+            first = i;
+      for (size_t i = 0; i < n; ++i)
+      {
+         const Point &pt = part.m_points[v[(first + i) % n]];
+         faces[face].push_back(pt.x);
+         faces[face].push_back(pt.y);
+         faces[face].push_back(pt.z);
+      }
+   }
+   std::sort(faces.begin(), faces.end());
+
+   std::vector<double> form;
+   for (const auto &f : faces)
+   {
+      form.push_back(static_cast<double>(f.size()));
+      form.insert(form.end(), f.begin(), f.end());
+   }
+   return form;
+}
+
+//--------------------------------------------------------------------
+// Looks for connected components of the mesh that are repeated,
+// possibly moved to a different position, elsewhere in the mesh.
+// Each kind of repeated component becomes one instanced MeshPart,
+// stored relative to the corner of its bounding box, with a
+// placement for every copy.  Everything that isn't repeated goes
+// into a single part that isn't instanced, which comes first in
+// "parts".  Returns the number of instanced parts.
+//--------------------------------------------------------------------
+inline size_t FindRepeatedParts(const Mesh &mesh, std::vector<MeshPart> &parts)
+{
+   parts.clear();
+   std::vector<std::uint32_t> faceComponent, componentStart, componentFaces;
+   const size_t numComponents = LabelConnectedComponents(mesh, faceComponent);
+   SortFacesByComponent(faceComponent, numComponents, componentStart, componentFaces);
+
+   // Extract each component relative to the corner of its bounding
+   // box, and group together the components that look alike.  The
+   // hash of the canonical form finds candidates quickly; the forms
+   // themselves are compared to make sure they really match.
+   struct Kind
+   {
+      std::vector<double>   form;        // Canonical form of the component.
+      std::vector<size_t>   components;  // Components that have this form.
+      std::vector<Point>    corners;     // Bounding box corner of each one.
+   };
+   std::vector<Kind> kinds;
+   std::unordered_multimap<std::uint64_t, size_t> kindByHash;
+   std::vector<size_t> componentKind(numComponents);
+   Mesh part;
+   for (size_t c = 0; c < numComponents; ++c)
+   {
+      const std::uint32_t *faces = componentFaces.data() + componentStart[c];
+      const size_t numFaces = componentStart[c + 1] - componentStart[c];
+
+      Point corner, farCorner;
+      FacesBounds(mesh, faces, numFaces, corner, farCorner);
+
+      ExtractFaces(mesh, faces, numFaces, corner, part);
+      std::vector<double> form = CanonicalForm(part);
+      std::uint64_t hash = 14695981039346656037ull;
+      for (double d : form)
+      {
+         std::uint64_t bits = 0;
+         memcpy(&bits, &d, sizeof(bits));
+         hash = (hash ^ bits) * 1099511628211ull;
+      }
+
+      size_t kind = kinds.size();
+      auto range = kindByHash.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it)
+         if (kinds[it->second].form == form)
+            kind = it->second;
+      if (kind == kinds.size())
+      {
+         kinds.emplace_back();
+         kinds.back().form = std::move(form);
+         kindByHash.emplace(hash, kind);
+      }
+      kinds[kind].components.push_back(c);
+      kinds[kind].corners.push_back(corner);
+      componentKind[c] = kind;
+   }
+
+   // Gather the components that appear only once into one part that
+   // stays where it is.
+   parts.emplace_back();
+   std::vector<std::uint32_t> singles;
+   for (size_t c = 0; c < numComponents; ++c)
+      if (kinds[componentKind[c]].components.size() == 1)
+         singles.insert(singles.end(), componentFaces.data() + componentStart[c],
+                        componentFaces.data() + componentStart[c + 1]);
+   std::sort(singles.begin(), singles.end());
+   ExtractFaces(mesh, singles.data(), singles.size(), Point(), parts.back().m_mesh);
+
+   // Make an instanced part out of each kind of repeated component,
+   // using the first copy's geometry for all of them.
+   size_t numInstanced = 0;
+   for (auto &kind : kinds)
+   {
+      if (kind.components.size() < 2)
+         continue;
+      const size_t c = kind.components[0];
+      parts.emplace_back();
+      ExtractFaces(mesh, componentFaces.data() + componentStart[c],
+                   componentStart[c + 1] - componentStart[c], kind.corners[0], parts.back().m_mesh);
+      parts.back().m_placements = std::move(kind.corners);
+      ++numInstanced;
+   }
+   return numInstanced;
+}
+
+//--------------------------------------------------------------------
+// Splits the mesh into its connected components, giving each one
+// its own part in model coordinates.  The components are extracted
+// in parallel.  Returns the number of components.
+//--------------------------------------------------------------------
+inline size_t SplitConnectedComponents(const Mesh &mesh, std::vector<MeshPart> &parts)
+{
+   std::vector<std::uint32_t> faceComponent, componentStart, componentFaces;
+   const size_t numComponents = LabelConnectedComponents(mesh, faceComponent);
+   SortFacesByComponent(faceComponent, numComponents, componentStart, componentFaces);
+
+   parts.clear();
+   parts.resize(numComponents);
+   ParallelFor(numComponents, [&](size_t begin, size_t end)
+   {
+      for (size_t c = begin; c < end; ++c)
+         ExtractFaces(mesh, componentFaces.data() + componentStart[c],
+                      componentStart[c + 1] - componentStart[c], Point(), parts[c].m_mesh);
+   }, 1);
+   return numComponents;
+}
+
+//--------------------------------------------------------------------
+// Computes a smoothed normal for each corner of each face, so that a
+// curved surface made of flat faces is shaded smoothly.  The normal
+// at a corner is the average of the normals of the faces around the
+// corner's vertex, weighted by their areas.  Faces that meet the
+// corner's face at more than creaseAngle radians are left out of the
+// average, which keeps sharp edges sharp.  Replaces any face normals
+// the mesh had.  The work is spread across all of the cores.
+//--------------------------------------------------------------------
+inline void ComputeSmoothNormals(Mesh &mesh, double creaseAngle)
+{
+   const size_t numFaces = mesh.NumFaces();
+   const size_t numPoints = mesh.m_points.size();
+   const std::vector<Point> &pts = mesh.m_points;
+
+   // Find the normal of each face using Newell's method, which works
+   // for polygons as well as triangles.  Its length is twice the
+   // face's area, which gives the weighting we want.
+   std::vector<Point> areaNormals(numFaces);
+   ParallelFor(numFaces, [&](size_t begin, size_t end)
+   {
+      for (size_t face = begin; face < end; ++face)
+      {
+         const std::uint32_t *v = mesh.Face(face);
+         const size_t n = mesh.FaceSize(face);
+         Point sum;
+         for (size_t i = 0; i < n; ++i)
+         {
+            const Point &a = pts[v[i]];
+            const Point &b = pts[v[(i + 1) % n]];
+            sum.x += (a.y - b.y) * (a.z + b.z);
+            sum.y += (a.z - b.z) * (a.x + b.x);
+            sum.z += (a.x - b.x) * (a.y + b.y);
+         }
+         areaNormals[face] = sum;
+      }
+   });
+
+   // Build a list of the faces around each vertex.
+   std::vector<std::uint32_t> vertexStart(numPoints + 1, 0);
+   for (auto v : mesh.m_indexes)
+      ++vertexStart[v + 1];
+   for (size_t v = 0; v < numPoints; ++v)
+      vertexStart[v + 1] += vertexStart[v];
+   std::vector<std::uint32_t> vertexFaces(mesh.m_indexes.size());
+   {
+      std::vector<std::uint32_t> next(vertexStart.begin(), vertexStart.end() - 1);
+      for (size_t face = 0; face < numFaces; ++face)
+      {
+         const std::uint32_t *v = mesh.Face(face);
+         for (size_t i = 0; i < mesh.FaceSize(face); ++i)
+            vertexFaces[next[v[i]]++] = static_cast<std::uint32_t>(face);
+      }
+   }
+
+   // Average the normals at each corner.
+   const double minCos = cos(creaseAngle);
+   mesh.m_cornerNormals.resize(mesh.m_indexes.size());
+   ParallelFor(numFaces, [&](size_t begin, size_t end)
+   {
+      for (size_t face = begin; face < end; ++face)
+      {
+         const Point &own = areaNormals[face];
+         const double ownLength = Length(own);
+         const std::uint32_t *v = mesh.Face(face);
+         for (size_t i = 0; i < mesh.FaceSize(face); ++i)
+         {
+            Point sum;
+            for (size_t k = vertexStart[v[i]]; k < vertexStart[v[i] + 1]; ++k)
+            {
+               const Point &other = areaNormals[vertexFaces[k]];
+               const double otherLength = Length(other);
+               if (vertexFaces[k] != face &&
+                   Dot(own, other) < minCos * ownLength * otherLength)
+                  continue;
+               sum.x += other.x;  sum.y += other.y;  sum.z += other.z;
+            }
+
+            const double len = Length(sum);
+            if (len > 0.)
+            {
+               sum.x /= len;  sum.y /= len;  sum.z /= len;
+            }
+            mesh.m_cornerNormals[mesh.m_faceStart[face] + i] = sum;
+         }
+      }
+   });
+
+   mesh.m_faceNormals.clear();
+}
+
+//--------------------------------------------------------------------
+// Result of OrientFaces.
+//--------------------------------------------------------------------
+struct OrientResult
+{
+   size_t numFlipped = 0;     // Number of faces that were turned over.
+   bool   closed = true;      // Every edge is shared by exactly two faces.
+   bool   consistent = true;  // All faces could be made to agree.
+
+   // Returns true if the mesh is a closed surface with every face
+   // facing outward, so a viewer may safely cull back faces.
+   bool IsSolid() const { return closed && consistent; }
+};
+
+//--------------------------------------------------------------------
+// Returns true if the ray from origin in the direction dir passes
+// through the triangle abc (Moller-Trumbore).
+//--------------------------------------------------------------------
+inline bool RayCrossesTriangle(const Point &origin, const Point &dir,
+                               const Point &a, const Point &b, const Point &c)
+{
+   const Point e1 = b - a, e2 = c - a;
+   const Point p = Cross(dir, e2);
+   const double det = Dot(e1, p);
+   if (det == 0.)
+      return false;
+   const Point s = origin - a;
+   const double u = Dot(s, p) / det;
+   if (u < 0. || u > 1.)
+      return false;
+   const Point q = Cross(s, e1);
+   const double v = Dot(dir, q) / det;
+   if (v < 0. || u + v > 1.)
+      return false;
+   return Dot(e2, q) / det > 0.;
+}
+
+//--------------------------------------------------------------------
+// Makes the winding of the mesh's faces consistent, so that all of
+// the faces in each connected piece face the same way, and makes the
+// closed pieces face outward (counterclockwise seen from outside).
+//
+// Two faces that share an edge agree when they run along the edge
+// in opposite directions.  Starting from one face of each piece, we
+// spread its winding to its neighbors across the shared edges.  Then
+// the signed volume enclosed by each closed piece tells us whether
+// it's inside out.  A closed piece that's nested inside an odd number
+// of others, such as the wall of a cavity, is the inside of the solid
+// around it, so it should face inward and have a negative volume; the
+// others should have a positive volume.  A piece that's the wrong way
+// round is turned over as a whole.  A piece that isn't closed is
+// turned whichever way needs the fewest faces changed.  Face normals
+// are turned to match the winding.
+//
+// The edge table, the volume sums, the nesting test and the flipping
+// run in parallel; only the spreading of the winding is done one face
+// at a time.
+//--------------------------------------------------------------------
+inline OrientResult OrientFaces(Mesh &mesh)
+{
+   OrientResult result;
+   const size_t numFaces = mesh.NumFaces();
+   const size_t numCorners = mesh.m_indexes.size();
+   constexpr std::uint32_t none = UINT32_MAX;
+
+   // Make a list of every face edge, keyed by its two vertices with
+   // the lower one first, and sort it so that the uses of each edge
+   // end up next to each other.
+   struct EdgeUse
+   {
+      std::uint64_t key;       // Lower vertex, higher vertex.
+      std::uint32_t corner;    // Corner of the face where the edge starts.
+      std::uint32_t forward;   // Nonzero if the edge runs from lower to higher.
+   };
+   std::vector<EdgeUse> uses(numCorners);
+   std::vector<std::uint32_t> cornerFace(numCorners);
+   ParallelFor(numFaces, [&](size_t begin, size_t end)
+   {
+      for (size_t face = begin; face < end; ++face)
+      {
+         const std::uint32_t *v = mesh.Face(face);
+         const size_t n = mesh.FaceSize(face);
+         for (size_t i = 0; i < n; ++i)
+         {
+            const std::uint32_t a = v[i], b = v[(i + 1) % n];
+            const std::uint32_t corner = mesh.m_faceStart[face] + static_cast<std::uint32_t>(i);
+            uses[corner].key = EdgeKey(std::min(a, b), std::max(a, b));
+            uses[corner].corner = corner;
+            uses[corner].forward = a < b ? 1 : 0;
+            cornerFace[corner] = static_cast<std::uint32_t>(face);
+         }
+      }
+   });
+   ParallelSort(uses, [](const EdgeUse &a, const EdgeUse &b)
+      { return a.key < b.key || (a.key == b.key && a.corner < b.corner); });
+
+   // For each corner, find the face on the other side of the edge
+   // that starts there, and whether that face runs along the edge in
+   // the same direction.  Edges with one face are boundary edges, and
+   // edges with more than two are non-manifold; neither joins faces.
+   std::vector<std::uint32_t> neighbor(numCorners, none);
+   std::vector<std::uint8_t> sameDirection(numCorners, 0);
+   std::atomic<bool> open(false);
+   ParallelFor(numCorners, [&](size_t begin, size_t end)
+   {
+      // Start at the first use of an edge, skipping a group that
+      // began in the previous range.
+      size_t i = begin;
+      while (i > 0 && i < end && uses[i].key == uses[i - 1].key)
+         ++i;
+      bool foundOpenEdge = false;
+      while (i < end)
+      {
+         size_t groupEnd = i + 1;
+         while (groupEnd < numCorners && uses[groupEnd].key == uses[i].key)
+            ++groupEnd;
+         if (groupEnd - i == 2)
+         {
+            const EdgeUse &a = uses[i], &b = uses[i + 1];
+            neighbor[a.corner] = cornerFace[b.corner];
+            neighbor[b.corner] = cornerFace[a.corner];
+            sameDirection[a.corner] = sameDirection[b.corner] = (a.forward == b.forward) ? 1 : 0;
+         }
+         else
+         {
+            foundOpenEdge = true;
+         }
+         i = groupEnd;
+      }
+      if (foundOpenEdge)
+         open = true;
+   });
+   result.closed = !open;
+
+   // Spread the winding across each connected piece.  flip is -1 for
+   // faces we haven't reached yet, otherwise 1 if the face must be
+   // turned over.
+   std::vector<std::int8_t> flip(numFaces, -1);
+   std::vector<std::uint32_t> faceComponent(numFaces, 0);
+   std::vector<bool> componentClosed;
+   std::vector<std::uint32_t> queue;
+   for (size_t seed = 0; seed < numFaces; ++seed)
+   {
+      if (flip[seed] >= 0)
+         continue;
+
+      const std::uint32_t component = static_cast<std::uint32_t>(componentClosed.size());
+      componentClosed.push_back(true);
+      flip[seed] = 0;
+      faceComponent[seed] = component;
+      queue.assign(1, static_cast<std::uint32_t>(seed));
+      while (!queue.empty())
+      {
+         const std::uint32_t face = queue.back();
+         queue.pop_back();
+         for (std::uint32_t corner = mesh.m_faceStart[face]; corner < mesh.m_faceStart[face + 1]; ++corner)
+         {
+            const std::uint32_t other = neighbor[corner];
+            if (other == none)
+            {
+               componentClosed[component] = false;
+               continue;
+            }
+            const std::int8_t wanted = static_cast<std::int8_t>(flip[face] ^ sameDirection[corner]);
+            if (flip[other] < 0)
+            {
+               flip[other] = wanted;
+               faceComponent[other] = component;
+               queue.push_back(other);
+            }
+            else if (flip[other] != wanted)
+            {
+               // The piece can't be oriented, like a Moebius strip.
+               result.consistent = false;
+            }
+         }
+      }
+   }
+   const size_t numComponents = componentClosed.size();
+
+   // Add up the signed volume of each piece, and count its faces and
+   // how many of them would be turned over, to decide which way to
+   // turn each piece as a whole.
+   const std::vector<Point> &pts = mesh.m_points;
+   std::vector<double> faceVolume(numFaces, 0.);
+   ParallelFor(numFaces, [&](size_t begin, size_t end)
+   {
+      for (size_t face = begin; face < end; ++face)
+      {
+         const std::uint32_t *v = mesh.Face(face);
+         double volume = 0.;
+         for (size_t i = 1; i + 1 < mesh.FaceSize(face); ++i)
+            volume += Dot(pts[v[0]], Cross(pts[v[i]], pts[v[i + 1]]));
+         faceVolume[face] = flip[face] ? -volume : volume;
+      }
+   });
+   std::vector<double> volume(numComponents, 0.);
+   std::vector<size_t> faces(numComponents, 0), flipped(numComponents, 0);
+   for (size_t face = 0; face < numFaces; ++face)
+   {
+      volume[faceComponent[face]] += faceVolume[face];
+      ++faces[faceComponent[face]];
+      flipped[faceComponent[face]] += static_cast<size_t>(flip[face]);
+   }
+
+   // Find how deeply each closed piece is nested inside the others.  A
+   // ray from a point inside a closed piece crosses it an odd number of
+   // times.  The ray is tilted a little off the axes, so that it doesn't
+   // run along the edges of blocky models.  Pieces that merely overlap,
+   // like the separate parts of a figure, aren't nested, so a piece only
+   // counts as inside another if the middles of several of its faces,
+   // spread through it, all are.
+   std::vector<size_t> closedPieces;
+   for (size_t c = 0; c < numComponents; ++c)
+      if (componentClosed[c])
+         closedPieces.push_back(c);
+   std::vector<size_t> depth(numComponents, 0);
+   if (closedPieces.size() > 1)
+   {
+      // The bounds of each piece, and the piece's faces listed together.
+      std::vector<Point> lo(numComponents), hi(numComponents);
+      for (auto c : closedPieces)
+      {
+         lo[c].x = lo[c].y = lo[c].z = DBL_MAX;
+         hi[c].x = hi[c].y = hi[c].z = -DBL_MAX;
+      }
+      std::vector<size_t> pieceStart(numComponents + 1, 0);
+      for (size_t face = 0; face < numFaces; ++face)
+         ++pieceStart[faceComponent[face] + 1];
+      for (size_t c = 0; c < numComponents; ++c)
+         pieceStart[c + 1] += pieceStart[c];
+      std::vector<std::uint32_t> pieceFaces(numFaces);
+      std::vector<size_t> next(pieceStart.begin(), pieceStart.end() - 1);
+      for (size_t face = 0; face < numFaces; ++face)
+      {
+         const std::uint32_t c = faceComponent[face];
+         pieceFaces[next[c]++] = static_cast<std::uint32_t>(face);
+         if (!componentClosed[c])
+            continue;
+         const std::uint32_t *v = mesh.Face(face);
+         for (size_t i = 0; i < mesh.FaceSize(face); ++i)
+         {
+            const Point &point = pts[v[i]];
+            lo[c].x = std::min(lo[c].x, point.x);  hi[c].x = std::max(hi[c].x, point.x);
+            lo[c].y = std::min(lo[c].y, point.y);  hi[c].y = std::max(hi[c].y, point.y);
+            lo[c].z = std::min(lo[c].z, point.z);  hi[c].z = std::max(hi[c].z, point.z);
+         }
+      }
+
+      Point dir;
+      dir.x = 1.;  dir.y = 0.0001234567;  dir.z = 0.0007654321;
+      const auto inside = [&](const Point &p, size_t b)
+      {
+         if (p.x < lo[b].x || p.x > hi[b].x || p.y < lo[b].y || p.y > hi[b].y ||
+             p.z < lo[b].z || p.z > hi[b].z)
+            return false;
+         size_t crossings = 0;
+         for (size_t f = pieceStart[b]; f < pieceStart[b + 1]; ++f)
+         {
+            const std::uint32_t *v = mesh.Face(pieceFaces[f]);
+            for (size_t k = 1; k + 1 < mesh.FaceSize(pieceFaces[f]); ++k)
+               if (RayCrossesTriangle(p, dir, pts[v[0]], pts[v[k]], pts[v[k + 1]]))
+                  ++crossings;
+         }
+         return crossings % 2 == 1;
+      };
+      constexpr size_t numProbes = 8;
+      ParallelFor(closedPieces.size(), [&](size_t begin, size_t end)
+      {
+         std::vector<Point> probes;
+         for (size_t i = begin; i < end; ++i)
+         {
+            const size_t a = closedPieces[i];
+            const size_t count = pieceStart[a + 1] - pieceStart[a];
+            probes.clear();
+            for (size_t k = 0; k < std::min(numProbes, count); ++k)
+            {
+               const std::uint32_t face = pieceFaces[pieceStart[a] + k * count / std::min(numProbes, count)];
+               const std::uint32_t *v = mesh.Face(face);
+               const size_t n = mesh.FaceSize(face);
+               Point middle;
+               for (size_t j = 0; j < n; ++j)
+               {
+                  middle.x += pts[v[j]].x / n;  middle.y += pts[v[j]].y / n;  middle.z += pts[v[j]].z / n;
+               }
+               probes.push_back(middle);
+            }
+            for (auto b : closedPieces)
+            {
+               if (b == a || lo[a].x < lo[b].x || hi[a].x > hi[b].x || lo[a].y < lo[b].y ||
+                   hi[a].y > hi[b].y || lo[a].z < lo[b].z || hi[a].z > hi[b].z)
+                  continue;
+               if (std::all_of(probes.begin(), probes.end(), [&](const Point &p) { return inside(p, b); }))
+                  ++depth[a];
+            }
+         }
+      }, 1);
+   }
+
+   std::vector<std::int8_t> invert(numComponents, 0);
+   for (size_t c = 0; c < numComponents; ++c)
+   {
+      if (componentClosed[c])
+         invert[c] = (volume[c] < 0.) != (depth[c] % 2 == 1) ? 1 : 0;
+      else
+         invert[c] = flipped[c] * 2 > faces[c] ? 1 : 0;
+   }
+
+   // Turn the faces over, and make the face normals agree with them.
+   std::atomic<size_t> numFlipped(0);
+   ParallelFor(numFaces, [&](size_t begin, size_t end)
+   {
+      size_t count = 0;
+      for (size_t face = begin; face < end; ++face)
+      {
+         const std::uint32_t first = mesh.m_faceStart[face];
+         const std::uint32_t last = mesh.m_faceStart[face + 1];
+         if (flip[face] != invert[faceComponent[face]])
+         {
+            // Reversing all but the first corner keeps the face
+            // starting at the same vertex.
+            std::reverse(mesh.m_indexes.begin() + first + 1, mesh.m_indexes.begin() + last);
+            if (!mesh.m_cornerNormals.empty())
+               std::reverse(mesh.m_cornerNormals.begin() + first + 1, mesh.m_cornerNormals.begin() + last);
+            ++count;
+         }
+
+         if (!mesh.m_faceNormals.empty() && last - first >= 3)
+         {
+            const std::uint32_t *v = mesh.Face(face);
+            Point &normal = mesh.m_faceNormals[face];
+            if (Dot(normal, Cross(pts[v[1]] - pts[v[0]], pts[v[2]] - pts[v[0]])) < 0.)
+            {
+               normal.x = -normal.x;  normal.y = -normal.y;  normal.z = -normal.z;
+            }
+         }
+      }
+      numFlipped += count;
+   });
+   result.numFlipped = numFlipped;
+   return result;
+}
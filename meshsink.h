@@ -0,0 +1,786 @@
+//--------------------------------------------------------------------
+// meshsink.h - Base class for the classes that write a 3D model to
+// an output file in one of the formats that stl2vrml supports.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#include "SimpleFile.h"
+#include "mesh.h"
+#include "meshops.h"
+#include "numformat.h"
+#include "parallel.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <cmath>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+//--------------------------------------------------------------------
+// Facet:  A triangle as read from an STL file, with the facet normal
+// that the file gave (zero if none) and, from a binary STL file, the
+// two attribute bytes, which some programs keep a color in.
+//--------------------------------------------------------------------
+struct Facet
+{
+   Point points[3];
+   Point normal;
+   std::uint16_t attribute = 0;
+};
+
+//--------------------------------------------------------------------
+// MeshSink:  The conversion hands the model to a sink either one
+// triangle at a time, as the triangles are read, or as a list of mesh
+// parts once the whole model has been loaded.  This class does the
+// work that's the same for every output format:  collecting streamed
+// triangles into batches, cutting large meshes into face sets of a
+// manageable size, walking through the parts with their placements
+// and groups, and rounding coordinates to the quantization grid.  The
+// derived classes encode the resulting pieces in their own format by
+// overriding the protected virtual functions.
+//
+// The member functions generally throw a string in the event of an
+// error.
+//--------------------------------------------------------------------
+class MeshSink
+{
+public:
+   MeshSink() = delete;
+   MeshSink(const MeshSink &) = delete;
+   explicit MeshSink(File &file, size_t maxPointsPerFaceSet = 3000)
+      : m_maxPointsPerFaceSet(maxPointsPerFaceSet), m_file(file) { }
+   virtual ~MeshSink() { }
+
+   //--------------------------------------------------------------------
+   // Sets the crease angle, in radians, written with smoothed corner
+   // normals.  It tells the viewer which edges were left sharp.
+   //--------------------------------------------------------------------
+   void SetCreaseAngle(double creaseAngle) { m_creaseAngle = creaseAngle; }
+
+   //--------------------------------------------------------------------
+   // Tells the sink whether the face sets will have normals.  This is
+   // called before WriteStart, for formats that must say so up front.
+   //--------------------------------------------------------------------
+   void SetNormals(bool normals) { m_normals = normals; }
+
+   //--------------------------------------------------------------------
+   // Returns true if the sink's format needs the model as a welded mesh,
+   // with the vertices that faces share written only once, rather than
+   // as triangles straight from the STL file.
+   //--------------------------------------------------------------------
+   virtual bool WantsMesh() const { return false; }
+
+   //--------------------------------------------------------------------
+   // Tells the sink whether the model's winding has been checked, and
+   // whether the model turned out to be a closed, outward facing solid.
+   // Once this has been called, each face set says so, which lets the
+   // viewer cull back faces of a solid and skip breaking the (convex)
+   // faces into triangles.
+   //--------------------------------------------------------------------
+   void SetSolid(bool solid)
+   {
+      m_writeHints = true;
+      m_solid = solid;
+   }
+
+   //--------------------------------------------------------------------
+   // Tells the sink to round coordinates to a grid with the given
+   // spacing, starting from origin, and to write them as whole numbers.
+   // WriteParts then puts everything in a Transform that scales the
+   // grid back to the model's own coordinates.  Integers are quicker to
+   // write than floating point numbers, and take fewer characters.
+   //--------------------------------------------------------------------
+   void SetQuantization(const Point &origin, double step)
+   {
+      assert(step > 0.);
+      m_quantize = true;
+      m_quantOrigin = m_coordOrigin = origin;
+      m_quantStep = step;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the beginning portion of the file.
+   //--------------------------------------------------------------------
+   virtual void WriteStart() = 0;
+
+   //--------------------------------------------------------------------
+   // Writes a 3D triangle to the file.
+   // Since individual facets are inefficient, we don't write the
+   // triangle immediately.  Instead, we accumulate the triangle into a
+   // buffer, and the buffer is written as a face set once it contains a
+   // sufficiently large number of triangles.  A format that stores
+   // facets as they come, with their normals and attributes, may
+   // override this.
+   //--------------------------------------------------------------------
+   virtual void WriteFacet(const Facet &facet)
+   {
+      // Save facet to list of facets.
+      m_triangles.insert(m_triangles.end(), facet.points, facet.points + 3);
+
+      // Write the list of facets when it gets big enough.
+      if (m_triangles.size() >= m_maxPointsPerFaceSet)
+         WriteBatchedFacets();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes a batch of 3D triangles to the file, in the same way as
+   // giving them to WriteFacet one at a time.
+   //--------------------------------------------------------------------
+   void WriteFacets(const std::vector<Facet> &facets)
+   {
+      for (const auto &facet : facets)
+         WriteFacet(facet);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes an indexed mesh to the file.  The mesh's faces may be any
+   // convex polygons, not just triangles.  Like the facets given to
+   // WriteFacet, the mesh is split into several face sets if it is
+   // large, with each face set carrying its own copy of the vertices
+   // that its faces use.
+   //--------------------------------------------------------------------
+   void WriteMesh(const Mesh &mesh)
+   {
+      // Maps vertex indexes in the whole mesh to vertex indexes in the
+      // face set being built.  A vertex that isn't in the current face
+      // set yet has a stale entry in localIndex, which we detect by
+      // checking that pointOrigin maps it back to the same vertex.
+      std::vector<std::uint32_t> localIndex(mesh.m_points.size(), 0);
+      std::vector<std::uint32_t> pointOrigin;
+      std::vector<std::uint32_t> faceIndexes;
+      Mesh faceSet;
+
+      for (size_t face = 0; face < mesh.NumFaces(); ++face)
+      {
+         const size_t faceSize = mesh.FaceSize(face);
+         if (faceSet.m_points.size() + faceSize > m_maxPointsPerFaceSet)
+         {
+            QueueFaceSet(std::move(faceSet));
+            faceSet.Clear();
+            pointOrigin.clear();
+         }
+
+         faceIndexes.clear();
+         const std::uint32_t *v = mesh.Face(face);
+         for (size_t i = 0; i < faceSize; ++i)
+         {
+            std::uint32_t &local = localIndex[v[i]];
+            if (local >= pointOrigin.size() || pointOrigin[local] != v[i])
+            {
+               local = static_cast<std::uint32_t>(faceSet.m_points.size());
+               faceSet.m_points.push_back(mesh.m_points[v[i]]);
+               pointOrigin.push_back(v[i]);
+            }
+            faceIndexes.push_back(local);
+            if (!mesh.m_cornerNormals.empty())
+               faceSet.m_cornerNormals.push_back(mesh.m_cornerNormals[mesh.m_faceStart[face] + i]);
+         }
+         faceSet.AddFace(faceIndexes.data(), faceIndexes.size());
+         if (!mesh.m_faceNormals.empty())
+            faceSet.m_faceNormals.push_back(mesh.m_faceNormals[face]);
+      }
+
+      if (faceSet.NumFaces() > 0)
+         QueueFaceSet(std::move(faceSet));
+      FlushFaceSets();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes a mesh to the file inside a group that gives the mesh's
+   // bounding box, so that a viewer can skip drawing it when it's out
+   // of view and can let the user select it as one piece.
+   //--------------------------------------------------------------------
+   void WriteGroup(const Mesh &mesh)
+   {
+      Point emin, emax;
+      MeshBounds(mesh, emin, emax);
+
+      // If the coordinates are quantized, the box needs to be in the
+      // same units as they are.
+      const double scale = m_quantize ? 1. / m_quantStep : 1.;
+      if (m_quantize)
+      {
+         emin = emin - m_coordOrigin;
+         emax = emax - m_coordOrigin;
+      }
+      Point center, size;
+      center.x = (emin.x + emax.x) / 2. * scale;
+      center.y = (emin.y + emax.y) / 2. * scale;
+      center.z = (emin.z + emax.z) / 2. * scale;
+      size.x = (emax.x - emin.x) * scale;
+      size.y = (emax.y - emin.y) * scale;
+      size.z = (emax.z - emin.z) * scale;
+
+      BeginBoundedGroup(center, size);
+      WriteMesh(mesh);
+      EndBoundedGroup();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the parts of a model to the file.  A part that isn't
+   // instanced is written just like WriteMesh would write it, or like
+   // WriteGroup if groupParts is true.  An instanced part is written
+   // once, named inside a transform that moves it to its first
+   // placement, and each further placement is a transform that reuses
+   // it by name.  If the coordinates are quantized, all of the parts go
+   // inside one more transform that maps the grid back to the model's
+   // coordinates.
+   //--------------------------------------------------------------------
+   void WriteParts(const std::vector<MeshPart> &parts, bool groupParts)
+   {
+      FlushFaceSets();
+      if (m_quantize)
+         BeginScaledTransform(m_quantOrigin, m_quantStep);
+
+      size_t partNumber = 0;
+      for (const auto &part : parts)
+      {
+         if (!part.IsInstanced())
+         {
+            if (groupParts)
+               WriteGroup(part.m_mesh);
+            else
+               WriteMesh(part.m_mesh);
+            continue;
+         }
+
+         ++partNumber;
+         for (size_t i = 0; i < part.m_placements.size(); ++i)
+         {
+            // If quantizing, the placement is rounded to the grid too,
+            // so that all of the copies of a part stay exactly alike.
+            Point where = part.m_placements[i];
+            if (m_quantize)
+            {
+               const Point offset = where - m_quantOrigin;
+               where.x = static_cast<double>(Quantize(offset.x));
+               where.y = static_cast<double>(Quantize(offset.y));
+               where.z = static_cast<double>(Quantize(offset.z));
+            }
+            BeginTransform(where);
+
+            if (i == 0)
+            {
+               // The part's mesh is relative to its placement, not to
+               // the corner of the model.
+               BeginPartDefinition(partNumber);
+               m_coordOrigin = Point();
+               WriteMesh(part.m_mesh);
+               m_coordOrigin = m_quantOrigin;
+               EndPartDefinition();
+            }
+            else
+               UsePart(partNumber);
+
+            EndTransform();
+         }
+      }
+
+      if (m_quantize)
+         EndTransform();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the remainder of the file after all of the facets have been
+   // given to us.  The minimum and maximum bounds of the 3D model
+   // should be provided in emin and emax.
+   //--------------------------------------------------------------------
+   void WriteEnd(const Point &emin, const Point &emax)
+   {
+      // Write any remaining facets that haven't been written yet.
+      if (!m_triangles.empty())
+         WriteBatchedFacets();
+      FlushFaceSets();
+
+      WriteTrailer(emin, emax);
+   }
+
+protected:
+   //--------------------------------------------------------------------
+   // Makes a sink with the same settings as another one, writing to a
+   // different file.  For use by NewFaceSetFormatter.
+   //--------------------------------------------------------------------
+   MeshSink(const MeshSink &settings, File &file)
+      : m_maxPointsPerFaceSet(settings.m_maxPointsPerFaceSet), m_file(file),
+        m_creaseAngle(settings.m_creaseAngle), m_normals(settings.m_normals),
+        m_writeHints(settings.m_writeHints), m_solid(settings.m_solid),
+        m_quantize(settings.m_quantize), m_quantStep(settings.m_quantStep),
+        m_quantOrigin(settings.m_quantOrigin), m_coordOrigin(settings.m_coordOrigin) { }
+
+   //--------------------------------------------------------------------
+   // Returns a new sink, with this one's current settings, that writes
+   // face sets to another file exactly as this one would.  Face sets
+   // are then formatted on several threads at once, into memory, and
+   // written to this sink's file in order, so that the output is the
+   // same as writing them one by one.  A format whose face sets depend
+   // on the ones before them returns nullptr, and its face sets are
+   // written one at a time.
+   //--------------------------------------------------------------------
+   virtual std::unique_ptr<MeshSink> NewFaceSetFormatter(File &) const { return nullptr; }
+
+   //--------------------------------------------------------------------
+   // Functions that encode the model in the derived class's format.
+   //--------------------------------------------------------------------
+
+   // Writes a piece of a mesh, with its normals if it has any.
+   virtual void WriteFaceSet(const Mesh &faceSet) = 0;
+
+   // Start a transform that translates what's inside it, or one that
+   // also scales it uniformly, and end either kind of transform.
+   virtual void BeginTransform(const Point &translation) = 0;
+   virtual void BeginScaledTransform(const Point &translation, double scale) = 0;
+   virtual void EndTransform() = 0;
+
+   // Start and end a group with a bounding box.
+   virtual void BeginBoundedGroup(const Point &center, const Point &size) = 0;
+   virtual void EndBoundedGroup() = 0;
+
+   // Start and end the first copy of an instanced part, which names it
+   // so that later copies can refer back to it, and write a later copy.
+   virtual void BeginPartDefinition(size_t partNumber) = 0;
+   virtual void EndPartDefinition() = 0;
+   virtual void UsePart(size_t partNumber) = 0;
+
+   // Writes what comes after the model, such as the camera position.
+   virtual void WriteTrailer(const Point &emin, const Point &emax) = 0;
+
+   //--------------------------------------------------------------------
+   // Helpers for the derived classes.
+   //--------------------------------------------------------------------
+
+   // Writes a string to the file.
+   void WriteText(const std::string &text)
+   {
+      if (!text.empty() && !m_file.Write(text.data(), text.size()))
+         throw writeError;
+   }
+
+   // Returns a coordinate value as a whole number of grid steps.
+   long long Quantize(double value) const
+   {
+      return std::llround(value / m_quantStep);
+   }
+
+   //--------------------------------------------------------------------
+   // Appends a vertex position as three numbers separated by spaces,
+   // rounded to the quantization grid if there is one.
+   //--------------------------------------------------------------------
+   void AppendCoordinate(std::string &text, const Point &point) const
+   {
+      if (!m_quantize)
+      {
+         AppendVector(text, point, 15);
+         return;
+      }
+      const Point offset = point - m_coordOrigin;
+      AppendInteger(text, Quantize(offset.x));
+      text += ' ';
+      AppendInteger(text, Quantize(offset.y));
+      text += ' ';
+      AppendInteger(text, Quantize(offset.z));
+   }
+
+   //--------------------------------------------------------------------
+   // Returns a vertex position in the units that it's written in, for
+   // formats that write numbers in binary:  whole grid steps if the
+   // coordinates are quantized, or else the position unchanged.
+   //--------------------------------------------------------------------
+   Point LocalCoordinate(const Point &point) const
+   {
+      if (!m_quantize)
+         return point;
+      const Point offset = point - m_coordOrigin;
+      Point local;
+      local.x = static_cast<double>(Quantize(offset.x));
+      local.y = static_cast<double>(Quantize(offset.y));
+      local.z = static_cast<double>(Quantize(offset.z));
+      return local;
+   }
+
+   //--------------------------------------------------------------------
+   // Appends the translation of a transform.  A placement that was
+   // rounded to the quantization grid is a whole number of steps, which
+   // is written in full even when it's too long for %.15G to write
+   // without an exponent.
+   //--------------------------------------------------------------------
+   static void AppendTranslation(std::string &text, const Point &translation)
+   {
+      const double values[3] = { translation.x, translation.y, translation.z };
+      for (int i = 0; i < 3; ++i)
+      {
+         if (i > 0)
+            text += ' ';
+         if (std::fabs(values[i]) >= 1e15 && std::fabs(values[i]) < 9e18 &&
+             values[i] == std::floor(values[i]))
+            AppendInteger(text, static_cast<std::int64_t>(values[i]));
+         else
+         {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.15G", values[i]);
+            text += buffer;
+         }
+      }
+   }
+
+   // Appends a vector, such as a normal, with the given number of
+   // significant digits.
+   static void AppendVector(std::string &text, const Point &v, int digits)
+   {
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), "%.*G %.*G %.*G", digits, v.x, digits, v.y, digits, v.z);
+      text += buffer;
+   }
+
+   //--------------------------------------------------------------------
+   // Helpers for formats that write numbers in binary, which are all
+   // little-endian.
+   //--------------------------------------------------------------------
+   static void AppendUint32(std::vector<std::uint8_t> &data, std::uint32_t value)
+   {
+      data.push_back(static_cast<std::uint8_t>(value));
+      data.push_back(static_cast<std::uint8_t>(value >> 8));
+      data.push_back(static_cast<std::uint8_t>(value >> 16));
+      data.push_back(static_cast<std::uint8_t>(value >> 24));
+   }
+
+   static void AppendFloat(std::vector<std::uint8_t> &data, float value)
+   {
+      std::uint32_t bits = 0;
+      memcpy(&bits, &value, sizeof(bits));
+      AppendUint32(data, bits);
+   }
+
+   static void AppendDouble(std::vector<std::uint8_t> &data, double value)
+   {
+      std::uint64_t bits = 0;
+      memcpy(&bits, &value, sizeof(bits));
+      AppendUint32(data, static_cast<std::uint32_t>(bits));
+      AppendUint32(data, static_cast<std::uint32_t>(bits >> 32));
+   }
+
+   //--------------------------------------------------------------------
+   // Makes a list of the unique corner normals of a face set, and an
+   // index into that list for each corner.
+   //--------------------------------------------------------------------
+   static void UniqueNormals(const Mesh &faceSet, std::vector<Point> &normals,
+                             std::vector<std::uint32_t> &normalIndexes)
+   {
+      normals.clear();
+      normalIndexes.clear();
+      std::unordered_map<Point, std::uint32_t, PointHash, PointEqual> normalIndex;
+      for (const auto &normal : faceSet.m_cornerNormals)
+      {
+         auto result = normalIndex.emplace(normal, static_cast<std::uint32_t>(normals.size()));
+         if (result.second)
+            normals.push_back(normal);
+         normalIndexes.push_back(result.first->second);
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // For formats where a normal belongs to a vertex rather than to a
+   // corner of a face:  makes a list of vertices, each being a point of
+   // the face set (vertexPoints) with one of its normals (vertexNormals,
+   // indexes into normals), and gives the vertex at each corner.  A
+   // point used with more than one normal becomes several vertices.  If
+   // the face set has no normals, the vertices are just its points.
+   //--------------------------------------------------------------------
+   static void SplitVerticesByNormal(const Mesh &faceSet, std::vector<Point> &normals,
+                                     std::vector<std::uint32_t> &vertexPoints,
+                                     std::vector<std::uint32_t> &vertexNormals,
+                                     std::vector<std::uint32_t> &cornerVertex)
+   {
+      std::vector<std::uint32_t> normalIndexes;
+      normals.clear();
+      if (!faceSet.m_cornerNormals.empty())
+         UniqueNormals(faceSet, normals, normalIndexes);
+      else if (!faceSet.m_faceNormals.empty())
+      {
+         normals = faceSet.m_faceNormals;
+         for (std::uint32_t face = 0; face < faceSet.NumFaces(); ++face)
+            normalIndexes.insert(normalIndexes.end(), faceSet.FaceSize(face), face);
+      }
+
+      vertexPoints.clear();
+      vertexNormals.clear();
+      if (normals.empty())
+      {
+         vertexPoints.resize(faceSet.m_points.size());
+         for (std::uint32_t i = 0; i < vertexPoints.size(); ++i)
+            vertexPoints[i] = i;
+         cornerVertex = faceSet.m_indexes;
+         return;
+      }
+
+      std::unordered_map<std::uint64_t, std::uint32_t> vertexIndex;
+      cornerVertex.clear();
+      cornerVertex.reserve(faceSet.m_indexes.size());
+      for (size_t corner = 0; corner < faceSet.m_indexes.size(); ++corner)
+      {
+         const std::uint64_t key = (static_cast<std::uint64_t>(faceSet.m_indexes[corner]) << 32) |
+                                   normalIndexes[corner];
+         auto result = vertexIndex.emplace(key, static_cast<std::uint32_t>(vertexPoints.size()));
+         if (result.second)
+         {
+            vertexPoints.push_back(faceSet.m_indexes[corner]);
+            vertexNormals.push_back(normalIndexes[corner]);
+         }
+         cornerVertex.push_back(result.first->second);
+      }
+   }
+
+private:
+   //--------------------------------------------------------------------
+   // Writes the batch of streamed triangles as a face set.
+   //--------------------------------------------------------------------
+   void WriteBatchedFacets()
+   {
+      assert((m_triangles.size() % 3) == 0);
+      Mesh faceSet;
+      faceSet.m_points = m_triangles;
+      for (std::uint32_t i = 0; i + 2 < faceSet.m_points.size(); i += 3)
+      {
+         const std::uint32_t tri[3] = { i, i + 1, i + 2 };
+         faceSet.AddFace(tri, 3);
+      }
+      QueueFaceSet(std::move(faceSet));
+      m_triangles.clear();
+   }
+
+   //--------------------------------------------------------------------
+   // Adds a face set to the ones waiting to be written.  If the format
+   // can't format them separately, or there's only one thread to do
+   // it on, the face set is written straight away.
+   //--------------------------------------------------------------------
+   void QueueFaceSet(Mesh &&faceSet)
+   {
+      // Enough face sets to keep the threads busy, but not so many that
+      // their text takes a lot of memory.
+      constexpr size_t maxQueuedFaceSets = 32;
+
+      if (!m_formatterChecked)
+      {
+         MemoryFile probe;
+         m_formatInParallel = NewFaceSetFormatter(probe) != nullptr;
+         m_formatterChecked = true;
+      }
+      m_queuedFaceSets.push_back(std::move(faceSet));
+      if (!m_formatInParallel || MaxLoopThreads() <= 1 ||
+          m_queuedFaceSets.size() >= maxQueuedFaceSets)
+         FlushFaceSets();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the face sets that are waiting, formatting them on several
+   // threads at once if there's more than one.
+   //--------------------------------------------------------------------
+   void FlushFaceSets()
+   {
+      const size_t count = m_queuedFaceSets.size();
+      if (count == 1 || (count > 1 && !m_formatInParallel))
+      {
+         for (const auto &faceSet : m_queuedFaceSets)
+            WriteFaceSet(faceSet);
+      }
+      else if (count > 1)
+      {
+         std::vector<MemoryFile> texts(count);
+         ParallelFor(count, [this, &texts](size_t begin, size_t end)
+         {
+            for (size_t i = begin; i < end; ++i)
+               NewFaceSetFormatter(texts[i])->WriteFaceSet(m_queuedFaceSets[i]);
+         }, 1);
+         for (const auto &text : texts)
+            WriteText(text.Data());
+      }
+      m_queuedFaceSets.clear();
+   }
+
+protected:
+   // Most points that we put into one face set.  The derived class
+   // may choose a different limit to suit its format.  It should be a
+   // multiple of three, so that batches of facets fill it exactly.
+   const size_t m_maxPointsPerFaceSet;
+
+   // The file we're writing.
+   File &m_file;
+
+   // Crease angle written with corner normals.
+   double m_creaseAngle = 0.;
+
+   // Whether the face sets will have normals.
+   bool m_normals = false;
+
+   // Whether to write the solid, ccw and convex hints, and whether
+   // the model is solid.
+   bool m_writeHints = false;
+   bool m_solid = false;
+
+   // Common error message string used by member functions.
+   const wchar_t *writeError = L"Failed writing to file.";
+
+private:
+   // Whether coordinates are rounded to a grid, the spacing of the grid
+   // and the model coordinates of its origin.  m_coordOrigin is the
+   // grid origin in the coordinates of the mesh being written, which
+   // differs from m_quantOrigin for the meshes of instanced parts.
+   bool m_quantize = false;
+   double m_quantStep = 1.;
+   Point m_quantOrigin;
+   Point m_coordOrigin;
+
+   // Triangles that haven't been written to the file yet.
+   // We accumulate them here and write them in batches,
+   // rather than writing them one-by-one.
+   std::vector<Point> m_triangles;
+
+   // Face sets waiting to be formatted and written, and whether the
+   // format lets them be formatted on separate threads.
+   std::vector<Mesh> m_queuedFaceSets;
+   bool m_formatterChecked = false;
+   bool m_formatInParallel = false;
+};
+
+//--------------------------------------------------------------------
+// FlatMeshSink:  Base class for sinks whose formats have no transforms
+// or reuse, only one list of vertices and faces.  It works out where
+// each face set ends up in model coordinates, and writes the faces of
+// an instanced part again for each copy.  The derived classes write
+// the face sets by overriding WriteFlatFaceSet.
+//--------------------------------------------------------------------
+class FlatMeshSink : public MeshSink
+{
+public:
+   FlatMeshSink() = delete;
+   FlatMeshSink(const FlatMeshSink &) = delete;
+
+   // Each mesh is written as one face set, so that the vertices that its
+   // faces share stay shared.
+   explicit FlatMeshSink(File &file) : MeshSink(file, 0xFFFFFFFF) { }
+
+   bool WantsMesh() const override { return true; }
+
+protected:
+   //--------------------------------------------------------------------
+   // Writes a face set, whose points are moved to model coordinates by
+   // WorldCoordinate.
+   //--------------------------------------------------------------------
+   virtual void WriteFlatFaceSet(const Mesh &faceSet) = 0;
+
+   // Returns a point of a face set in model coordinates.
+   Point WorldCoordinate(const Point &point) const
+   {
+      const Placement &place = m_placements.back();
+      const Point local = LocalCoordinate(point);
+      Point world;
+      world.x = place.offset.x + place.scale * local.x;
+      world.y = place.offset.y + place.scale * local.y;
+      world.z = place.offset.z + place.scale * local.z;
+      return world;
+   }
+
+   void WriteFaceSet(const Mesh &faceSet) override
+   {
+      if (faceSet.NumFaces() < 1)
+         return;  // Nothing to write.
+      if (m_definingPart)
+         m_parts.back().push_back(faceSet);
+      WriteFlatFaceSet(faceSet);
+   }
+
+   void BeginTransform(const Point &translation) override
+   {
+      BeginScaledTransform(translation, 1.);
+   }
+
+   void BeginScaledTransform(const Point &translation, double scale) override
+   {
+      const Placement &outer = m_placements.back();
+      Placement place;
+      place.offset.x = outer.offset.x + outer.scale * translation.x;
+      place.offset.y = outer.offset.y + outer.scale * translation.y;
+      place.offset.z = outer.offset.z + outer.scale * translation.z;
+      place.scale = outer.scale * scale;
+      m_placements.push_back(place);
+   }
+
+   void EndTransform() override
+   {
+      assert(m_placements.size() > 1);
+      m_placements.pop_back();
+   }
+
+   void BeginBoundedGroup(const Point &, const Point &) override { }
+   void EndBoundedGroup() override { }
+
+   //--------------------------------------------------------------------
+   // The face sets of an instanced part are kept, so that they can be
+   // written again at each of the part's other placements.
+   //--------------------------------------------------------------------
+   void BeginPartDefinition(size_t) override
+   {
+      m_parts.emplace_back();
+      m_definingPart = true;
+   }
+
+   void EndPartDefinition() override
+   {
+      m_definingPart = false;
+   }
+
+   void UsePart(size_t partNumber) override
+   {
+      assert(partNumber >= 1 && partNumber <= m_parts.size());
+      for (const auto &faceSet : m_parts[partNumber - 1])
+         WriteFlatFaceSet(faceSet);
+   }
+
+private:
+   // A translation and uniform scale from the coordinates of the face
+   // sets being written to model coordinates.
+   struct Placement
+   {
+      Point offset;
+      double scale = 1.;
+   };
+   std::vector<Placement> m_placements = std::vector<Placement>(1);
+
+   // The face sets of each instanced part, by part number less one.
+   std::vector<std::vector<Mesh>> m_parts;
+   bool m_definingPart = false;
+};
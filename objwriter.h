@@ -0,0 +1,142 @@
+//--------------------------------------------------------------------
+// objwriter.h - Class that writes a 3D model as a Wavefront .OBJ file.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * http://paulbourke.net/dataformats/obj/
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "meshsink.h"
+
+//--------------------------------------------------------------------
+// ObjWriter:  Writes a 3D model as a Wavefront .OBJ text file.  Each
+// face set's vertices and normals are written as "v" and "vn" lines,
+// followed by its faces as "f" lines that refer back to them.  The
+// vertices are numbered from one across the whole file, so the faces
+// of later face sets are offset by the number of vertices before them.
+// The member functions of this class generally throw a string in the
+// event of an error.
+//--------------------------------------------------------------------
+class ObjWriter : public FlatMeshSink
+{
+public:
+   ObjWriter() = delete;
+   ObjWriter(const ObjWriter &) = delete;
+   explicit ObjWriter(File &file) : FlatMeshSink(file) { }
+
+   //--------------------------------------------------------------------
+   // Writes the beginning portion of the OBJ file.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (!m_file.Printf("# Model converted by stl2vrml.\r\n"))
+         throw writeError;
+   }
+
+protected:
+
+   //--------------------------------------------------------------------
+   // Writes a face set's vertices, normals and faces.  OBJ gives each
+   // corner of a face both a vertex and a normal, so the normals don't
+   // need to be matched up with the vertices.
+   //--------------------------------------------------------------------
+   void WriteFlatFaceSet(const Mesh &faceSet) override
+   {
+      std::string text;
+      text.reserve(faceSet.m_points.size() * 48 + faceSet.m_indexes.size() * 16);
+      for (const auto &point : faceSet.m_points)
+      {
+         text += "v ";
+         AppendVector(text, WorldCoordinate(point), 15);
+         text += "\r\n";
+      }
+
+      // Corner normals are written as a list of unique normals, with an
+      // index into that list for each corner.  Face normals are written
+      // in the same order as the faces.
+      std::vector<Point> normals;
+      std::vector<std::uint32_t> normalIndexes;
+      if (!faceSet.m_cornerNormals.empty())
+         UniqueNormals(faceSet, normals, normalIndexes);
+      else if (!faceSet.m_faceNormals.empty())
+         normals = faceSet.m_faceNormals;
+      for (const auto &normal : normals)
+      {
+         text += "vn ";
+         AppendVector(text, normal, 7);
+         text += "\r\n";
+      }
+
+      for (size_t face = 0; face < faceSet.NumFaces(); ++face)
+      {
+         text += 'f';
+         const size_t start = faceSet.m_faceStart[face];
+         for (size_t i = 0; i < faceSet.FaceSize(face); ++i)
+         {
+            text += ' ';
+            AppendInteger(text, static_cast<std::int64_t>(m_vertexCount + faceSet.m_indexes[start + i] + 1));
+            if (!normals.empty())
+            {
+               const size_t normal = normalIndexes.empty() ? face : normalIndexes[start + i];
+               text += "//";
+               AppendInteger(text, static_cast<std::int64_t>(m_normalCount + normal + 1));
+            }
+         }
+         text += "\r\n";
+      }
+      WriteText(text);
+
+      m_vertexCount += faceSet.m_points.size();
+      m_normalCount += normals.size();
+   }
+
+   //--------------------------------------------------------------------
+   // Nothing comes after the faces in an OBJ file.
+   //--------------------------------------------------------------------
+   void WriteTrailer(const Point &, const Point &) override
+   {
+   }
+
+private:
+   // Numbers of vertices and normals written so far.
+   size_t m_vertexCount = 0;
+   size_t m_normalCount = 0;
+};
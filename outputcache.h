@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------
+// outputcache.h - Cache of finished output files, so that converting
+// the same STL file with the same options again is just a copy.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#include "cachedir.h"
+#include <string>
+#include <cstdint>
+
+//--------------------------------------------------------------------
+// OutputCache:  Keeps copies of finished output files in a cache
+// directory, keyed by a hash of everything that decides what's in
+// them:  the STL file's contents, the options, the output format and
+// the program's version.  The key is worked out by the caller.  An
+// output file that's in the cache is copied from there instead of
+// being converted again.
+//--------------------------------------------------------------------
+class OutputCache
+{
+public:
+   OutputCache() = delete;
+   OutputCache(const OutputCache &) = delete;
+   OutputCache(const std::wstring &directory, std::uint64_t budget)
+      : m_cache(directory, L".output", budget) { }
+
+   //--------------------------------------------------------------------
+   // Copies the cached output file for a key to the given file.  Returns
+   // false if it isn't in the cache.
+   //--------------------------------------------------------------------
+   bool Fetch(std::uint64_t key, const wchar_t *filename) const
+   {
+      const std::wstring name = m_cache.EntryName(key);
+      if (!CopyWholeFile(name.c_str(), filename))
+         return false;
+      CacheDirectory::Touch(name);
+      return true;
+   }
+
+   //--------------------------------------------------------------------
+   // Puts a copy of a finished output file in the cache.  Returns false
+   // if it couldn't be added.
+   //--------------------------------------------------------------------
+   bool Store(std::uint64_t key, const wchar_t *filename) const
+   {
+      m_cache.Create();
+      const std::wstring tempName = m_cache.NewTempName(key);
+      if (!CopyWholeFile(filename, tempName.c_str()))
+         return false;
+      return m_cache.Add(key, tempName);
+   }
+
+private:
+   CacheDirectory m_cache;
+};
@@ -0,0 +1,540 @@
+//--------------------------------------------------------------------
+// parallel.h - Minimal helpers for spreading a loop across all of
+// the processor cores, for handing work to another thread, and for
+// running many jobs at once on a pool of threads.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <exception>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+//--------------------------------------------------------------------
+// Returns the number of threads to use for parallel loops.
+//--------------------------------------------------------------------
+inline size_t NumWorkerThreads()
+{
+   const unsigned cores = std::thread::hardware_concurrency();
+   return cores > 0 ? cores : 1;
+}
+
+//--------------------------------------------------------------------
+// TaskPool:  A pool of threads for running many jobs, such as the
+// files of a batch conversion, together with the parallel loops
+// inside them.  Jobs wait in one queue and are started in the order
+// they were submitted, one per free thread.  ParallelFor called from
+// a job splits its loop into chunks on the pool instead of starting
+// threads of its own.  Each thread puts its chunks on its own queue
+// and runs them newest first; a thread that runs out of chunks steals
+// the oldest ones from the other threads before starting a new job,
+// so a huge file's loops spread across the cores that small files
+// leave free.  A thread waiting for its loop to finish runs chunks in
+// the meantime, but not jobs.  Each job may limit the number of chunks
+// its loops are split into, e.g. so that small jobs don't bother.
+//--------------------------------------------------------------------
+class TaskPool
+{
+public:
+   TaskPool() = delete;
+   TaskPool(const TaskPool &) = delete;
+   explicit TaskPool(size_t numThreads)
+   {
+      for (size_t i = 0; i < numThreads; ++i)
+         m_chunkQueues.emplace_back(new ChunkQueue);
+      for (size_t i = 0; i < numThreads; ++i)
+         m_threads.emplace_back([this, i]() { Run(i); });
+   }
+
+   // Waits for the jobs to finish.
+   ~TaskPool()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_stopping = true;
+      }
+      m_wake.notify_all();
+      for (auto &thread : m_threads)
+         thread.join();
+   }
+
+   // Returns the number of threads in the pool.
+   size_t NumThreads() const { return m_threads.size(); }
+
+   //--------------------------------------------------------------------
+   // Adds a job to the end of the queue.  Its parallel loops are split
+   // across at most loopThreads threads, or all of them if it's zero.
+   // Jobs should catch their own exceptions; one that escapes is lost.
+   //--------------------------------------------------------------------
+   void Submit(std::function<void()> job, size_t loopThreads = 0)
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_jobs.push_back({ std::move(job), loopThreads });
+         ++m_unfinishedJobs;
+      }
+      m_wake.notify_one();
+   }
+
+   // Waits until all of the submitted jobs have finished.
+   void Wait()
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobsDone.wait(lock, [this]() { return m_unfinishedJobs == 0; });
+   }
+
+   // Returns the pool that the calling thread belongs to, or null.
+   static TaskPool *Current() { return CurrentPool(); }
+
+   // Returns the most threads that the calling thread's current job
+   // may split a loop across.
+   size_t LoopThreads() const
+      { return CurrentLoopThreads() > 0 ? CurrentLoopThreads() : NumThreads(); }
+
+   //--------------------------------------------------------------------
+   // Puts a chunk of a parallel loop on the calling thread's queue.
+   // Must be called from one of the pool's threads.
+   //--------------------------------------------------------------------
+   void SubmitChunk(std::function<void()> chunk)
+   {
+      assert(CurrentPool() == this);
+      ChunkQueue &queue = *m_chunkQueues[CurrentIndex()];
+      {
+         std::lock_guard<std::mutex> lock(queue.mutex);
+         queue.chunks.push_back(std::move(chunk));
+      }
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         ++m_queuedChunks;
+      }
+      m_wake.notify_one();
+   }
+
+   //--------------------------------------------------------------------
+   // Runs one chunk, the calling thread's newest or another thread's
+   // oldest.  Returns false if there weren't any.
+   //--------------------------------------------------------------------
+   bool RunChunk()
+   {
+      std::function<void()> chunk;
+      if (!TakeChunk(chunk))
+         return false;
+      chunk();
+      return true;
+   }
+
+   //--------------------------------------------------------------------
+   // Runs chunks until "remaining" counts down to zero, sleeping while
+   // there are none to run.  The chunks being waited for count it down
+   // with FinishChunk, which wakes the waiting thread.
+   //--------------------------------------------------------------------
+   void RunChunksUntilDone(const std::atomic<size_t> &remaining)
+   {
+      while (remaining > 0)
+      {
+         if (RunChunk())
+            continue;
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_wake.wait(lock, [&]() { return remaining == 0 || m_queuedChunks > 0; });
+      }
+   }
+
+   // Counts down the chunks that a thread is waiting for.
+   void FinishChunk(std::atomic<size_t> &remaining)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--remaining == 0)
+         m_wake.notify_all();
+   }
+
+private:
+   struct ChunkQueue
+   {
+      std::mutex mutex;
+      std::deque<std::function<void()>> chunks;
+   };
+
+   struct Job
+   {
+      std::function<void()> run;
+      size_t loopThreads;
+   };
+
+   // The pool and queue of the calling thread, and its job's limit.
+   static TaskPool *&CurrentPool() { static thread_local TaskPool *pool = nullptr; return pool; }
+   static size_t &CurrentIndex() { static thread_local size_t index = 0; return index; }
+   static size_t &CurrentLoopThreads() { static thread_local size_t limit = 0; return limit; }
+
+   bool TakeChunk(std::function<void()> &chunk)
+   {
+      const size_t self = CurrentIndex();
+      for (size_t i = 0; i < m_chunkQueues.size(); ++i)
+      {
+         ChunkQueue &queue = *m_chunkQueues[(self + i) % m_chunkQueues.size()];
+         std::lock_guard<std::mutex> lock(queue.mutex);
+         if (queue.chunks.empty())
+            continue;
+         if (i == 0)
+         {
+            chunk = std::move(queue.chunks.back());
+            queue.chunks.pop_back();
+         }
+         else
+         {
+            chunk = std::move(queue.chunks.front());
+            queue.chunks.pop_front();
+         }
+         std::lock_guard<std::mutex> countLock(m_mutex);
+         --m_queuedChunks;
+         return true;
+      }
+      return false;
+   }
+
+   void Run(size_t index)
+   {
+      CurrentPool() = this;
+      CurrentIndex() = index;
+      for (;;)
+      {
+         if (RunChunk())
+            continue;
+
+         Job job;
+         {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_queuedChunks > 0 || !m_jobs.empty() || m_stopping; });
+            if (m_queuedChunks > 0)
+               continue;
+            if (m_jobs.empty())
+               return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+         }
+
+         CurrentLoopThreads() = job.loopThreads;
+         try
+         {
+            job.run();
+         }
+         catch (...)
+         {
+         }
+         CurrentLoopThreads() = 0;
+
+         std::lock_guard<std::mutex> lock(m_mutex);
+         if (--m_unfinishedJobs == 0)
+            m_jobsDone.notify_all();
+      }
+   }
+
+   std::vector<std::unique_ptr<ChunkQueue>> m_chunkQueues;
+   std::mutex m_mutex;
+   std::condition_variable m_wake;
+   std::condition_variable m_jobsDone;
+   std::deque<Job> m_jobs;
+   size_t m_unfinishedJobs = 0;
+   size_t m_queuedChunks = 0;
+   bool m_stopping = false;
+
+   // Declared last, so that everything else is ready when they start.
+   std::vector<std::thread> m_threads;
+};
+
+//--------------------------------------------------------------------
+// The most threads that a parallel loop may be split across on the
+// calling thread, when it isn't one of a TaskPool's, or zero for all
+// of them.  A WorkerThread sets it for its own thread.
+//--------------------------------------------------------------------
+inline size_t &ThreadLoopLimit()
+{
+   static thread_local size_t limit = 0;
+   return limit;
+}
+
+//--------------------------------------------------------------------
+// Returns the most threads that a parallel loop may be split across
+// on the calling thread.
+//--------------------------------------------------------------------
+inline size_t MaxLoopThreads()
+{
+   if (const TaskPool *pool = TaskPool::Current())
+      return pool->LoopThreads();
+   return ThreadLoopLimit() > 0 ? ThreadLoopLimit() : NumWorkerThreads();
+}
+
+//--------------------------------------------------------------------
+// Calls body(begin, end) for consecutive ranges of the indexes
+// [0, count), running the ranges on separate threads.  Each thread
+// gets at least minPerThread indexes, since small loops aren't worth
+// starting threads for; a loop too small to split runs on the calling
+// thread.  If the body throws, the first exception is passed on to
+// the caller once all of the threads have finished.  On a TaskPool's
+// thread, the ranges are run as chunks on the pool instead, and there
+// are only as many as the current job may use.
+//--------------------------------------------------------------------
+template <typename Body>
+void ParallelFor(size_t count, const Body &body, size_t minPerThread = 4096)
+{
+   const size_t numThreads = std::min(MaxLoopThreads(), (count + minPerThread - 1) / minPerThread);
+   if (numThreads <= 1)
+   {
+      if (count > 0)
+         body(size_t(0), count);
+      return;
+   }
+
+   std::vector<std::exception_ptr> errors(numThreads);
+   if (TaskPool *pool = TaskPool::Current())
+   {
+      // Hand out all but the first range, run that one here, and help
+      // with the chunks until the others are done.
+      std::atomic<size_t> remaining(numThreads - 1);
+      for (size_t t = 1; t < numThreads; ++t)
+      {
+         const size_t begin = count * t / numThreads;
+         const size_t end = count * (t + 1) / numThreads;
+         pool->SubmitChunk([pool, &body, &errors, &remaining, t, begin, end]()
+         {
+            try
+            {
+               body(begin, end);
+            }
+            catch (...)
+            {
+               errors[t] = std::current_exception();
+            }
+            pool->FinishChunk(remaining);
+         });
+      }
+      try
+      {
+         body(size_t(0), count / numThreads);
+      }
+      catch (...)
+      {
+         errors[0] = std::current_exception();
+      }
+      pool->RunChunksUntilDone(remaining);
+
+      for (auto &error : errors)
+         if (error)
+            std::rethrow_exception(error);
+      return;
+   }
+
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < numThreads; ++t)
+   {
+      const size_t begin = count * t / numThreads;
+      const size_t end = count * (t + 1) / numThreads;
+      threads.emplace_back([&body, &errors, t, begin, end]()
+      {
+         try
+         {
+            body(begin, end);
+         }
+         catch (...)
+         {
+            errors[t] = std::current_exception();
+         }
+      });
+   }
+
+   for (auto &thread : threads)
+      thread.join();
+   for (auto &error : errors)
+      if (error)
+         std::rethrow_exception(error);
+}
+
+//--------------------------------------------------------------------
+// Sorts a vector using all of the cores:  the vector is cut into
+// pieces that are sorted on separate threads, then neighboring
+// pieces are merged together, also in parallel, until one is left.
+// On a TaskPool's thread, there are only as many pieces as the
+// current job may use threads.
+//--------------------------------------------------------------------
+template <typename T, typename Less>
+void ParallelSort(std::vector<T> &items, const Less &less)
+{
+   constexpr size_t minPerPiece = 65536;
+   size_t numPieces = std::min(MaxLoopThreads(), (items.size() + minPerPiece - 1) / minPerPiece);
+   if (numPieces <= 1)
+   {
+      std::sort(items.begin(), items.end(), less);
+      return;
+   }
+
+   std::vector<size_t> bounds(numPieces + 1);
+   for (size_t p = 0; p <= numPieces; ++p)
+      bounds[p] = items.size() * p / numPieces;
+
+   ParallelFor(numPieces, [&](size_t begin, size_t end)
+   {
+      for (size_t p = begin; p < end; ++p)
+         std::sort(items.begin() + static_cast<std::ptrdiff_t>(bounds[p]),
+                   items.begin() + static_cast<std::ptrdiff_t>(bounds[p + 1]), less);
+   }, 1);
+
+   while (numPieces > 1)
+   {
+      const size_t numPairs = numPieces / 2;
+      ParallelFor(numPairs, [&](size_t begin, size_t end)
+      {
+         for (size_t pair = begin; pair < end; ++pair)
+            std::inplace_merge(items.begin() + static_cast<std::ptrdiff_t>(bounds[pair * 2]),
+                               items.begin() + static_cast<std::ptrdiff_t>(bounds[pair * 2 + 1]),
+                               items.begin() + static_cast<std::ptrdiff_t>(bounds[pair * 2 + 2]), less);
+      }, 1);
+
+      // Drop the bounds between the pieces that were merged.
+      std::vector<size_t> merged;
+      for (size_t p = 0; p < numPieces; p += 2)
+         merged.push_back(bounds[p]);
+      merged.push_back(bounds[numPieces]);
+      bounds.swap(merged);
+      numPieces = bounds.size() - 1;
+   }
+}
+
+//--------------------------------------------------------------------
+// WorkerThread:  Runs tasks one at a time, in the order they were
+// posted, on a thread of its own.  At most maxQueued tasks wait to be
+// run; Post blocks until there's room, so that a fast producer can't
+// get far ahead of a slow worker and fill up the memory.  If a task
+// throws, the tasks after it are skipped, and Finish passes the
+// exception on to the caller.  The parallel loops in the tasks are
+// split across at most loopThreads threads, or all of them if it's
+// zero.
+//--------------------------------------------------------------------
+class WorkerThread
+{
+public:
+   WorkerThread() = delete;
+   WorkerThread(const WorkerThread &) = delete;
+   explicit WorkerThread(size_t maxQueued, size_t loopThreads = 0)
+      : m_maxQueued(maxQueued), m_loopThreads(loopThreads), m_thread([this]() { Run(); }) { }
+
+   // Skips any tasks that haven't been run yet, e.g. if the producer
+   // gave up part way through.
+   ~WorkerThread()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_closed = true;
+         m_tasks.clear();
+      }
+      m_taskPosted.notify_one();
+      if (m_thread.joinable())
+         m_thread.join();
+   }
+
+   // Adds a task to the end of the queue, waiting for room if need be.
+   void Post(std::function<void()> task)
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_taskTaken.wait(lock, [this]() { return m_tasks.size() < m_maxQueued; });
+      m_tasks.push_back(std::move(task));
+      lock.unlock();
+      m_taskPosted.notify_one();
+   }
+
+   // Waits for all of the posted tasks to be run, and throws the
+   // exception that stopped them, if one did.
+   void Finish()
+   {
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         m_closed = true;
+      }
+      m_taskPosted.notify_one();
+      if (m_thread.joinable())
+         m_thread.join();
+      if (m_error)
+         std::rethrow_exception(m_error);
+   }
+
+private:
+   void Run()
+   {
+      ThreadLoopLimit() = m_loopThreads;
+      for (;;)
+      {
+         std::function<void()> task;
+         {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_taskPosted.wait(lock, [this]() { return !m_tasks.empty() || m_closed; });
+            if (m_tasks.empty())
+               return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+         }
+         m_taskTaken.notify_one();
+
+         if (!m_error)
+         {
+            try
+            {
+               task();
+            }
+            catch (...)
+            {
+               m_error = std::current_exception();
+            }
+         }
+      }
+   }
+
+   const size_t m_maxQueued;
+   const size_t m_loopThreads;
+   std::mutex m_mutex;
+   std::condition_variable m_taskPosted;
+   std::condition_variable m_taskTaken;
+   std::deque<std::function<void()>> m_tasks;
+   bool m_closed = false;
+   std::exception_ptr m_error;
+
+   // Declared last, so that everything else is ready when it starts.
+   std::thread m_thread;
+};
@@ -0,0 +1,190 @@
+//--------------------------------------------------------------------
+// plywriter.h - Class that writes a 3D model as a binary PLY file.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * http://paulbourke.net/dataformats/ply/
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "meshsink.h"
+
+//--------------------------------------------------------------------
+// PlyWriter:  Writes a 3D model as a binary little-endian PLY file,
+// with a welded list of vertices followed by a list of faces.  The
+// header gives the number of vertices and faces, which we don't know
+// until the end, so it's written with space for the numbers and filled
+// in at the end.  The vertices are written as each face set arrives,
+// while the faces, which must come after all of the vertices, are kept
+// in memory in their binary form until then.  The member functions of
+// this class generally throw a string in the event of an error.
+//--------------------------------------------------------------------
+class PlyWriter : public FlatMeshSink
+{
+public:
+   PlyWriter() = delete;
+   PlyWriter(const PlyWriter &) = delete;
+   explicit PlyWriter(File &file) : FlatMeshSink(file) { }
+
+   //--------------------------------------------------------------------
+   // Writes the PLY header, with the counts left as zeros for now.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      WriteText(Header());
+   }
+
+protected:
+
+   //--------------------------------------------------------------------
+   // Writes the vertices of a face set, and adds its faces to the list.
+   // Normals belong to vertices in PLY, so a point used with more than
+   // one normal becomes several vertices.
+   //--------------------------------------------------------------------
+   void WriteFlatFaceSet(const Mesh &faceSet) override
+   {
+      std::vector<Point> normals;
+      std::vector<std::uint32_t> vertexPoints, vertexNormals, cornerVertex;
+      SplitVerticesByNormal(faceSet, normals, vertexPoints, vertexNormals, cornerVertex);
+      if (m_vertexCount + vertexPoints.size() > 0x7FFFFFFF)
+         throw L"Too many vertices for a PLY file.";
+
+      std::vector<std::uint8_t> data;
+      data.reserve(vertexPoints.size() * (m_normals ? 36 : 24));
+      for (size_t i = 0; i < vertexPoints.size(); ++i)
+      {
+         const Point world = WorldCoordinate(faceSet.m_points[vertexPoints[i]]);
+         AppendDouble(data, world.x);
+         AppendDouble(data, world.y);
+         AppendDouble(data, world.z);
+         if (m_normals)
+         {
+            Point normal;
+            if (!vertexNormals.empty())
+               normal = normals[vertexNormals[i]];
+            AppendFloat(data, static_cast<float>(normal.x));
+            AppendFloat(data, static_cast<float>(normal.y));
+            AppendFloat(data, static_cast<float>(normal.z));
+         }
+      }
+      if (!data.empty() && !m_file.Write(data.data(), data.size()))
+         throw writeError;
+
+      // A face's corners are counted with one byte, so a bigger face is
+      // split into a fan of triangles.  Faces are always convex.
+      const std::uint32_t first = static_cast<std::uint32_t>(m_vertexCount);
+      for (size_t face = 0; face < faceSet.NumFaces(); ++face)
+      {
+         const std::uint32_t *v = cornerVertex.data() + faceSet.m_faceStart[face];
+         const size_t faceSize = faceSet.FaceSize(face);
+         if (faceSize <= 255)
+         {
+            m_faces.push_back(static_cast<std::uint8_t>(faceSize));
+            for (size_t i = 0; i < faceSize; ++i)
+               AppendUint32(m_faces, first + v[i]);
+            ++m_faceCount;
+            continue;
+         }
+         for (size_t i = 1; i + 1 < faceSize; ++i)
+         {
+            m_faces.push_back(3);
+            AppendUint32(m_faces, first + v[0]);
+            AppendUint32(m_faces, first + v[i]);
+            AppendUint32(m_faces, first + v[i + 1]);
+            ++m_faceCount;
+         }
+      }
+      m_vertexCount += vertexPoints.size();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the faces after the vertices, and fills in the counts in
+   // the header.
+   //--------------------------------------------------------------------
+   void WriteTrailer(const Point &, const Point &) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (!m_faces.empty() && !m_file.Write(m_faces.data(), m_faces.size()))
+         throw writeError;
+      std::vector<std::uint8_t>().swap(m_faces);
+
+      if (!m_file.Seek(0))
+         throw L"Failed seeking in output file.";
+      WriteText(Header());
+   }
+
+private:
+
+   //--------------------------------------------------------------------
+   // Returns the PLY header with the current counts.  The counts are
+   // padded to a fixed width, so that the header is the same length
+   // when it's written again at the end.
+   //--------------------------------------------------------------------
+   std::string Header() const
+   {
+      char buffer[512];
+      snprintf(buffer, sizeof(buffer),
+               "ply\n"
+               "format binary_little_endian 1.0\n"
+               "comment Model converted by stl2vrml.\n"
+               "element vertex %10zu\n"
+               "property double x\n"
+               "property double y\n"
+               "property double z\n"
+               "%s"
+               "element face %10zu\n"
+               "property list uchar int vertex_indices\n"
+               "end_header\n",
+               m_vertexCount,
+               m_normals ? "property float nx\n"
+                           "property float ny\n"
+                           "property float nz\n" : "",
+               m_faceCount);
+      return buffer;
+   }
+
+   // Numbers of vertices and faces written so far.
+   size_t m_vertexCount = 0;
+   size_t m_faceCount = 0;
+
+   // The faces, waiting to be written after the vertices.
+   std::vector<std::uint8_t> m_faces;
+};
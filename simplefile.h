@@ -36,9 +36,14 @@
 //--------------------------------------------------------------------
 //
 // Limitations / Bugs:
-// * Doesn't work with files over 2GB in size (uses 32-bit offsets).
+// * Positions and lengths are 64-bit, but size_t limits them to 4GB
+//   in a 32-bit build.
 // * Error handling is weak.
 //
+// The reading and writing functions are virtual, so that a derived
+// class can stand in for a plain file, e.g. to compress the data on
+// its way to another File.
+//
 //--------------------------------------------------------------------
 
 #pragma once
@@ -54,33 +59,34 @@ private:
    size_t m_lineCounter = 0;
 
 public:
-   ~File() { if (m_file) fclose(m_file); }
+   virtual ~File() { if (m_file) fclose(m_file); }
 
    // Open file for reading.
    bool Open(const wchar_t *filename)
       { return !(_wfopen_s(&m_file, filename, L"rb") || m_file == nullptr); }
 
-   // Open file for writing.
+   // Open file for writing.  What has been written may also be read
+   // back, e.g. to move it along after seeking.
    bool Create(const wchar_t *filename)
-      { return !(_wfopen_s(&m_file, filename, L"wb") || m_file == nullptr); }
+      { return !(_wfopen_s(&m_file, filename, L"w+b") || m_file == nullptr); }
 
    // Returns true if the file is currently open.
-   bool IsOpen()
+   virtual bool IsOpen()
       { return (m_file != nullptr); }
 
    // Close the file.
-   void Close() { if (m_file) fclose(m_file); }
+   virtual void Close() { if (m_file) fclose(m_file); m_file = nullptr; }
 
    // Seek to specific position in file.
-   bool Seek(size_t position)
-      { return !fseek(m_file, static_cast<long>(position), SEEK_SET); }
+   virtual bool Seek(size_t position)
+      { return !_fseeki64(m_file, static_cast<__int64>(position), SEEK_SET); }
 
    // Write numbytes of data to file.  Returns true if successful.
-   bool Write(const void *data, size_t numbytes)
+   virtual bool Write(const void *data, size_t numbytes)
       { return fwrite(data, numbytes, 1, m_file) == 1; }
 
    // Read numbytes of data from file.  Returns number of bytes actually read.
-   size_t Read(void *data, size_t numbytes)
+   virtual size_t Read(void *data, size_t numbytes)
       { return fread(data, 1, numbytes, m_file); }
 
    // Reads a line of text from the file.
@@ -94,15 +100,19 @@ public:
       do
       {
          text.clear();
+         readAny = false;
          char c = '\0';
-         while (Read(&c, 1) == 1 && c != '\n')
+         while (Read(&c, 1) == 1)
          {
             readAny = true;
+            if (c == '\n')
+            {
+               m_lineCounter++;
+               break;
+            }
             if (c != '\r')
                text += c;
          }
-         if (c == '\n')
-            m_lineCounter++;
       }
       while ((skipBlankLines && text.empty()) && readAny);
       return readAny;
@@ -133,15 +143,42 @@ public:
    }
 
    // Retrieve length of file in bytes.
-   // Note:  Returned value will be incorrect for files over 2GB in size.
-   size_t Length()
+   virtual size_t Length()
    {
       if (!m_file) return 0;
-      size_t pos = ftell(m_file);
-      fseek(m_file, 0, SEEK_END);
-      size_t endpos = ftell(m_file);
-      fseek(m_file, static_cast<long>(pos), SEEK_SET);
-      return endpos;
+      const __int64 pos = _ftelli64(m_file);
+      _fseeki64(m_file, 0, SEEK_END);
+      const __int64 endpos = _ftelli64(m_file);
+      _fseeki64(m_file, pos, SEEK_SET);
+      return static_cast<size_t>(endpos);
    }
 };
 
+
+//--------------------------------------------------------------------
+// MemoryFile:  A File that keeps what's written to it in memory, e.g.
+// so that text can be formatted on several threads at once and then
+// written to the real file in order.
+//--------------------------------------------------------------------
+class MemoryFile : public File
+{
+private:
+   std::string m_data;
+
+public:
+   bool IsOpen() override { return true; }
+   void Close() override { }
+   bool Seek(size_t) override { return false; }
+   size_t Read(void *, size_t) override { return 0; }
+   size_t Length() override { return m_data.size(); }
+
+   // Adds numbytes of data to the end.  Returns true.
+   bool Write(const void *data, size_t numbytes) override
+   {
+      m_data.append(static_cast<const char *>(data), numbytes);
+      return true;
+   }
+
+   // Returns everything written so far.
+   const std::string &Data() const { return m_data; }
+};
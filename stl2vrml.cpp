@@ -42,17 +42,133 @@
 //
 // Run the program from the command line with two filename arguments:
 //
-//    stl2vrml infile.stl outfile.wrl
+//    stl2vrml [options] infile.stl outfile.wrl [more output files]
+//    stl2vrml [options] --batch list-or-directory [--batch-extension ext]
+//    stl2vrml --facet-range begin:end infile.stl fragment.wrl
+//    stl2vrml --merge outfile.wrl fragment.wrl [more fragments]
+//    stl2vrml [options] --watch directory [--batch-extension ext]
+//    stl2vrml [options] --serve socket [--serve-queue n]
+//    stl2vrml [options] --client socket infile.stl outfile.wrl [...]
 //
 // The 3D model is read from the first file (in .STL format) and
-// written to the second file (in .WRL format).
+// written to the second file (in .WRL format).  The STL file may be
+// compressed with gzip, in which case it's decompressed as it's read.
+// If the name of the second file ends in .gz or .wrz, the WRL file is
+// compressed with gzip, which VRML viewers can read directly.  If it
+// ends in .x3d or .x3dv, the model is written as X3D in the XML or
+// classic VRML encoding, and .x3dz or .x3dvz compress those too.  If
+// it ends in .glb, the model is written as binary glTF, if it ends in
+// .ply as binary PLY, if it ends in .obj as Wavefront OBJ, and if it
+// ends in .stl as binary STL, which is quicker to read again than an
+// ASCII STL file.  More output files may be given, and all of them are
+// written from one reading of the STL file.
+//
+// With --batch, many files are converted in one run.  The list file
+// has a line for each STL file, giving its name and then the names of
+// the files to write it to.  If a directory is given instead, each STL
+// file in it is converted to a file of the same name, with the
+// extension given by --batch-extension (.wrl by default).  Files are
+// converted several at a time, biggest first, and the parallel loops
+// within them share the same threads, so that all of the cores are
+// kept busy.  The speed of each file and of the batch is reported.
+//
+// With --batch-processes n, the batch's files are converted in n
+// worker processes instead, each started as this program and fed the
+// files one at a time through a pipe.  A file that crashes its worker,
+// or takes longer than --batch-timeout, only stops that worker, which
+// is restarted, and the file is tried again up to --batch-retries
+// times, so that one bad file can't end a long batch.
+//
+// With --facet-range, only a slice of a binary STL file's facets is
+// converted, into a fragment of a WRL file, and --merge joins the
+// fragments of a model into a whole WRL file.  The slices can be
+// converted on different computers at the same time.
+//
+// With --watch, the program keeps watching a directory, and converts
+// each STL file that's added to it or changed, once the file has
+// stopped changing, as --batch would.  A file whose contents are the
+// same as when it was last converted isn't converted again.
+//
+// With --serve, the program keeps running as a service that listens on
+// a local socket, and "stl2vrml --client socket" with the usual options
+// and filenames has the service convert the files, which saves starting
+// the program each time.  "stl2vrml --client socket --stop" stops it.
+//
+// Options:
+//
+//    --merge-coplanar   Join adjacent triangles that lie in the same
+//                       plane into convex polygons.  This makes the
+//                       WRL file smaller and quicker to display,
+//                       especially for blocky models.
+//
+//    --instance         Look for parts of the model that are repeated
+//                       at different positions, such as the blocks of
+//                       voxel art or an array of screws.  Each part is
+//                       written once and then reused with DEF/USE.
+//
+//    --components       Split the model into its separate pieces and
+//                       write each one as a Group with a bounding box,
+//                       so that a viewer can cull and select them
+//                       individually.
+//
+//    --normals          Write the facet normals from the STL file into
+//                       the WRL file, so the viewer doesn't need to
+//                       calculate them.
+//
+//    --smooth-normals angle
+//                       Calculate and write smoothed normals at the
+//                       corners of the faces, so that curved surfaces
+//                       look smooth.  Edges where the faces meet at more
+//                       than "angle" degrees are kept sharp.
+//
+//    --orient           Make all of the faces wind the same way, facing
+//                       out of the model.  If the model is a closed
+//                       solid, the WRL file says so, which lets the
+//                       viewer skip drawing the back faces.
+//
+//    --quantize step    Round the coordinates to a grid and write them as
+//                       whole numbers, inside a Transform that scales them
+//                       back to the model's size.  The grid spacing is
+//                       "step" times the size of the model, e.g. 1e-6.
+//                       This makes the WRL file much smaller.
+//
+//    --mesh-cache dir   Keep the parsed facets of each model in a cache
+//                       directory, named after a hash of the STL file's
+//                       contents.  When the same STL file is converted
+//                       again, its facets are read from the cache
+//                       instead of being parsed.
+//
+//    --mesh-cache-size megabytes
+//                       Limit the total size of the mesh cache.  The
+//                       least recently used models are deleted to make
+//                       room.  The default is 1024.
+//
+//    --output-cache dir Keep a copy of each finished output file in a
+//                       cache directory, keyed by a hash of the STL
+//                       file's contents, the options, the output format
+//                       and the program's output version.  When the
+//                       same conversion is asked for again, the output
+//                       file is copied from the cache instead.
+//
+//    --output-cache-size megabytes
+//                       Limit the total size of the output cache, as
+//                       for the mesh cache.  The default is 1024.
+//
+//    --direct-io        Read the STL file and write the output files
+//                       without going through the system's file cache,
+//                       so that converting a huge file doesn't push
+//                       other programs' files out of the cache.  GLB,
+//                       PLY and STL output files are still written
+//                       through the cache, since they're finished by
+//                       going back to the start.
 //
 //--------------------------------------------------------------------
 //
 // Limitations / Bugs:
 //
-// * Doesn't work with binary .STL files larger than 2GB.  No size
-//   limit for ASCII .STL files.
+// * A binary .STL file can't have more than 4294967295 facets, since
+//   its header only has room for a 32-bit count.  No size limit for
+//   ASCII .STL files.
 // * Parse errors don't include any information in the error message
 //   about where in the STL file the error happened.
 //
@@ -67,18 +183,40 @@
 //--------------------------------------------------------------------
 
 #include "SimpleFile.h"
+#include "mesh.h"
+#include "meshops.h"
+#include "gzipfile.h"
+#include "asyncfile.h"
+#include "directfile.h"
+#include "meshsink.h"
+#include "vrmlwriter.h"
+#include "x3dwriter.h"
+#include "glbwriter.h"
+#include "plywriter.h"
+#include "objwriter.h"
+#include "stlwriter.h"
+#include "meshcache.h"
+#include "outputcache.h"
+#include "parallel.h"
+#include "workerprocess.h"
+#include "localsocket.h"
 #include <vector>
+#include <string>
+#include <cmath>
 #include <algorithm>
 #include <assert.h>
 #include <ctype.h>
-
-//--------------------------------------------------------------------
-// Simple container for a 3D coordinate.
-//--------------------------------------------------------------------
-struct Point
-{
-   double x = 0., y = 0., z = 0.;
-};
+#include <wctype.h>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <map>
+#include <condition_variable>
+#include <io.h>
 
 //--------------------------------------------------------------------
 // Function to split a string into fields delimited by spaces, commas,
@@ -102,206 +240,6 @@ std::vector<std::string> StringFields(const std::string &str)
    return fields;
 }
 
-//--------------------------------------------------------------------
-// VrmlWriter:  This class may be used to write a simple 3D model,
-// consisting of triangles, to a VRML .WRL file.  The member functions
-// of this class generally throw a string in the event of an error.
-//--------------------------------------------------------------------
-class VrmlWriter
-{
-public:
-   VrmlWriter() = delete;
-   VrmlWriter(const VrmlWriter &) = delete;
-   explicit VrmlWriter(File &file) : m_file(file) { }
-
-   //--------------------------------------------------------------------
-   // Writes the beginning portion of the WRL file.
-   //--------------------------------------------------------------------
-   void WriteStartOfWrl()
-   {
-      // cppcheck-suppress assertWithSideEffect
-      assert(m_file.IsOpen());
-      if (!m_file.Printf("#VRML V2.0 utf8\r\n# Model converted by stl2vrml.\r\n"))
-         throw writeError;
-   }
-
-   //--------------------------------------------------------------------
-   // Writes a 3D triangle to the WRL file.
-   // Since individual facets are inefficient in WRL file format, we don't
-   // write the triangle immediately.  Instead, we accumulate the triangle
-   // into a buffer, and the buffer is written to the WRL file as a face
-   // set object once it contains a sufficiently large number of
-   // triangles.
-   //--------------------------------------------------------------------
-   void WriteFacetToWrl(const std::vector<Point> &coords)
-   {
-      // Save facet to list of facets.
-      for (const auto &pt : coords)
-         m_triangles.push_back(pt);
-
-      // Write the list of facets when it gets big enough.
-      constexpr size_t maxPointsPerFaceSet = 3000;
-      if (m_triangles.size() >= maxPointsPerFaceSet)
-      {
-         WriteFacetsToWrl(m_triangles);
-         m_triangles.clear();
-      }
-   }
-
-   //--------------------------------------------------------------------
-   // Writes the remainder of the WRL file after all of the facets have
-   // been given to us.  The minimum and maximum bounds of the 3D model
-   // should be provided in emin and emax.
-   //--------------------------------------------------------------------
-   void WriteEndOfWrl(const Point &emin, const Point &emax)
-   {
-      // cppcheck-suppress assertWithSideEffect
-      assert(m_file.IsOpen());
-
-      // Write any remaining facets that haven't been written yet.
-      if (!m_triangles.empty())
-         WriteFacetsToWrl(m_triangles);
-
-      // Point the camera at the model.
-      if (!m_file.Printf("\r\nViewpoint {\r\n"
-                    "  description \"View_1\"\r\n"
-                    "  orientation 1 0 0 0\r\n"))
-         throw writeError;
-      if (!m_file.Printf("  position %G %G %G\n",
-            emin.x + (emax.x - emin.x) / 2.,
-            emin.y + (emax.y - emin.y) / 2.,
-            emin.z + (emax.z - emin.z) / 2 + std::max(emax.x - emin.x, emax.y - emin.y)))
-         throw writeError;
-      if (!m_file.Printf("}\r\n"))
-         throw writeError;
- 
-      // Set a dark gray background.
-      if (!m_file.Printf("Background { skyColor 0.4 0.4 0.4 }\r\n"))
-         throw writeError;
-   
-      // Default to "examine" mode when the VRML viewer opens the WRL file.
-      if (!m_file.Printf("NavigationInfo { type [ \"EXAMINE\" \"ANY\" ] }\r\n\r\n"))
-         throw writeError;
-   }
-
-private:
-
-   //--------------------------------------------------------------------
-   // Writes a list of coordinates values for an IndexedFaceSet in a WRL.
-   //--------------------------------------------------------------------
-   void WriteCoordListToWrl(const std::vector<Point> &points)
-   {
-      // Each line contains one XYZ coordinate with spaces
-      // between the fields.
-      // All but the last line ends with a comma.
-      size_t pointsWritten = 0;
-      for (const auto &point : points)
-      {
-         if (!m_file.Printf("        "))
-            throw writeError;
-
-         if (!m_file.Printf("%.15G %.15G %.15G", point.x, point.y, point.z))
-            throw writeError;
-
-         if (pointsWritten < points.size() - 1)
-            if (!m_file.Printf(", "))
-               throw writeError;
-
-         if (!m_file.Printf("\r\n"))
-            throw writeError;
-
-         ++pointsWritten;
-      }
-   }
-
-   //--------------------------------------------------------------------
-   // Writes a list of coordinate indexes for an IndexedFaceSet in a WRL.
-   //--------------------------------------------------------------------
-   void WriteCoordIndexesToWrl(const size_t numTriangles)
-   {
-      // Each line contains the three coordinate indexes for one triangle
-      // facet.  The indexes refer to points in the previously written
-      // coordinate list.  The format of each line of coorindate indexes
-      // is:
-      //        index1 index2 index3 -1
-      //
-      // All but the last line should also have a comma at the end.
-      for (size_t trndx = 0; trndx < numTriangles; ++trndx)
-      {
-         if (!m_file.Printf("      "))
-            throw writeError;
-
-         for (size_t i = 0; i < 3; ++i)
-            if (!m_file.Printf("%zu, ", trndx * 3 + i))
-               throw writeError;
-
-         m_file.Printf("-1");
-         if (trndx < numTriangles - 1)
-            if (!m_file.Printf(","))
-               throw writeError;
-
-         if (!m_file.Printf("\r\n"))
-            throw writeError;
-      }
-   }
-
-   //--------------------------------------------------------------------
-   // Writes a collection of 3D triangles to the WRL file as a Shape
-   // object with an IndexedFaceSet inside.
-   //--------------------------------------------------------------------
-   void WriteFacetsToWrl(const std::vector<Point> &points)
-   {
-      // cppcheck-suppress assertWithSideEffect
-      assert(m_file.IsOpen());
-      assert((points.size() % 3) == 0);
-
-      const size_t numTriangles = points.size() / 3;
-      if (numTriangles < 1)
-         return;  // Nothing to write.
-
-      // We don't have any color information about this model,
-      // so we're using a light gray color for the triangles
-      // in the WRL file.
-
-      if (!m_file.Printf("\r\nShape {\r\n"
-                         "  appearance Appearance {\r\n"
-                         "    material Material {\r\n"
-                         "      diffuseColor 0.8 0.8 0.8\r\n"
-                         "    }\r\n"
-                         "  }\r\n"
-                         "  geometry IndexedFaceSet {\r\n"
-                         "    coord Coordinate {\r\n"
-                         "      point [\r\n"))
-         throw writeError;
-
-      WriteCoordListToWrl(points);
-
-      if (!m_file.Printf("      ]\r\n"
-                         "    }\r\n"
-                         "    coordIndex [\r\n"))
-         throw writeError;
-
-      WriteCoordIndexesToWrl(numTriangles);
-
-      if (!m_file.Printf("    ]\r\n"
-                         "  }\r\n"
-                         "}\r\n"))
-         throw writeError;
-   }
-
-private:
-   // The file we're writing.
-   File &m_file;
-
-   // Triangles that haven't been written to the file yet.
-   // We accumulate them here and write them in batches,
-   // rather than writing them one-by-one.
-   std::vector<Point> m_triangles;
-
-   // Common error message string used by member functions above.
-   const wchar_t *writeError = L"Failed writing to file.";
-};
-
 //--------------------------------------------------------------------
 // StlReader:  This class may be used to read a 3D model, consisting
 // of triangles, from a .STL file.  Supports both ASCII and binary
@@ -335,16 +273,56 @@ public:
    //--------------------------------------------------------------------
    // Reads the next facet (triangle) from the STL model.
    // Returns false if there are no more facets in the file.
-   // The facet's vertex coordinates are returned in "coords".
+   // The facet's vertex coordinates are returned in "coords", and the
+   // facet normal given in the file is returned in "normal".  The
+   // normal is all zero if the file didn't give one.
    //--------------------------------------------------------------------
-   bool ReadFacetFromStl(std::vector<Point> &coords)
+   bool ReadFacetFromStl(std::vector<Point> &coords, Point &normal)
    {
       // cppcheck-suppress assertWithSideEffect
       assert(m_file.IsOpen());
       coords.clear();
-      return m_isBinaryStl ? ReadFacetFromBinaryStl(coords) : ReadFacetFromAsciiStl(coords);
+      normal = Point();
+      m_attribute = 0;
+      return m_isBinaryStl ? ReadFacetFromBinaryStl(coords, normal) : ReadFacetFromAsciiStl(coords, normal);
+   }
+
+   //--------------------------------------------------------------------
+   // Returns a quick estimate of the number of facets in the model, for
+   // deciding how much work it is.  A binary STL file gives the number
+   // in its header; for an ASCII STL file it's worked out from the
+   // file's length.  Call after ReadHeaderFromStl.
+   //--------------------------------------------------------------------
+   size_t EstimateNumFacets()
+   {
+      // An ASCII facet takes this many bytes, give or take.
+      constexpr size_t asciiBytesPerFacet = 200;
+      return m_isBinaryStl ? m_numFacets : m_file.Length() / asciiBytesPerFacet;
+   }
+
+   //--------------------------------------------------------------------
+   // Makes the reader read only the facets from number "begin" up to,
+   // but not including, number "end", by seeking straight to the first
+   // one.  Only a binary STL file's facets can be found that way, since
+   // they're all the same size.  Call after ReadHeaderFromStl.
+   // Throws if the file isn't a binary STL file.
+   //--------------------------------------------------------------------
+   void SelectFacets(size_t begin, size_t end)
+   {
+      if (!m_isBinaryStl)
+         throw "A range of facets can only be read from a binary STL file.";
+      m_numFacets = std::min(end, m_numFacets);
+      m_curFacet = std::min(begin, m_numFacets);
+      if (!m_file.Seek(80 + sizeof(std::uint32_t) + m_curFacet * sizeof(BinaryStlRecord)))
+         throw "Failed seeking in input file.";
    }
 
+   //--------------------------------------------------------------------
+   // Returns the attribute bytes of the last facet read from a binary
+   // STL file.  They're zero for an ASCII STL file.
+   //--------------------------------------------------------------------
+   std::uint16_t LastAttribute() const { return m_attribute; }
+
    //--------------------------------------------------------------------
    // Clean up after reading an STL file.
    //--------------------------------------------------------------------
@@ -358,17 +336,15 @@ private:
    //--------------------------------------------------------------------
    // A binary STL record as it appears in the file.
    //--------------------------------------------------------------------
-   struct BinaryStlRecord
-   {
    #pragma pack(push)
    #pragma pack(1)
-   
+   struct BinaryStlRecord
+   {
       float m_normal[3] = {0};            // Surface normal of triangle.
       float m_coorddata[9] = {0};         // Corner points of the triangle.
-      std::uint16_t m_attributeSize = 0;  // Reserved.  Should always be zero.
-   
-   #pragma pack(pop)
+      std::uint16_t m_attribute = 0;      // Usually zero, but may be a color.
    };
+   #pragma pack(pop)
 
    //--------------------------------------------------------------------
    // Reads the header portion of a binary STL file.
@@ -443,10 +419,22 @@ private:
          return false;
    
       // Confirm that the file size is correct for the number of facets
-      // specified.
+      // specified.  A compressed file only knows its size modulo 4GB.
       size_t expectedLength = 80 + sizeof(std::uint32_t) +
                                       numFacets * sizeof(BinaryStlRecord);
-      return inFile.Length() == expectedLength;
+      if ((inFile.Length() & 0xFFFFFFFFu) == (expectedLength & 0xFFFFFFFFu))
+         return true;
+
+      // The size can't always be known (e.g. for several gzip streams
+      // joined together), so also look at the first few facets.  An
+      // ASCII STL file is plain text, but binary facet records nearly
+      // always contain zero bytes or other control characters.
+      std::vector<unsigned char> prefix(sizeof(BinaryStlRecord) * std::min<size_t>(numFacets, 20));
+      prefix.resize(inFile.Read(prefix.data(), prefix.size()));
+      for (const auto c : prefix)
+         if (c < '\t' || (c > '\r' && c < ' '))
+            return true;
+      return false;
    }
 
    //--------------------------------------------------------------------
@@ -496,11 +484,12 @@ private:
    //    end loop
    // end facet
    //
-   // The coordinates from the vertex lines are passed back in "coords".
+   // The coordinates from the vertex lines are passed back in "coords",
+   // and the normal from the facet line in "normal".
    // Returns false if there are no more facets in the file.
    // Throws zstring if error.
    //--------------------------------------------------------------------
-   bool ReadFacetFromAsciiStl(std::vector<Point> &coords)
+   bool ReadFacetFromAsciiStl(std::vector<Point> &coords, Point &normal)
    {
       // cppcheck-suppress assertWithSideEffect
       assert(m_file.IsOpen());
@@ -520,6 +509,17 @@ private:
       }
       else if (fields[0] == "facet")
       {
+         // Pick up the normal if there is one.  Many programs don't
+         // bother filling it in, so a bad one just counts as missing.
+         if (fields.size() >= 5 && fields[1] == "normal")
+         {
+            normal.x = atof(fields[2].c_str());
+            normal.y = atof(fields[3].c_str());
+            normal.z = atof(fields[4].c_str());
+            if (!_finite(normal.x) || !_finite(normal.y) || !_finite(normal.z))
+               normal = Point();
+         }
+
          // Read and check the outerloop line.
          if (!m_file.ReadLine(text, true))
          {
@@ -566,10 +566,12 @@ private:
 
    //--------------------------------------------------------------------
    // Reads the next facet from a binary STL file.
+   // The facet's vertex coordinates are returned in "coords", and its
+   // normal in "normal".
    // Returns false if there are no more facets in the file.
    // Errors throw strings.
    //--------------------------------------------------------------------
-   bool ReadFacetFromBinaryStl(std::vector<Point> &coords)
+   bool ReadFacetFromBinaryStl(std::vector<Point> &coords, Point &normal)
    {
       // cppcheck-suppress assertWithSideEffect
       assert(m_file.IsOpen());
@@ -579,8 +581,13 @@ private:
       BinaryStlRecord record;
       if (m_file.Read(&record, sizeof(record)) != sizeof(record))
          throw "Failed reading facet record from binary STL file.";
-      if (record.m_attributeSize != 0)
-         throw "Invalid attribute size in binary STL file.";
+      m_attribute = record.m_attribute;
+
+      normal.x = record.m_normal[0];
+      normal.y = record.m_normal[1];
+      normal.z = record.m_normal[2];
+      if (!_finite(normal.x) || !_finite(normal.y) || !_finite(normal.z))
+         normal = Point();
 
       // Build the coordinate list from the record.
       float *fp = &record.m_coorddata[0];
@@ -598,10 +605,11 @@ private:
    }
 
 private:
-   File     m_file;
+   File     &m_file;
    bool     m_isBinaryStl = false;
    size_t   m_numFacets = 0;
    size_t   m_curFacet = 0;
+   std::uint16_t m_attribute = 0;
 };
 
 //--------------------------------------------------------------------
@@ -619,16 +627,147 @@ void UpdateMinMax(const Point &input, Point &emin, Point &emax)
 }
 
 //--------------------------------------------------------------------
-// Converts a 3D model from .STL file format to VRML .WRL file format.
-// The .STL file may be binary or ASCII STL format.
+// Options that control how ConvertStlToWrl converts a model.  The
+// defaults give a plain streaming conversion.
+//--------------------------------------------------------------------
+struct ConvertOptions
+{
+   // Join adjacent coplanar triangles into convex polygons.
+   bool mergeCoplanar = false;
+
+   // Write repeated parts of the model once and reuse them.
+   bool instancing = false;
+
+   // Write each connected component of the model as its own group.
+   bool components = false;
+
+   // Write the facet normals from the STL file, one per face.
+   bool faceNormals = false;
+
+   // Write smoothed normals at the corners of the faces.  Edges where
+   // faces meet at more than creaseAngle (in radians) stay sharp.
+   bool smoothNormals = false;
+   double creaseAngle = 0.;
+
+   // Make the winding of the faces consistent, and tell the viewer if
+   // the model is a closed solid.
+   bool orient = false;
+
+   // Round coordinates to a grid this fraction of the model's size and
+   // write them as integers.  Zero means don't quantize.
+   double quantizeStep = 0.;
+
+   // Convert only the facets from firstFacet up to endFacet of a binary
+   // STL file, into a fragment of a WRL file, to be joined up with the
+   // fragments for the rest of the facets by MergeFragments.
+   bool fragment = false;
+   size_t firstFacet = 0;
+   size_t endFacet = 0;
+
+   // Read and write the files without the system's file cache.  This
+   // doesn't change the output, so it isn't part of the output cache's
+   // key.
+   bool directIo = false;
+
+   // Returns true if the options require the whole model to be loaded
+   // into a Mesh before anything is written.
+   bool NeedsMesh() const
+      { return mergeCoplanar || instancing || components || faceNormals || smoothNormals || orient ||
+                quantizeStep > 0.; }
+};
+
+//--------------------------------------------------------------------
+// Converts a 3D model from .STL file format to VRML .WRL file format,
+// or to whichever formats the given sinks write.  The .STL file may
+// be binary or ASCII STL format, and is only read once, however many
+// sinks there are.
+//
+// With more than one sink, each one runs on a thread of its own, fed
+// through a short queue, so that the sinks work alongside each other
+// and alongside the reading.  A lone sink that gets the facets as
+// they're read runs on a thread of its own too, if there's a core to
+// spare, so that formatting and writing the output overlaps reading
+// and parsing the STL file.  Otherwise a lone sink is called on this
+// thread.
+//
+// If a mesh cache is given and it found the model, the facets are
+// read from the cache and the STL file isn't read at all.  Otherwise
+// the facets read from the STL file are added to the cache.
+//
+// Returns the number of facets in the model.
 //--------------------------------------------------------------------
-void ConvertStlToWrl(File &inFile, File &outFile)
+size_t ConvertStlToWrl(File &inFile, const std::vector<MeshSink *> &writers,
+                     const ConvertOptions &options, MeshCache *cache = nullptr)
 {
+   // Facets are handed to the sink threads in batches of this many,
+   // and each sink's queue holds this many batches or other tasks.
+   constexpr size_t facetsPerBatch = 4096;
+   constexpr size_t maxQueuedTasks = 8;
+
    StlReader reader(inFile);
-   reader.ReadHeaderFromStl();
+   const bool fromCache = cache && cache->Found();
+   if (!fromCache)
+   {
+      reader.ReadHeaderFromStl();
+      if (options.fragment)
+         reader.SelectFacets(options.firstFacet, options.endFacet);
+   }
+   const bool toCache = cache && !fromCache && cache->Begin();
+   if (cache && !fromCache && !toCache)
+      printf("stl2vrml:  Can't add the model to the mesh cache.\n");
+
+   // The parts of the model outlive the sink threads, which use them.
+   std::vector<MeshPart> parts;
+
+   // A sink gets the facets as they're read, unless the options need
+   // the whole model or the sink's format needs a welded mesh.  Those
+   // sinks get the mesh's parts at the end instead.
+   std::vector<size_t> streamSinks, meshSinks;
+   for (size_t i = 0; i < writers.size(); ++i)
+   {
+      if (options.NeedsMesh() || writers[i]->WantsMesh())
+         meshSinks.push_back(i);
+      else
+         streamSinks.push_back(i);
+   }
+
+   // The sink threads' queues hold back the reading when a sink falls
+   // behind, so the batches waiting for it don't fill up the memory.
+   // On a batch's pool the other files keep the cores busy, so a lone
+   // sink stays on this thread there, and sink threads format their
+   // face sets one at a time.  Otherwise the sinks share the cores.
+   std::vector<std::unique_ptr<WorkerThread>> workers;
+   if (writers.size() > 1 ||
+       (!streamSinks.empty() && !TaskPool::Current() && NumWorkerThreads() > 1))
+   {
+      const size_t loopThreads = TaskPool::Current() ? 1 :
+                                 std::max<size_t>(1, NumWorkerThreads() / writers.size());
+      for (size_t i = 0; i < writers.size(); ++i)
+         workers.emplace_back(new WorkerThread(maxQueuedTasks, loopThreads));
+   }
+   const auto run = [&workers](size_t sink, std::function<void()> task)
+   {
+      if (workers.empty())
+         task();
+      else
+         workers[sink]->Post(std::move(task));
+   };
+
+   const bool normals = options.faceNormals || options.smoothNormals;
+   for (size_t i = 0; i < writers.size(); ++i)
+   {
+      MeshSink *writer = writers[i];
+      run(i, [writer, normals]()
+      {
+         writer->SetNormals(normals);
+         writer->WriteStart();
+      });
+   }
 
-   VrmlWriter writer(outFile);
-   writer.WriteStartOfWrl();
+   // If we need to work on the model as a whole, the facets are
+   // collected into a mesh instead of going straight to the writer.
+   Mesh mesh;
+   MeshBuilder builder(mesh, options.faceNormals);
 
    // These two points are used to accumulate the minimum and maximum
    // bounds of the 3D model as we read its coordinates from the STL file.
@@ -638,11 +777,65 @@ void ConvertStlToWrl(File &inFile, File &outFile)
 
    size_t numFacetsProcessed = 0;
 
-   // Read all facets in the STL model and write them to the WRL file.
+   // Facets for the streaming sinks, gathered into a batch that all of
+   // their threads share.
+   std::shared_ptr<std::vector<Facet>> batch;
+   const auto sendBatch = [&]()
+   {
+      for (auto i : streamSinks)
+      {
+         MeshSink *writer = writers[i];
+         std::shared_ptr<const std::vector<Facet>> facets = batch;
+         run(i, [writer, facets]() { writer->WriteFacets(*facets); });
+      }
+      batch.reset();
+   };
+
+   // Reads the next facet, from the cache or from the STL file.
    std::vector<Point> coords;
-   while (reader.ReadFacetFromStl(coords))
+   Point normal;
+   Facet facet;
+   const auto readFacet = [&]()
+   {
+      if (fromCache)
+      {
+         if (!cache->ReadFacet(facet))
+            return false;
+         coords.assign(facet.points, facet.points + 3);
+         normal = facet.normal;
+         return true;
+      }
+      if (!reader.ReadFacetFromStl(coords, normal))
+         return false;
+      std::copy(coords.begin(), coords.end(), facet.points);
+      facet.normal = normal;
+      facet.attribute = reader.LastAttribute();
+      return true;
+   };
+
+   // Read all facets in the STL model and write them to the WRL file.
+   while (readFacet())
    {
-      writer.WriteFacetToWrl(coords);
+      if (toCache)
+         cache->AddFacet(facet);
+      if (!meshSinks.empty())
+         builder.AddFacet(coords, normal);
+      if (!streamSinks.empty())
+      {
+         if (workers.empty())
+            writers[streamSinks[0]]->WriteFacet(facet);
+         else
+         {
+            if (!batch)
+            {
+               batch = std::make_shared<std::vector<Facet>>();
+               batch->reserve(facetsPerBatch);
+            }
+            batch->push_back(facet);
+            if (batch->size() >= facetsPerBatch)
+               sendBatch();
+         }
+      }
       for (const auto &point : coords)
          UpdateMinMax(point, emin, emax);
 
@@ -653,63 +846,1703 @@ void ConvertStlToWrl(File &inFile, File &outFile)
          fprintf(stderr, ".");
    }
    fprintf(stderr, "\n");
-
    reader.Close();
-   writer.WriteEndOfWrl(emin, emax);
+   if (batch)
+      sendBatch();
+   if (toCache && !cache->Finish())
+      printf("stl2vrml:  Can't add the model to the mesh cache.\n");
+
+   if (!meshSinks.empty())
+   {
+      // Fix the winding first, since merging, instancing and smoothing
+      // all depend on neighboring faces agreeing.
+      bool orientChecked = false, solid = false;
+      if (options.orient)
+      {
+         const OrientResult orientation = OrientFaces(mesh);
+         printf("stl2vrml:  Turned over %zu faces.  The model %s a closed solid.\n",
+                orientation.numFlipped, orientation.IsSolid() ? "is" : "is not");
+         orientChecked = true;
+         solid = orientation.IsSolid();
+      }
+
+      // Split the model into parts.  Without instancing, the whole
+      // model is one part.
+      if (options.instancing)
+      {
+         const size_t numRepeated = FindRepeatedParts(mesh, parts);
+         size_t numCopies = 0;
+         for (const auto &part : parts)
+            numCopies += part.m_placements.size();
+         printf("stl2vrml:  Found %zu repeated parts used %zu times.\n",
+                numRepeated, numCopies);
+      }
+      else
+      {
+         parts.emplace_back();
+         parts.back().m_mesh = std::move(mesh);
+      }
+      mesh.Clear();
+
+      // Split the part that isn't instanced into its components.
+      if (options.components)
+      {
+         std::vector<MeshPart> components;
+         const size_t numComponents = SplitConnectedComponents(parts[0].m_mesh, components);
+         printf("stl2vrml:  Found %zu separate components.\n", numComponents);
+         parts.erase(parts.begin());
+         parts.insert(parts.begin(), std::make_move_iterator(components.begin()),
+                      std::make_move_iterator(components.end()));
+      }
+
+      if (options.mergeCoplanar)
+      {
+         size_t numTriangles = 0, numPolygons = 0;
+         for (auto &part : parts)
+         {
+            numTriangles += part.m_mesh.NumFaces();
+            numPolygons += MergeCoplanarFaces(part.m_mesh);
+         }
+         printf("stl2vrml:  Merged %zu triangles into %zu polygons.\n",
+                numTriangles, numPolygons);
+      }
+
+      if (options.smoothNormals)
+      {
+         for (auto &part : parts)
+            ComputeSmoothNormals(part.m_mesh, options.creaseAngle);
+      }
+
+      double quantStep = 0.;
+      if (options.quantizeStep > 0.)
+      {
+         const double size = std::max(emax.x - emin.x, std::max(emax.y - emin.y, emax.z - emin.z));
+         quantStep = size > 0. ? size * options.quantizeStep : options.quantizeStep;
+      }
+
+      // The parts are finished now, so the sinks can share them.
+      const std::vector<MeshPart> &finishedParts = parts;
+      for (auto i : meshSinks)
+      {
+         MeshSink *writer = writers[i];
+         run(i, [writer, &finishedParts, &options, orientChecked, solid, quantStep, emin]()
+         {
+            if (orientChecked)
+               writer->SetSolid(solid);
+            if (options.smoothNormals)
+               writer->SetCreaseAngle(options.creaseAngle);
+            if (quantStep > 0.)
+               writer->SetQuantization(emin, quantStep);
+            writer->WriteParts(finishedParts, options.components);
+         });
+      }
+   }
+
+   for (size_t i = 0; i < writers.size(); ++i)
+   {
+      MeshSink *writer = writers[i];
+      run(i, [writer, emin, emax]() { writer->WriteEnd(emin, emax); });
+   }
+   for (auto &worker : workers)
+      worker->Finish();
+   return numFacetsProcessed;
 }
 
 //--------------------------------------------------------------------
-// Program entry point.  Takes standard arguments from the command
-// line and returns EXIT_SUCCESS if no errors occur.
+// Returns true if a filename ends with the given extension, ignoring
+// case.
 //--------------------------------------------------------------------
-int wmain(int argc, wchar_t **argv)
+bool HasExtension(const wchar_t *filename, const wchar_t *extension)
 {
-   if (argc != 3)
-   {
-      // The user needs command line help.
-      printf("Usage:  stl2vrml infile.stl outfile.wrl\n");
-      return EXIT_FAILURE;
-   }
+   const size_t nameLength = wcslen(filename);
+   const size_t extLength = wcslen(extension);
+   if (nameLength < extLength)
+      return false;
+   for (size_t i = 0; i < extLength; ++i)
+      if (towlower(filename[nameLength - extLength + i]) != towlower(extension[i]))
+         return false;
+   return true;
+}
 
-   const wchar_t *inFilename = argv[1];
-   const wchar_t *outFilename = argv[2];
-   fwprintf(stderr, L"Converting %s to %s\n", inFilename, outFilename);
+//--------------------------------------------------------------------
+// Checks whether two filenames are the same, ignoring case as Windows
+// does.  Different paths to the same file aren't caught.
+//--------------------------------------------------------------------
+bool SameFilename(const wchar_t *a, const wchar_t *b)
+{
+   for (; *a != L'\0' && *b != L'\0'; ++a, ++b)
+      if (towlower(*a) != towlower(*b))
+         return false;
+   return *a == *b;
+}
 
-   // Open the STL input file.
-   wprintf(L"Opening %s for reading.\n", inFilename);
-   File inFile;
-   if (!inFile.Open(inFilename))
-   {
-      wprintf(L"stl2vrml:  Failed opening input file:  %s\n", inFilename);
-      return EXIT_FAILURE;
-   }
+//--------------------------------------------------------------------
+// Output file formats, chosen by the output filename.
+//--------------------------------------------------------------------
+enum class OutputFormat { Vrml, X3dClassic, X3dXml, Glb, Ply, Obj, Stl };
 
-   // Open the WRL output file.
-   wprintf(L"stl2vrml:  Opening %s for writing.\n", outFilename);
-   File outFile;
-   if (!outFile.Create(outFilename))
+//--------------------------------------------------------------------
+// Works out the output format from a filename's extension, and
+// whether the file should be compressed with gzip.  A .gz ending may
+// follow any of the other extensions, and .wrz, .x3dvz and .x3dz are
+// the usual names for compressed files.  Anything else is VRML.
+//--------------------------------------------------------------------
+OutputFormat FormatFromFilename(const wchar_t *filename, bool &compress)
+{
+   std::wstring name = filename;
+   compress = false;
+   if (HasExtension(name.c_str(), L".gz"))
    {
-      wprintf(L"stl2vrml:  Failed opening output file:  %s\n", outFilename);
-      return EXIT_FAILURE;
+      compress = true;
+      name.resize(name.size() - 3);
    }
 
-   try
+   if (HasExtension(name.c_str(), L".wrz"))
+      compress = true;
+   else if (HasExtension(name.c_str(), L".x3dvz"))
    {
-      printf("stl2vrml:  Processing.\n");
-      ConvertStlToWrl(inFile, outFile);
+      compress = true;
+      return OutputFormat::X3dClassic;
    }
-   catch(const char *text)
+   else if (HasExtension(name.c_str(), L".x3dv"))
+      return OutputFormat::X3dClassic;
+   else if (HasExtension(name.c_str(), L".x3dz"))
    {
-      printf("stl2vrml:  Error - %s\n", text);
-      return EXIT_FAILURE;
+      compress = true;
+      return OutputFormat::X3dXml;
    }
-   catch(...)
+   else if (HasExtension(name.c_str(), L".x3d"))
+      return OutputFormat::X3dXml;
+   else if (HasExtension(name.c_str(), L".glb"))
+      return OutputFormat::Glb;
+   else if (HasExtension(name.c_str(), L".ply"))
+      return OutputFormat::Ply;
+   else if (HasExtension(name.c_str(), L".obj"))
+      return OutputFormat::Obj;
+   else if (HasExtension(name.c_str(), L".stl"))
+      return OutputFormat::Stl;
+   return OutputFormat::Vrml;
+}
+
+//--------------------------------------------------------------------
+// The version of the program's output.  This goes into the output
+// cache's keys, so it must be changed whenever a change to the program
+// changes what it writes, or the cache would hand out stale files.
+//--------------------------------------------------------------------
+const char *const outputVersion = "stl2vrml output 1";
+
+//--------------------------------------------------------------------
+// Works out the output cache's key for an output file, from the hash
+// and length of the STL file, the options, the output format and the
+// output version.
+//--------------------------------------------------------------------
+std::uint64_t OutputCacheKey(std::uint64_t inputHash, std::uint64_t inputLength,
+                             const ConvertOptions &options, OutputFormat format, bool compress)
+{
+   ContentHash key;
+   key.Update(outputVersion, strlen(outputVersion));
+   key.Update(&inputHash, sizeof(inputHash));
+   key.Update(&inputLength, sizeof(inputLength));
+
+   // The options are added one at a time, since the struct may have
+   // padding with anything in it.
+   const bool flags[] = { options.mergeCoplanar, options.instancing, options.components,
+                          options.faceNormals, options.smoothNormals, options.orient, compress };
+   key.Update(flags, sizeof(flags));
+   key.Update(&options.creaseAngle, sizeof(options.creaseAngle));
+   key.Update(&options.quantizeStep, sizeof(options.quantizeStep));
+   const int formatNumber = static_cast<int>(format);
+   key.Update(&formatNumber, sizeof(formatNumber));
+   if (options.fragment)
    {
-      printf("stl2vrml:  Aborted due to exception!\n");
-      return EXIT_FAILURE;
+      const std::uint64_t range[] = { options.firstFacet, options.endFacet };
+      key.Update(range, sizeof(range));
    }
+   return key.Digest();
+}
 
-   printf("stl2vrml:  Done.\n");
-   return EXIT_SUCCESS;
+//--------------------------------------------------------------------
+// Where the caches are kept, if anywhere, and how big they may get.
+//--------------------------------------------------------------------
+struct CacheOptions
+{
+   std::wstring meshCacheDir;
+   double meshCacheMegabytes = 1024.;
+   std::wstring outputCacheDir;
+   double outputCacheMegabytes = 1024.;
+};
+
+//--------------------------------------------------------------------
+// Converts one STL file to one or more output files, reporting any
+// errors.  Returns EXIT_SUCCESS if no errors occur.  The number of
+// facets converted is put in numFacets if it's given; it's zero if
+// every output file came from the output cache.
+//--------------------------------------------------------------------
+int ConvertFiles(const wchar_t *inFilename, const std::vector<const wchar_t *> &outFilenames,
+                 const ConvertOptions &options, const CacheOptions &caches,
+                 size_t *numFacets = nullptr)
+{
+   // Each output file, with its format and writer.
+   struct Output
+   {
+      const wchar_t *filename = nullptr;
+      OutputFormat format = OutputFormat::Vrml;
+      bool compress = false;
+      File file;
+      std::unique_ptr<DirectFile> directFile;
+      std::unique_ptr<WriteBehindFile> writeBehind;
+      std::unique_ptr<GzipOutputFile> gzipFile;
+      std::unique_ptr<MeshSink> writer;
+      std::uint64_t cacheKey = 0;
+      bool cached = false;
+   };
+   std::vector<std::unique_ptr<Output>> outputs;
+
+   for (const auto outFilename : outFilenames)
+   {
+      outputs.emplace_back(new Output);
+      Output &out = *outputs.back();
+      out.filename = outFilename;
+      fwprintf(stderr, L"Converting %s to %s\n", inFilename, out.filename);
+
+      // The output format comes from the output filename.  GLB, PLY
+      // and STL files are finished by going back to the start, which
+      // can't be done once they have been compressed.
+      out.format = FormatFromFilename(out.filename, out.compress);
+      if ((out.format == OutputFormat::Glb || out.format == OutputFormat::Ply ||
+           out.format == OutputFormat::Stl) && out.compress)
+      {
+         wprintf(L"stl2vrml:  GLB, PLY and STL files can't be compressed:  %s\n", out.filename);
+         return EXIT_FAILURE;
+      }
+
+      // A fragment is part of a WRL file, to be joined up with others.
+      if (options.fragment && (out.format != OutputFormat::Vrml || out.compress))
+      {
+         wprintf(L"stl2vrml:  A fragment must be an uncompressed WRL file:  %s\n", out.filename);
+         return EXIT_FAILURE;
+      }
+
+      // Writing an STL file over the one being read would destroy it.
+      if (SameFilename(out.filename, inFilename))
+      {
+         wprintf(L"stl2vrml:  Output file is the input file:  %s\n", out.filename);
+         return EXIT_FAILURE;
+      }
+   }
+
+   // Open the STL input file.
+   wprintf(L"Opening %s for reading.\n", inFilename);
+   File bufferedInFile;
+   DirectFile directInFile;
+   const bool opened = options.directIo ? directInFile.Open(inFilename) : bufferedInFile.Open(inFilename);
+   File &inFile = options.directIo ? static_cast<File &>(directInFile) : bufferedInFile;
+   if (!opened)
+   {
+      wprintf(L"stl2vrml:  Failed opening input file:  %s\n", inFilename);
+      return EXIT_FAILURE;
+   }
+
+   // With a core to spare, the input file is read ahead of the parsing
+   // and the output files are written behind the formatting, so that
+   // the disk is kept busy at the same time as the processor.
+   const bool asyncFiles = NumWorkerThreads() > 1;
+   std::unique_ptr<ReadAheadFile> readAhead;
+   if (asyncFiles)
+      readAhead.reset(new ReadAheadFile(inFile));
+   File &stlFile = readAhead ? *readAhead : inFile;
+
+   try
+   {
+      // The caches are keyed by a hash of the STL file's contents.
+      std::uint64_t inputHash = 0, inputLength = 0;
+      if (!caches.meshCacheDir.empty() || !caches.outputCacheDir.empty())
+      {
+         inputHash = HashFileContents(stlFile);
+         inputLength = stlFile.Length();
+      }
+
+      // Copy any output files that are in the output cache.
+      std::unique_ptr<OutputCache> outputCache;
+      if (!caches.outputCacheDir.empty())
+      {
+         outputCache.reset(new OutputCache(caches.outputCacheDir,
+                                           static_cast<std::uint64_t>(caches.outputCacheMegabytes * 1048576.)));
+         for (auto &out : outputs)
+         {
+            out->cacheKey = OutputCacheKey(inputHash, inputLength, options, out->format, out->compress);
+            out->cached = outputCache->Fetch(out->cacheKey, out->filename);
+            if (out->cached)
+               wprintf(L"stl2vrml:  Copied %s from the output cache.\n", out->filename);
+         }
+      }
+
+      std::vector<MeshSink *> writers;
+      for (auto &out : outputs)
+      {
+         if (out->cached)
+            continue;
+
+         // Open the WRL output file.  Formats that are finished by going
+         // back to the start can't be written directly.
+         wprintf(L"stl2vrml:  Opening %s for writing.\n", out->filename);
+         if (options.directIo && out->format != OutputFormat::Glb && out->format != OutputFormat::Ply &&
+             out->format != OutputFormat::Stl)
+            out->directFile.reset(new DirectFile);
+         if (!(out->directFile ? out->directFile->Create(out->filename) : out->file.Create(out->filename)))
+         {
+            wprintf(L"stl2vrml:  Failed opening output file:  %s\n", out->filename);
+            return EXIT_FAILURE;
+         }
+         File &diskFile = out->directFile ? *out->directFile : out->file;
+
+         // Compress the output if the filename asks for it.
+         if (asyncFiles)
+            out->writeBehind.reset(new WriteBehindFile(diskFile));
+         File &plainOutput = out->writeBehind ? *out->writeBehind : diskFile;
+         if (out->compress)
+            out->gzipFile.reset(new GzipOutputFile(plainOutput));
+         File &output = out->gzipFile ? *out->gzipFile : plainOutput;
+
+         // Pick the writer for the output format.
+         if (out->format == OutputFormat::X3dXml)
+            out->writer.reset(new X3dXmlWriter(output));
+         else if (out->format == OutputFormat::X3dClassic)
+            out->writer.reset(new X3dClassicWriter(output));
+         else if (out->format == OutputFormat::Glb)
+            out->writer.reset(new GlbWriter(output));
+         else if (out->format == OutputFormat::Ply)
+            out->writer.reset(new PlyWriter(output));
+         else if (out->format == OutputFormat::Obj)
+            out->writer.reset(new ObjWriter(output));
+         else if (out->format == OutputFormat::Stl)
+            out->writer.reset(new StlWriter(output));
+         else
+         {
+            VrmlWriter *vrmlWriter = new VrmlWriter(output);
+            vrmlWriter->SetFragment(options.fragment);
+            out->writer.reset(vrmlWriter);
+         }
+         writers.push_back(out->writer.get());
+      }
+
+      if (!writers.empty())
+      {
+         // Look for the model in the mesh cache.
+         std::unique_ptr<MeshCache> meshCache;
+         if (!caches.meshCacheDir.empty() && !options.fragment)
+         {
+            meshCache.reset(new MeshCache(caches.meshCacheDir,
+                                          static_cast<std::uint64_t>(caches.meshCacheMegabytes * 1048576.)));
+            if (meshCache->Find(inputHash, inputLength))
+               printf("stl2vrml:  Found the model in the mesh cache.\n");
+         }
+
+         // Decompress the input on the fly if it's a gzip file.
+         std::unique_ptr<GzipInputFile> gzipInput;
+         if (!(meshCache && meshCache->Found()) && GzipInputFile::IsGzipFile(stlFile))
+         {
+            printf("stl2vrml:  Input file is compressed.\n");
+            gzipInput.reset(new GzipInputFile(stlFile));
+         }
+         File &input = gzipInput ? *gzipInput : stlFile;
+
+         printf("stl2vrml:  Processing.\n");
+         const size_t facets = ConvertStlToWrl(input, writers, options, meshCache.get());
+         if (numFacets)
+            *numFacets = facets;
+         for (auto &out : outputs)
+         {
+            if (out->gzipFile && !out->gzipFile->Finish())
+               throw "Failed writing compressed output file.";
+            if (out->writeBehind && !out->writeBehind->Finish())
+               throw "Failed writing output file.";
+            if (out->directFile && !out->directFile->Finish())
+               throw "Failed writing output file.";
+         }
+      }
+
+      // Put the new output files in the output cache.
+      if (outputCache)
+      {
+         for (auto &out : outputs)
+         {
+            if (out->cached)
+               continue;
+            out->file.Close();
+            if (out->directFile)
+               out->directFile->Close();
+            if (!outputCache->Store(out->cacheKey, out->filename))
+               wprintf(L"stl2vrml:  Can't add %s to the output cache.\n", out->filename);
+         }
+      }
+   }
+   catch(const char *text)
+   {
+      printf("stl2vrml:  Error - %s\n", text);
+      return EXIT_FAILURE;
+   }
+   catch(const wchar_t *text)
+   {
+      // The writers' errors.
+      wprintf(L"stl2vrml:  Error - %s\n", text);
+      return EXIT_FAILURE;
+   }
+   catch(...)
+   {
+      printf("stl2vrml:  Aborted due to exception!\n");
+      return EXIT_FAILURE;
+   }
+
+   printf("stl2vrml:  Done.\n");
+   return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------
+// Joins fragments of a model, written with --facet-range, into a
+// whole WRL file.  The middle of each fragment is copied as it is, in
+// the order given, between the start of a WRL file and an end whose
+// camera looks at the bounds of all of the fragments together.  The
+// output file may be compressed.  Returns EXIT_SUCCESS if successful.
+//--------------------------------------------------------------------
+int MergeFragments(const wchar_t *outFilename, const std::vector<std::wstring> &fragments)
+{
+   bool compress = false;
+   if (FormatFromFilename(outFilename, compress) != OutputFormat::Vrml)
+   {
+      wprintf(L"stl2vrml:  Fragments can only be joined into a WRL file:  %s\n", outFilename);
+      return EXIT_FAILURE;
+   }
+   for (const auto &fragment : fragments)
+   {
+      if (SameFilename(fragment.c_str(), outFilename))
+      {
+         wprintf(L"stl2vrml:  Output file is a fragment:  %s\n", outFilename);
+         return EXIT_FAILURE;
+      }
+   }
+
+   wprintf(L"stl2vrml:  Opening %s for writing.\n", outFilename);
+   File outFile;
+   if (!outFile.Create(outFilename))
+   {
+      wprintf(L"stl2vrml:  Failed opening output file:  %s\n", outFilename);
+      return EXIT_FAILURE;
+   }
+
+   try
+   {
+      std::unique_ptr<GzipOutputFile> gzipFile;
+      if (compress)
+         gzipFile.reset(new GzipOutputFile(outFile));
+      File &output = gzipFile ? *gzipFile : outFile;
+      VrmlWriter writer(output);
+      writer.WriteStart();
+
+      Point emin, emax;
+      emin.x = emin.y = emin.z = DBL_MAX;
+      emax.x = emax.y = emax.z = -DBL_MAX;
+      const std::string start = VrmlWriter::FragmentStart();
+      const std::string bounds = VrmlWriter::FragmentBounds();
+      std::vector<char> block(1 << 20);
+      for (const auto &fragment : fragments)
+      {
+         wprintf(L"Opening %s for reading.\n", fragment.c_str());
+         File inFile;
+         if (!inFile.Open(fragment.c_str()))
+         {
+            wprintf(L"stl2vrml:  Failed opening fragment:  %s\n", fragment.c_str());
+            return EXIT_FAILURE;
+         }
+
+         // The bounds are on the fragment's last line, which is short.
+         const size_t length = inFile.Length();
+         const size_t tailLength = std::min<size_t>(length, 256);
+         std::string tail(tailLength, '\0');
+         if (inFile.Read(&block[0], start.size()) != start.size() ||
+             std::string(block.data(), start.size()) != start ||
+             !inFile.Seek(length - tailLength) || inFile.Read(&tail[0], tailLength) != tailLength)
+            throw "Not a fragment written by stl2vrml.";
+         const size_t boundsAt = tail.rfind(bounds);
+         Point fmin, fmax;
+         if (boundsAt == std::string::npos ||
+             sscanf(tail.c_str() + boundsAt + bounds.size(), "%lf %lf %lf %lf %lf %lf",
+                    &fmin.x, &fmin.y, &fmin.z, &fmax.x, &fmax.y, &fmax.z) != 6)
+            throw "The fragment has no bounds at the end.";
+         if (fmin.x <= fmax.x)
+         {
+            // The fragment isn't empty.
+            UpdateMinMax(fmin, emin, emax);
+            UpdateMinMax(fmax, emin, emax);
+         }
+
+         // Copy everything between the first and last lines.
+         const size_t bodyEnd = length - tailLength + boundsAt;
+         if (bodyEnd < start.size() || !inFile.Seek(start.size()))
+            throw "Not a fragment written by stl2vrml.";
+         for (size_t remaining = bodyEnd - start.size(); remaining > 0; )
+         {
+            const size_t numbytes = inFile.Read(block.data(), std::min(remaining, block.size()));
+            if (numbytes == 0)
+               throw "Failed reading fragment.";
+            if (!output.Write(block.data(), numbytes))
+               throw "Failed writing output file.";
+            remaining -= numbytes;
+         }
+      }
+
+      writer.WriteEnd(emin, emax);
+      if (gzipFile && !gzipFile->Finish())
+         throw "Failed writing compressed output file.";
+   }
+   catch(const char *text)
+   {
+      printf("stl2vrml:  Error - %s\n", text);
+      return EXIT_FAILURE;
+   }
+   catch(const wchar_t *text)
+   {
+      // The writers' errors.
+      wprintf(L"stl2vrml:  Error - %s\n", text);
+      return EXIT_FAILURE;
+   }
+   catch(...)
+   {
+      printf("stl2vrml:  Aborted due to exception!\n");
+      return EXIT_FAILURE;
+   }
+
+   printf("stl2vrml:  Done.\n");
+   return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------
+// How a batch is given, and whether its files are converted in this
+// process or handed out to worker processes.
+//--------------------------------------------------------------------
+struct BatchOptions
+{
+   std::wstring path;
+   std::wstring extension = L".wrl";
+
+   // The number of worker processes, or zero to convert the files in
+   // this process.  A worker that crashes or runs past the time limit
+   // is restarted, and its file is tried again up to "retries" times.
+   size_t processes = 0;
+   double timeoutSeconds = 0.;
+   size_t retries = 2;
+
+   // How to start a worker:  this program, with the same arguments.
+   std::wstring program;
+   std::vector<std::wstring> workerArgs;
+};
+
+//--------------------------------------------------------------------
+// A file to convert in a batch, and the files to write it to.
+//--------------------------------------------------------------------
+struct BatchJob
+{
+   std::wstring inFilename;
+   std::vector<std::wstring> outFilenames;
+
+   // The size of the STL file, and the estimated number of facets in it.
+   size_t inputLength = 0;
+   size_t estimatedFacets = 0;
+
+   // When the STL file was last written, if it was found in a directory.
+   __time64_t inputTime = 0;
+};
+
+//--------------------------------------------------------------------
+// Looks at the start of a job's STL file to estimate how big a job
+// it is, without reading the whole file.  A file that can't be read
+// is put down as no work; its job will report the error.
+//--------------------------------------------------------------------
+void EstimateBatchJob(BatchJob &job)
+{
+   File file;
+   if (!file.Open(job.inFilename.c_str()))
+      return;
+   // A job found in a directory already has the length from there.
+   if (job.inputLength == 0)
+      job.inputLength = file.Length();
+   try
+   {
+      std::unique_ptr<GzipInputFile> gzipInput;
+      if (GzipInputFile::IsGzipFile(file))
+         gzipInput.reset(new GzipInputFile(file));
+      StlReader reader(gzipInput ? *gzipInput : file);
+      reader.ReadHeaderFromStl();
+      job.estimatedFacets = reader.EstimateNumFacets();
+   }
+   catch (...)
+   {
+   }
+}
+
+//--------------------------------------------------------------------
+// Reads the jobs for a batch from a list file.  Each line gives an STL
+// file and then the files to convert it to, separated by spaces, with
+// double quotes around any name that has spaces in it.  Blank lines
+// and lines starting with # are skipped.  Returns false if the list
+// file can't be read or a line names no output file.
+//--------------------------------------------------------------------
+bool ReadBatchList(const wchar_t *listFilename, std::vector<BatchJob> &jobs)
+{
+   File list;
+   if (!list.Open(listFilename))
+      return false;
+
+   std::string line;
+   while (list.ReadLine(line, true))
+   {
+      std::vector<std::wstring> names;
+      for (size_t i = 0; i < line.size(); )
+      {
+         if (isspace(static_cast<unsigned char>(line[i])))
+         {
+            ++i;
+            continue;
+         }
+         if (names.empty() && line[i] == '#')
+            break;
+         const bool quoted = line[i] == '"';
+         const size_t begin = quoted ? i + 1 : i;
+         size_t end = begin;
+         while (end < line.size() &&
+                (quoted ? line[end] != '"' : !isspace(static_cast<unsigned char>(line[end]))))
+            ++end;
+         names.emplace_back(line.begin() + static_cast<std::ptrdiff_t>(begin),
+                            line.begin() + static_cast<std::ptrdiff_t>(end));
+         i = quoted ? end + 1 : end;
+      }
+
+      if (names.empty())
+         continue;
+      if (names.size() < 2)
+      {
+         printf("stl2vrml:  No output file on line %zu of the batch list.\n", list.LineCounter());
+         return false;
+      }
+      jobs.push_back({ names[0], std::vector<std::wstring>(names.begin() + 1, names.end()) });
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Makes a batch job for each STL file in a directory, compressed or
+// not, converting it to a file of the same name with the given
+// extension in the same directory.  If there's both a compressed and
+// an uncompressed copy of a file, only the uncompressed one is used.
+//--------------------------------------------------------------------
+void ListBatchDirectory(const wchar_t *directory, const wchar_t *extension,
+                        std::vector<BatchJob> &jobs)
+{
+   std::wstring prefix = directory;
+   if (!prefix.empty() && prefix.back() != L'\\' && prefix.back() != L'/')
+      prefix += L'\\';
+
+   _wfinddata64_t found;
+   const std::wstring pattern = prefix + L"*";
+   const intptr_t search = _wfindfirst64(pattern.c_str(), &found);
+   if (search == -1)
+      return;
+   do
+   {
+      std::wstring name = found.name;
+      if (found.attrib & _A_SUBDIR)
+         continue;
+      if (HasExtension(name.c_str(), L".stl.gz"))
+         name.resize(name.size() - 7);
+      else if (HasExtension(name.c_str(), L".stl"))
+         name.resize(name.size() - 4);
+      else
+         continue;
+      jobs.push_back({ prefix + found.name, { prefix + name + extension } });
+      jobs.back().inputLength = static_cast<size_t>(found.size);
+      jobs.back().inputTime = found.time_write;
+   }
+   while (_wfindnext64(search, &found) == 0);
+   _findclose(search);
+
+   // The directory isn't listed in any particular order.  Sorting it
+   // puts each file just before its compressed copy.
+   std::sort(jobs.begin(), jobs.end(),
+             [](const BatchJob &a, const BatchJob &b) { return a.inFilename < b.inFilename; });
+   jobs.erase(std::unique(jobs.begin(), jobs.end(), [](const BatchJob &a, const BatchJob &b)
+              { return SameFilename(a.outFilenames[0].c_str(), b.outFilenames[0].c_str()); }),
+              jobs.end());
+}
+
+//--------------------------------------------------------------------
+// The request and reply that a worker process gets and sends for each
+// file of a batch.  The request is followed by the names of the input
+// file and its output files.
+//--------------------------------------------------------------------
+struct BatchRequest
+{
+   std::uint32_t loopThreads;
+};
+
+struct BatchReply
+{
+   std::uint64_t numFacets;
+   std::uint32_t ok;
+   std::uint32_t reserved;
+};
+
+//--------------------------------------------------------------------
+// Runs a worker process for a batch, which converts one file after
+// another as the supervising process sends them through the pipes
+// whose numbers were given on the command line.  Returns when the
+// supervisor closes the pipe.
+//--------------------------------------------------------------------
+int RunBatchWorker(int in, int out, const ConvertOptions &options,
+                   const CacheOptions &caches)
+{
+   PipeChannel channel(in, out);
+   TaskPool pool(NumWorkerThreads());
+   BatchRequest request;
+   std::vector<std::wstring> names;
+   while (channel.Read(&request, sizeof(request)) && ReadStrings(channel, names) &&
+          names.size() >= 2)
+   {
+      BatchReply reply = {};
+      pool.Submit([&]()
+      {
+         std::vector<const wchar_t *> outFilenames;
+         for (size_t i = 1; i < names.size(); ++i)
+            outFilenames.push_back(names[i].c_str());
+         size_t numFacets = 0;
+         reply.ok = ConvertFiles(names[0].c_str(), outFilenames, options, caches,
+                                 &numFacets) == EXIT_SUCCESS;
+         reply.numFacets = numFacets;
+      }, std::max<size_t>(1, request.loopThreads));
+      pool.Wait();
+      fflush(stdout);
+      if (!channel.Write(&reply, sizeof(reply)))
+         break;
+   }
+   channel.Close();
+   return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------
+// Converts a batch of files.  The batch is either a list file, as
+// read by ReadBatchList, or a directory of STL files, which are
+// converted to files with the given extension.  The files are
+// converted on a TaskPool, several at once, and the parallel loops
+// within each conversion share the pool's threads.
+//
+// If worker processes are asked for, the files are handed out to
+// them instead, one at a time, so that a file that crashes the
+// program only takes its own worker down.  The worker is restarted
+// and the file is tried again, up to the batch's number of retries,
+// before it's counted as failed.
+//
+// The biggest files are started first, so that one huge file doesn't
+// start last and keep the rest of the cores waiting for it at the end.
+// A file that's more than its share of the whole batch gets its loops
+// split across more threads.  The time and speed of each file and of
+// the whole batch are reported.  Returns EXIT_SUCCESS if all of the
+// files were converted.
+//--------------------------------------------------------------------
+int ConvertBatch(const BatchOptions &batch, const ConvertOptions &options,
+                 const CacheOptions &caches)
+{
+   std::vector<BatchJob> jobs;
+   _wfinddata64_t found;
+   const intptr_t search = _wfindfirst64(batch.path.c_str(), &found);
+   const bool isDirectory = search != -1 && (found.attrib & _A_SUBDIR);
+   if (search != -1)
+      _findclose(search);
+   if (isDirectory)
+      ListBatchDirectory(batch.path.c_str(), batch.extension.c_str(), jobs);
+   else if (!ReadBatchList(batch.path.c_str(), jobs))
+   {
+      wprintf(L"stl2vrml:  Failed reading batch list:  %s\n", batch.path.c_str());
+      return EXIT_FAILURE;
+   }
+
+   // Jobs running at the same time mustn't write to the same file.
+   std::vector<std::wstring> allOutputs;
+   for (const auto &job : jobs)
+      for (const auto &name : job.outFilenames)
+      {
+         allOutputs.push_back(name);
+         for (auto &c : allOutputs.back())
+            c = static_cast<wchar_t>(towlower(c));
+      }
+   std::sort(allOutputs.begin(), allOutputs.end());
+   const auto repeated = std::adjacent_find(allOutputs.begin(), allOutputs.end());
+   if (repeated != allOutputs.end())
+   {
+      wprintf(L"stl2vrml:  The batch writes to a file more than once:  %s\n", repeated->c_str());
+      return EXIT_FAILURE;
+   }
+
+   // Biggest first.  Ties keep the order they were given in.
+   ParallelFor(jobs.size(), [&jobs](size_t begin, size_t end)
+   {
+      for (size_t i = begin; i < end; ++i)
+         EstimateBatchJob(jobs[i]);
+   }, 64);
+   std::stable_sort(jobs.begin(), jobs.end(), [](const BatchJob &a, const BatchJob &b)
+                    { return a.estimatedFacets > b.estimatedFacets; });
+   size_t totalEstimate = 0;
+   for (const auto &job : jobs)
+      totalEstimate += job.estimatedFacets;
+   printf("stl2vrml:  Converting a batch of %zu files.\n", jobs.size());
+
+   // A file's loops get as many threads as its share of the batch is
+   // worth, so that small files don't split their loops when the other
+   // files are keeping the cores busy anyway.
+   const size_t numThreads = NumWorkerThreads();
+   const auto loopThreadsFor = [&](const BatchJob &job)
+   {
+      return totalEstimate == 0 ? size_t(1) :
+         std::max<size_t>(1, std::min(numThreads, static_cast<size_t>(std::ceil(
+            static_cast<double>(job.estimatedFacets) * numThreads / totalEstimate))));
+   };
+
+   using Clock = std::chrono::steady_clock;
+   const auto seconds = [](Clock::duration time)
+      { return std::chrono::duration<double>(time).count(); };
+   const Clock::time_point batchStart = Clock::now();
+   std::mutex statsMutex;
+   size_t numFailed = 0, numDone = 0, totalFacets = 0, totalLength = 0;
+   double busySeconds = 0.;
+
+   // Counts and reports a finished file.  The caller holds statsMutex.
+   const auto report = [&](const BatchJob &job, bool ok, size_t numFacets, double time)
+   {
+      ++numDone;
+      busySeconds += time;
+      if (!ok)
+      {
+         ++numFailed;
+         wprintf(L"stl2vrml:  [%zu/%zu] Failed converting %s\n", numDone, jobs.size(),
+                 job.inFilename.c_str());
+         return;
+      }
+      totalFacets += numFacets;
+      totalLength += job.inputLength;
+      wprintf(L"stl2vrml:  [%zu/%zu] Converted %s:  %zu facets in %.3f s, "
+              L"%.0f facets/s, %.2f MB/s\n", numDone, jobs.size(), job.inFilename.c_str(),
+              numFacets, time, time > 0. ? numFacets / time : 0.,
+              time > 0. ? job.inputLength / time / 1048576. : 0.);
+      fflush(stdout);
+   };
+
+   if (batch.processes == 0)
+   {
+      TaskPool pool(numThreads);
+      for (const auto &job : jobs)
+      {
+         pool.Submit([&]()
+         {
+            std::vector<const wchar_t *> outFilenames;
+            for (const auto &name : job.outFilenames)
+               outFilenames.push_back(name.c_str());
+            size_t numFacets = 0;
+            const Clock::time_point start = Clock::now();
+            const bool ok = ConvertFiles(job.inFilename.c_str(), outFilenames, options, caches,
+                                         &numFacets) == EXIT_SUCCESS;
+            const double time = seconds(Clock::now() - start);
+
+            std::lock_guard<std::mutex> lock(statsMutex);
+            report(job, ok, numFacets, time);
+         }, loopThreadsFor(job));
+      }
+      pool.Wait();
+   }
+   else
+   {
+      // Each thread here looks after one worker process, handing it the
+      // next file whenever it's done with the last one.  A file whose
+      // worker stopped goes to the back of the queue to be tried again.
+      std::deque<size_t> queue;
+      for (size_t i = 0; i < jobs.size(); ++i)
+         queue.push_back(i);
+      std::vector<size_t> attempts(jobs.size(), 0);
+      std::vector<std::thread> supervisors;
+      for (size_t p = 0; p < std::min(batch.processes, jobs.size()); ++p)
+         supervisors.emplace_back([&]()
+         {
+            WorkerProcess worker;
+            for (;;)
+            {
+               size_t index = 0;
+               {
+                  std::lock_guard<std::mutex> lock(statsMutex);
+                  if (queue.empty())
+                     break;
+                  index = queue.front();
+                  queue.pop_front();
+               }
+               const BatchJob &job = jobs[index];
+               if (!worker.IsRunning() && !worker.Start(batch.program.c_str(), batch.workerArgs))
+               {
+                  std::lock_guard<std::mutex> lock(statsMutex);
+                  wprintf(L"stl2vrml:  Failed starting a worker process:  %s\n",
+                          batch.program.c_str());
+                  report(job, false, 0, 0.);
+                  continue;
+               }
+
+               std::vector<std::wstring> names(1, job.inFilename);
+               names.insert(names.end(), job.outFilenames.begin(), job.outFilenames.end());
+               const BatchRequest request = { static_cast<std::uint32_t>(loopThreadsFor(job)) };
+               BatchReply reply = {};
+               const Clock::time_point start = Clock::now();
+               PipeChannel &channel = worker.Channel();
+               bool timedOut = false;
+               const bool answered = channel.Write(&request, sizeof(request)) &&
+                                     WriteStrings(channel, names) &&
+                                     worker.ReadReply(&reply, sizeof(reply),
+                                                      batch.timeoutSeconds, &timedOut);
+               const double time = seconds(Clock::now() - start);
+               if (answered)
+               {
+                  std::lock_guard<std::mutex> lock(statsMutex);
+                  report(job, reply.ok != 0, static_cast<size_t>(reply.numFacets), time);
+                  continue;
+               }
+
+               // The worker crashed or was stopped by its time limit.
+               const int exitCode = worker.Stop();
+               std::lock_guard<std::mutex> lock(statsMutex);
+               if (timedOut)
+                  wprintf(L"stl2vrml:  Stopped a worker process after %g s converting %s\n",
+                          batch.timeoutSeconds, job.inFilename.c_str());
+               else
+                  wprintf(L"stl2vrml:  A worker process stopped (exit code %#x) while "
+                          L"converting %s\n", static_cast<unsigned>(exitCode),
+                          job.inFilename.c_str());
+               if (++attempts[index] <= batch.retries)
+                  queue.push_back(index);
+               else
+                  report(job, false, 0, time);
+            }
+         });
+      for (auto &supervisor : supervisors)
+         supervisor.join();
+   }
+
+   const double batchSeconds = seconds(Clock::now() - batchStart);
+   printf("stl2vrml:  Converted %zu of %zu files.\n", jobs.size() - numFailed, jobs.size());
+   printf("stl2vrml:  %zu facets in %.3f s, %.0f facets/s, %.2f MB/s, "
+          "%.1f files at a time on average.\n", totalFacets, batchSeconds,
+          batchSeconds > 0. ? totalFacets / batchSeconds : 0.,
+          batchSeconds > 0. ? totalLength / batchSeconds / 1048576. : 0.,
+          batchSeconds > 0. ? busySeconds / batchSeconds : 0.);
+   return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//--------------------------------------------------------------------
+// Everything given on the command line.
+//--------------------------------------------------------------------
+struct CommandLine
+{
+   ConvertOptions options;
+   CacheOptions caches;
+   BatchOptions batch;
+   std::vector<std::wstring> filenames;
+
+   // The file to join fragments into, if that's what's asked for.
+   std::wstring mergePath;
+
+   // The directory to watch for STL files to convert, how often to
+   // look at it, and how long to keep watching it (forever if zero).
+   std::wstring watchPath;
+   double watchInterval = 1.;
+   double watchTime = 0.;
+
+   // The pipes of a batch worker process, if this is one.
+   int workerIn = -1, workerOut = -1;
+
+   // The socket to serve conversions on, or to ask a service to do a
+   // conversion through, and how many requests may wait at once.
+   std::wstring servePath, clientPath;
+   size_t serveQueue = 64;
+   bool stopService = false;
+};
+
+//--------------------------------------------------------------------
+// Separates the options on a command line from the filenames.
+// Reports any bad option and returns false if there are any.
+//--------------------------------------------------------------------
+bool ParseCommandLine(int argc, const wchar_t *const *argv, CommandLine &line)
+{
+   ConvertOptions &options = line.options;
+   CacheOptions &caches = line.caches;
+   BatchOptions &batch = line.batch;
+   bool badOption = false;
+   for (int arg = 1; arg < argc; ++arg)
+   {
+      const std::wstring text = argv[arg];
+      if (text.compare(0, 2, L"--") != 0)
+         line.filenames.push_back(argv[arg]);
+      else if (text == L"--merge-coplanar")
+         options.mergeCoplanar = true;
+      else if (text == L"--instance")
+         options.instancing = true;
+      else if (text == L"--components")
+         options.components = true;
+      else if (text == L"--normals")
+         options.faceNormals = true;
+      else if (text == L"--orient")
+         options.orient = true;
+      else if (text == L"--smooth-normals" && arg + 1 < argc)
+      {
+         // The crease angle is given in degrees.
+         wchar_t *end = nullptr;
+         const double degrees = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(degrees >= 0. && degrees <= 180.))
+         {
+            wprintf(L"stl2vrml:  Bad crease angle:  %s\n", argv[arg]);
+            badOption = true;
+         }
+         options.smoothNormals = true;
+         options.creaseAngle = degrees * 3.14159265358979323846 / 180.;
+      }
+      else if (text == L"--quantize" && arg + 1 < argc)
+      {
+         // The grid step is a fraction of the model's size.  Very small
+         // steps would overflow the integer coordinates.
+         wchar_t *end = nullptr;
+         const double step = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(step >= 1e-15 && step <= 1.))
+         {
+            wprintf(L"stl2vrml:  Bad quantization step:  %s\n", argv[arg]);
+            badOption = true;
+         }
+         options.quantizeStep = step;
+      }
+      else if (text == L"--mesh-cache" && arg + 1 < argc)
+         caches.meshCacheDir = argv[++arg];
+      else if (text == L"--mesh-cache-size" && arg + 1 < argc)
+      {
+         // The cache's budget is given in megabytes.
+         wchar_t *end = nullptr;
+         caches.meshCacheMegabytes = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(caches.meshCacheMegabytes >= 0. && caches.meshCacheMegabytes <= 1e9))
+         {
+            wprintf(L"stl2vrml:  Bad mesh cache size:  %s\n", argv[arg]);
+            badOption = true;
+         }
+      }
+      else if (text == L"--direct-io")
+         options.directIo = true;
+      else if (text == L"--output-cache" && arg + 1 < argc)
+         caches.outputCacheDir = argv[++arg];
+      else if (text == L"--output-cache-size" && arg + 1 < argc)
+      {
+         // The cache's budget is given in megabytes.
+         wchar_t *end = nullptr;
+         caches.outputCacheMegabytes = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(caches.outputCacheMegabytes >= 0. && caches.outputCacheMegabytes <= 1e9))
+         {
+            wprintf(L"stl2vrml:  Bad output cache size:  %s\n", argv[arg]);
+            badOption = true;
+         }
+      }
+      else if (text == L"--batch" && arg + 1 < argc)
+         batch.path = argv[++arg];
+      else if (text == L"--batch-extension" && arg + 1 < argc)
+      {
+         batch.extension = argv[++arg];
+         if (batch.extension.empty() || batch.extension[0] != L'.')
+            batch.extension.insert(batch.extension.begin(), L'.');
+      }
+      else if ((text == L"--batch-processes" || text == L"--batch-retries") && arg + 1 < argc)
+      {
+         wchar_t *end = nullptr;
+         const double count = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(count >= 0. && count <= 1024.) || count != std::floor(count))
+         {
+            wprintf(L"stl2vrml:  Bad number for %s:  %s\n", text.c_str(), argv[arg]);
+            badOption = true;
+         }
+         (text == L"--batch-processes" ? batch.processes : batch.retries) =
+            static_cast<size_t>(count);
+      }
+      else if (text == L"--batch-timeout" && arg + 1 < argc)
+      {
+         // The time limit for each file is given in seconds.
+         wchar_t *end = nullptr;
+         batch.timeoutSeconds = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(batch.timeoutSeconds >= 0. && batch.timeoutSeconds <= 1e9))
+         {
+            wprintf(L"stl2vrml:  Bad batch time limit:  %s\n", argv[arg]);
+            badOption = true;
+         }
+      }
+      else if (text == L"--facet-range" && arg + 1 < argc)
+      {
+         // The range is given as begin:end, counting facets from zero,
+         // with the end not included.
+         wchar_t *end = nullptr;
+         const unsigned long long first = wcstoull(argv[++arg], &end, 10);
+         unsigned long long last = 0;
+         if (*end == L':')
+            last = wcstoull(end + 1, &end, 10);
+         if (*end != L'\0' || last < first || argv[arg][0] == L':')
+         {
+            wprintf(L"stl2vrml:  Bad facet range:  %s\n", argv[arg]);
+            badOption = true;
+         }
+         options.fragment = true;
+         options.firstFacet = static_cast<size_t>(first);
+         options.endFacet = static_cast<size_t>(last);
+      }
+      else if (text == L"--merge" && arg + 1 < argc)
+         line.mergePath = argv[++arg];
+      else if (text == L"--watch" && arg + 1 < argc)
+         line.watchPath = argv[++arg];
+      else if ((text == L"--watch-interval" || text == L"--watch-time") && arg + 1 < argc)
+      {
+         // Both are given in seconds.
+         wchar_t *end = nullptr;
+         const double time = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(time >= 0. && time <= 1e9) ||
+             (text == L"--watch-interval" && time < 0.01))
+         {
+            wprintf(L"stl2vrml:  Bad time for %s:  %s\n", text.c_str(), argv[arg]);
+            badOption = true;
+         }
+         (text == L"--watch-interval" ? line.watchInterval : line.watchTime) = time;
+      }
+      else if (text == L"--serve" && arg + 1 < argc)
+         line.servePath = argv[++arg];
+      else if (text == L"--serve-queue" && arg + 1 < argc)
+      {
+         wchar_t *end = nullptr;
+         const double count = wcstod(argv[++arg], &end);
+         if (*end != L'\0' || !(count >= 1. && count <= 65536.) || count != std::floor(count))
+         {
+            wprintf(L"stl2vrml:  Bad service queue length:  %s\n", argv[arg]);
+            badOption = true;
+         }
+         line.serveQueue = static_cast<size_t>(count);
+      }
+      else if (text == L"--client" && arg + 1 < argc)
+         line.clientPath = argv[++arg];
+      else if (text == L"--stop")
+         line.stopService = true;
+      else if (text == L"--batch-worker" && arg + 2 < argc)
+      {
+         // Added by the supervising process when it starts a worker.
+         line.workerIn = static_cast<int>(wcstol(argv[++arg], nullptr, 10));
+         line.workerOut = static_cast<int>(wcstol(argv[++arg], nullptr, 10));
+      }
+      else
+      {
+         wprintf(L"stl2vrml:  Unknown option:  %s\n", argv[arg]);
+         badOption = true;
+      }
+   }
+
+
+   // The options that need the whole model can't work on a slice of it.
+   if (options.fragment && options.NeedsMesh())
+   {
+      printf("stl2vrml:  --facet-range can't be used with options that need the whole model.\n");
+      badOption = true;
+   }
+   return !badOption;
+}
+
+//--------------------------------------------------------------------
+// Watches a directory for STL files that are added or changed, and
+// converts each one to a file of the same name with the batch's
+// extension, as --batch does for a whole directory.  The directory is
+// listed every watchInterval seconds, which works the same on local
+// disks and network shares.
+//
+// A file is converted once its size and time have stayed the same for
+// a whole interval, so that a file that's still being copied in isn't
+// read half written.  A file whose contents hash the same as when it
+// was last converted, such as one that's only been touched or copied
+// over with itself, isn't converted again.  At the start, files whose
+// output file is already newer are left alone.  The conversions run on
+// a TaskPool, several at once, while the directory is still watched.
+// Returns when watchTime seconds have passed, if it's not zero.
+//--------------------------------------------------------------------
+int RunWatch(const CommandLine &line)
+{
+   _wfinddata64_t found;
+   const intptr_t search = _wfindfirst64(line.watchPath.c_str(), &found);
+   const bool isDirectory = search != -1 && (found.attrib & _A_SUBDIR);
+   if (search != -1)
+      _findclose(search);
+   if (!isDirectory)
+   {
+      wprintf(L"stl2vrml:  Not a directory:  %s\n", line.watchPath.c_str());
+      return EXIT_FAILURE;
+   }
+   wprintf(L"stl2vrml:  Watching %s for STL files.\n", line.watchPath.c_str());
+   fflush(stdout);
+
+   // What's known about each STL file in the directory.
+   struct WatchedFile
+   {
+      size_t length;
+      __time64_t time;
+      bool settled;       // The same size and time for a whole interval.
+      bool busy;          // Being converted.
+      bool hashed;        // Converted, with contents that hashed to "hash".
+      std::uint64_t hash;
+      bool seen;          // Found by the latest listing.
+   };
+   std::map<std::wstring, WatchedFile> files;
+   std::mutex mutex;
+   bool firstListing = true;
+
+   using Clock = std::chrono::steady_clock;
+   const Clock::time_point watchStart = Clock::now();
+   TaskPool pool(NumWorkerThreads());
+   for (;;)
+   {
+      std::vector<BatchJob> jobs;
+      ListBatchDirectory(line.watchPath.c_str(), line.batch.extension.c_str(), jobs);
+
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         for (auto &file : files)
+            file.second.seen = false;
+         for (const auto &job : jobs)
+         {
+            auto entry = files.find(job.inFilename);
+            if (entry == files.end())
+            {
+               // A file that's there at the start, with an output file
+               // that's newer than it, is up to date already.
+               bool upToDate = false;
+               const intptr_t output = firstListing ?
+                  _wfindfirst64(job.outFilenames[0].c_str(), &found) : -1;
+               if (output != -1)
+               {
+                  upToDate = found.time_write >= job.inputTime;
+                  _findclose(output);
+               }
+               files[job.inFilename] = { job.inputLength, job.inputTime, upToDate, false, false,
+                                         0, true };
+               continue;
+            }
+
+            WatchedFile &file = entry->second;
+            file.seen = true;
+            if (file.busy)
+               continue;
+            if (file.length != job.inputLength || file.time != job.inputTime)
+            {
+               // Still being written, or changed since the last listing.
+               file.length = job.inputLength;
+               file.time = job.inputTime;
+               file.settled = false;
+               continue;
+            }
+            if (file.settled)
+               continue;
+            file.settled = true;
+            file.busy = true;
+
+            pool.Submit([&, job]()
+            {
+               std::vector<const wchar_t *> outFilenames;
+               for (const auto &name : job.outFilenames)
+                  outFilenames.push_back(name.c_str());
+               const Clock::time_point start = Clock::now();
+
+               // Skip a file whose contents haven't changed since they were
+               // converted, as long as its output file is still there.
+               std::uint64_t hash = 0;
+               bool hashed = false;
+               try
+               {
+                  File inFile;
+                  if (inFile.Open(job.inFilename.c_str()))
+                  {
+                     hash = HashFileContents(inFile);
+                     hashed = true;
+                  }
+               }
+               catch (...)
+               {
+               }
+               File outFile;
+               const bool haveOutput = outFile.Open(outFilenames[0]);
+               outFile.Close();
+               {
+                  std::lock_guard<std::mutex> fileLock(mutex);
+                  const WatchedFile &before = files[job.inFilename];
+                  if (hashed && before.hashed && before.hash == hash && haveOutput)
+                  {
+                     files[job.inFilename].busy = false;
+                     return;
+                  }
+               }
+
+               size_t numFacets = 0;
+               const bool ok = ConvertFiles(job.inFilename.c_str(), outFilenames, line.options,
+                                            line.caches, &numFacets) == EXIT_SUCCESS;
+               const double time = std::chrono::duration<double>(Clock::now() - start).count();
+
+               std::lock_guard<std::mutex> fileLock(mutex);
+               WatchedFile &after = files[job.inFilename];
+               after.busy = false;
+               after.hashed = ok && hashed;
+               after.hash = hash;
+               if (ok)
+                  wprintf(L"stl2vrml:  Converted %s:  %zu facets in %.3f s\n",
+                          job.inFilename.c_str(), numFacets, time);
+               else
+                  wprintf(L"stl2vrml:  Failed converting %s\n", job.inFilename.c_str());
+               fflush(stdout);
+            }, pool.NumThreads());
+         }
+
+         // Forget files that have gone, unless they're being converted.
+         for (auto file = files.begin(); file != files.end(); )
+         {
+            if (!file->second.seen && !file->second.busy)
+               file = files.erase(file);
+            else
+               ++file;
+         }
+      }
+      firstListing = false;
+
+      const double elapsed = std::chrono::duration<double>(Clock::now() - watchStart).count();
+      if (line.watchTime > 0. && elapsed >= line.watchTime)
+         break;
+      std::this_thread::sleep_for(std::chrono::duration<double>(line.watchInterval));
+   }
+
+   pool.Wait();
+   printf("stl2vrml:  Stopped watching.\n");
+   return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------
+// Puts a client's current directory in front of a relative filename,
+// since the service's own current directory may be somewhere else.
+//--------------------------------------------------------------------
+std::wstring ClientFilename(const std::wstring &directory, const std::wstring &name)
+{
+   const bool absolute = !name.empty() && (name[0] == L'\\' || name[0] == L'/' ||
+                                           (name.size() > 1 && name[1] == L':'));
+   if (absolute || directory.empty())
+      return name;
+   const wchar_t last = directory.back();
+   return directory + (last == L'\\' || last == L'/' ? L"" : L"\\") + name;
+}
+
+//--------------------------------------------------------------------
+// Handles one client's request to a conversion service.  The request
+// is the client's current directory and then its command line, less
+// the --client option, and the reply is a BatchReply, as for a batch
+// worker.  A client that gives no caches of its own uses the
+// service's, which stay warm from one request to the next.  Sets
+// "stop" if the client asked the service to stop.
+//--------------------------------------------------------------------
+void HandleServiceRequest(LocalSocket &client, const CommandLine &service, bool &stop)
+{
+   std::vector<std::wstring> strings;
+   if (!ReadStrings(client, strings) || strings.empty())
+      return;
+   std::vector<const wchar_t *> argv(1, L"stl2vrml");
+   for (size_t i = 1; i < strings.size(); ++i)
+      argv.push_back(strings[i].c_str());
+
+   CommandLine line;
+   BatchReply reply = {};
+   const bool good = ParseCommandLine(static_cast<int>(argv.size()), argv.data(), line) &&
+                     line.batch.path.empty() && line.servePath.empty() && line.workerIn == -1 &&
+                     line.mergePath.empty() && line.watchPath.empty() && line.clientPath.empty();
+   if (good && line.stopService)
+   {
+      stop = true;
+      reply.ok = 1;
+   }
+   else if (good && line.filenames.size() >= 2)
+   {
+      const std::wstring &directory = strings[0];
+      for (auto &name : line.filenames)
+         name = ClientFilename(directory, name);
+      if (line.caches.meshCacheDir.empty())
+      {
+         line.caches.meshCacheDir = service.caches.meshCacheDir;
+         line.caches.meshCacheMegabytes = service.caches.meshCacheMegabytes;
+      }
+      else
+         line.caches.meshCacheDir = ClientFilename(directory, line.caches.meshCacheDir);
+      if (line.caches.outputCacheDir.empty())
+      {
+         line.caches.outputCacheDir = service.caches.outputCacheDir;
+         line.caches.outputCacheMegabytes = service.caches.outputCacheMegabytes;
+      }
+      else
+         line.caches.outputCacheDir = ClientFilename(directory, line.caches.outputCacheDir);
+
+      std::vector<const wchar_t *> outFilenames;
+      for (size_t i = 1; i < line.filenames.size(); ++i)
+         outFilenames.push_back(line.filenames[i].c_str());
+      size_t numFacets = 0;
+      reply.ok = ConvertFiles(line.filenames[0].c_str(), outFilenames, line.options, line.caches,
+                              &numFacets) == EXIT_SUCCESS;
+      reply.numFacets = numFacets;
+      fflush(stdout);
+   }
+   client.Write(&reply, sizeof(reply));
+}
+
+//--------------------------------------------------------------------
+// Runs a conversion service, which listens on a local socket for
+// requests from clients (stl2vrml --client) and converts their files
+// on a TaskPool, until a client asks it to stop.  Requests run
+// several at once, sharing the pool's threads as the files of a batch
+// do, and the program's memory and caches stay warm between them.
+// When the service's queue is full, it stops accepting connections
+// until a request finishes, so that clients wait instead of piling up
+// more work than it can hold.
+//--------------------------------------------------------------------
+int RunService(const CommandLine &line)
+{
+   LocalSocket server;
+   if (LocalSocket::IsOtherFile(line.servePath))
+   {
+      wprintf(L"stl2vrml:  There's a file that isn't a socket at %s; remove it or give another path.\n",
+              line.servePath.c_str());
+      return EXIT_FAILURE;
+   }
+   if (!server.Listen(line.servePath, SOMAXCONN))
+   {
+      wprintf(L"stl2vrml:  Failed listening on %s\n", line.servePath.c_str());
+      return EXIT_FAILURE;
+   }
+   wprintf(L"stl2vrml:  Serving conversions on %s\n", line.servePath.c_str());
+   fflush(stdout);
+
+   TaskPool pool(NumWorkerThreads());
+   std::mutex mutex;
+   std::condition_variable finished;
+   size_t pending = 0;
+   bool stopping = false;
+   for (;;)
+   {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         finished.wait(lock, [&]() { return pending < line.serveQueue || stopping; });
+         if (stopping)
+            break;
+      }
+      auto client = std::make_shared<LocalSocket>(server.Accept());
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         if (stopping)
+            break;
+         if (!client->IsOpen())
+         {
+            wprintf(L"stl2vrml:  Failed accepting a connection on %s\n", line.servePath.c_str());
+            break;
+         }
+         ++pending;
+      }
+
+      pool.Submit([&, client]()
+      {
+         bool stop = false;
+         HandleServiceRequest(*client, line, stop);
+         client->Close();
+         if (stop)
+         {
+            {
+               std::lock_guard<std::mutex> lock(mutex);
+               stopping = true;
+            }
+            // Wake the loop up if it's waiting for a connection.
+            LocalSocket wake;
+            wake.Connect(line.servePath);
+         }
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            --pending;
+         }
+         finished.notify_one();
+      }, pool.NumThreads());
+   }
+
+   pool.Wait();
+   server.Close();
+   _wremove(line.servePath.c_str());
+   printf("stl2vrml:  Stopped serving conversions.\n");
+   return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------
+// Asks the conversion service listening on a local socket to convert
+// files, with the options given on this command line, or to stop.
+// Returns EXIT_SUCCESS if it did.
+//--------------------------------------------------------------------
+int RunClient(const CommandLine &line, int argc, const wchar_t *const *argv)
+{
+   LocalSocket service;
+   if (!service.Connect(line.clientPath))
+   {
+      wprintf(L"stl2vrml:  No conversion service is listening on %s\n", line.clientPath.c_str());
+      return EXIT_FAILURE;
+   }
+
+   std::vector<std::wstring> strings;
+   wchar_t *directory = _wgetcwd(nullptr, 0);
+   strings.push_back(directory ? directory : L"");
+   free(directory);
+   // The service is sent the rest of the command line, without the
+   // --client option itself.
+   for (int arg = 1; arg < argc; ++arg)
+   {
+      if (std::wstring(argv[arg]) == L"--client" && arg + 1 < argc)
+         ++arg;
+      else
+         strings.push_back(argv[arg]);
+   }
+   BatchReply reply = {};
+   if (!WriteStrings(service, strings) || !service.Read(&reply, sizeof(reply)))
+   {
+      printf("stl2vrml:  The conversion service stopped without replying.\n");
+      return EXIT_FAILURE;
+   }
+   if (line.stopService)
+   {
+      printf("stl2vrml:  Asked the conversion service to stop.\n");
+      return EXIT_SUCCESS;
+   }
+   if (!reply.ok)
+   {
+      wprintf(L"stl2vrml:  The conversion service failed converting %s\n",
+              line.filenames[0].c_str());
+      return EXIT_FAILURE;
+   }
+   wprintf(L"stl2vrml:  The conversion service converted %s:  %llu facets.\n",
+           line.filenames[0].c_str(), static_cast<unsigned long long>(reply.numFacets));
+   return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------
+// Program entry point.  Takes standard arguments from the command
+// line and returns EXIT_SUCCESS if no errors occur.
+//--------------------------------------------------------------------
+int wmain(int argc, wchar_t **argv)
+{
+   CommandLine line;
+   const bool badOption = !ParseCommandLine(argc, argv, line);
+   const std::vector<std::wstring> &filenames = line.filenames;
+   const bool noFilenames = !line.batch.path.empty() || !line.watchPath.empty() ||
+                            !line.servePath.empty() || line.stopService;
+   const size_t minFilenames = noFilenames ? 0 : line.mergePath.empty() ? 2 : 1;
+   const bool clientOnly = line.clientPath.empty() ||
+                           (line.batch.path.empty() && line.watchPath.empty() &&
+                            line.servePath.empty() && line.mergePath.empty());
+   if (badOption || (noFilenames && !filenames.empty()) || filenames.size() < minFilenames ||
+       (line.stopService && line.clientPath.empty()) || !clientOnly)
+   {
+      // The user needs command line help.
+      printf("Usage:  stl2vrml [options] infile.stl outfile.wrl [more output files]\n"
+             "        stl2vrml [options] --batch list-or-directory [--batch-extension ext]\n"
+             "                 [--batch-processes n] [--batch-timeout seconds]\n"
+             "                 [--batch-retries n]\n"
+             "        stl2vrml --facet-range begin:end infile.stl fragment.wrl\n"
+             "        stl2vrml --merge outfile.wrl fragment.wrl [more fragments]\n"
+             "        stl2vrml [options] --watch directory [--batch-extension ext]\n"
+             "                 [--watch-interval seconds] [--watch-time seconds]\n"
+             "        stl2vrml [options] --serve socket [--serve-queue n]\n"
+             "        stl2vrml [options] --client socket infile.stl outfile.wrl [...]\n"
+             "        stl2vrml --client socket --stop\n"
+             "Options:\n"
+             "  --merge-coplanar   Join coplanar triangles into convex polygons.\n"
+             "  --instance         Write repeated parts once and reuse them.\n"
+             "  --components       Write each separate piece of the model as a group.\n"
+             "  --normals          Write the facet normals from the STL file.\n"
+             "  --smooth-normals angle\n"
+             "                     Write smoothed normals, keeping edges sharper than\n"
+             "                     angle (in degrees) sharp.\n"
+             "  --orient           Make the winding consistent and mark solid models.\n"
+             "  --quantize step    Write coordinates as integers on a grid of step times\n"
+             "                     the model's size (e.g. 1e-6).\n"
+             "  --mesh-cache dir   Keep parsed models in dir, and read a model from\n"
+             "                     there instead of parsing it again.\n"
+             "  --mesh-cache-size megabytes\n"
+             "                     Limit the mesh cache to this size (default 1024),\n"
+             "                     deleting the least recently used models.\n"
+             "  --output-cache dir Keep finished output files in dir, and copy an output\n"
+             "                     file from there if the same input file has been\n"
+             "                     converted with the same options before.\n"
+             "  --output-cache-size megabytes\n"
+             "                     Limit the output cache to this size (default 1024).\n"
+             "  --direct-io        Read and write files without the system's file cache,\n"
+             "                     except for GLB, PLY and STL output files.\n"
+             "  --batch list       Convert many files in one run, using all of the cores.\n"
+             "                     Each line of the list file gives an input file and\n"
+             "                     its output files.  If a directory is given instead,\n"
+             "                     each STL file in it is converted to a file with the\n"
+             "                     extension given by --batch-extension (default .wrl).\n"
+             "  --batch-processes n\n"
+             "                     Convert the batch's files in n worker processes,\n"
+             "                     so that a file that crashes the program doesn't\n"
+             "                     stop the batch.  Crashed workers are restarted.\n"
+             "  --batch-timeout seconds\n"
+             "                     Stop a worker process that takes longer than this\n"
+             "                     to convert a file (default no limit).\n"
+             "  --batch-retries n  Try a file that stopped its worker again up to n\n"
+             "                     times (default 2).\n"
+             "  --facet-range begin:end\n"
+             "                     Convert only facets begin to end-1 of a binary STL\n"
+             "                     file, into a fragment of a WRL file.\n"
+             "  --merge outfile    Join the fragments of a model into a WRL file.\n"
+             "  --watch directory  Keep converting STL files that are added to or changed\n"
+             "                     in the directory, as for --batch directory.\n"
+             "  --watch-interval seconds\n"
+             "                     Look at the directory this often (default 1).\n"
+             "  --watch-time seconds\n"
+             "                     Stop watching after this long (default never).\n"
+             "  --serve socket     Run as a service, converting files for clients that\n"
+             "                     connect to the local socket, until one sends --stop.\n"
+             "  --serve-queue n    Let up to n requests wait for the service at once\n"
+             "                     (default 64); more clients wait to connect.\n"
+             "  --client socket    Have the service on the socket convert the files.\n"
+             "An output filename ending in .x3d or .x3dv is written as X3D (XML or\n"
+             "classic encoding), one ending in .glb as binary glTF, one ending in .ply\n"
+             "as binary PLY, one ending in .obj as Wavefront OBJ and one ending in\n"
+             ".stl as binary STL.  One ending in .gz, .wrz, .x3dz or .x3dvz is\n"
+             "compressed with gzip.  Each output file gets the same model, from one\n"
+             "reading of the input file.\n");
+      return EXIT_FAILURE;
+   }
+
+   if (line.workerIn != -1)
+      return RunBatchWorker(line.workerIn, line.workerOut, line.options, line.caches);
+   if (!line.mergePath.empty())
+      return MergeFragments(line.mergePath.c_str(), filenames);
+   if (!line.watchPath.empty())
+      return RunWatch(line);
+   if (!line.servePath.empty())
+      return RunService(line);
+   if (!line.clientPath.empty())
+      return RunClient(line, argc, argv);
+   if (!line.batch.path.empty())
+   {
+      // Worker processes are started as this program with the same
+      // arguments, plus the numbers of their pipes.
+      line.batch.program = argv[0];
+      line.batch.workerArgs.assign(argv + 1, argv + argc);
+      line.batch.workerArgs.push_back(L"--batch-worker");
+      return ConvertBatch(line.batch, line.options, line.caches);
+   }
+   std::vector<const wchar_t *> outFilenames;
+   for (size_t i = 1; i < filenames.size(); ++i)
+      outFilenames.push_back(filenames[i].c_str());
+   return ConvertFiles(filenames[0].c_str(), outFilenames, line.options, line.caches);
 }
 
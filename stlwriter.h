@@ -0,0 +1,182 @@
+//--------------------------------------------------------------------
+// stlwriter.h - Class that writes a 3D model as a binary STL file.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * https://en.wikipedia.org/wiki/STL_(file_format)
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "meshsink.h"
+
+//--------------------------------------------------------------------
+// StlWriter:  Writes a 3D model as a binary STL file, e.g. to turn an
+// ASCII STL file into one that's much quicker to read.  Facets read
+// from the STL file are written as they come, keeping their normals
+// and attribute bytes.  The facet count in the header isn't known
+// until the end, so it's filled in then.  If the options need the
+// whole model, the faces of the mesh are written as triangles instead,
+// with normals worked out from their corners.  The member functions of
+// this class generally throw a string in the event of an error.
+//--------------------------------------------------------------------
+class StlWriter : public FlatMeshSink
+{
+public:
+   StlWriter() = delete;
+   StlWriter(const StlWriter &) = delete;
+   explicit StlWriter(File &file) : FlatMeshSink(file) { }
+
+   // Facets are written straight from the STL file when possible.
+   bool WantsMesh() const override { return false; }
+
+   //--------------------------------------------------------------------
+   // Writes the 80 byte header, which mustn't start with "solid" or it
+   // might be taken for an ASCII STL file, and a facet count of zero
+   // for now.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      std::string header = "Binary STL converted by stl2vrml.";
+      header.resize(headerSize, ' ');
+      WriteText(header);
+      std::vector<std::uint8_t> count;
+      AppendUint32(count, 0);
+      WriteRecords(count);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes a facet read from the STL file.  The records are gathered
+   // into a buffer, which is written to the file when it fills up.
+   //--------------------------------------------------------------------
+   void WriteFacet(const Facet &facet) override
+   {
+      AppendRecord(facet.normal, facet.points, facet.attribute);
+   }
+
+protected:
+
+   //--------------------------------------------------------------------
+   // Writes the faces of a face set as triangles.  The faces are convex,
+   // so each one is split into a fan.
+   //--------------------------------------------------------------------
+   void WriteFlatFaceSet(const Mesh &faceSet) override
+   {
+      for (size_t face = 0; face < faceSet.NumFaces(); ++face)
+      {
+         const std::uint32_t *v = faceSet.Face(face);
+         for (size_t i = 1; i + 1 < faceSet.FaceSize(face); ++i)
+         {
+            const Point points[3] = { WorldCoordinate(faceSet.m_points[v[0]]),
+                                      WorldCoordinate(faceSet.m_points[v[i]]),
+                                      WorldCoordinate(faceSet.m_points[v[i + 1]]) };
+            Point normal = Cross(points[1] - points[0], points[2] - points[0]);
+            const double length = std::sqrt(normal.x * normal.x + normal.y * normal.y +
+                                            normal.z * normal.z);
+            if (length > 0.)
+            {
+               normal.x /= length;
+               normal.y /= length;
+               normal.z /= length;
+            }
+            AppendRecord(normal, points, 0);
+         }
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Writes any facets left in the buffer, and fills in the count.
+   //--------------------------------------------------------------------
+   void WriteTrailer(const Point &, const Point &) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      WriteRecords(m_records);
+      m_records.clear();
+
+      if (m_facetCount > 0xFFFFFFFF)
+         throw L"Too many facets for an STL file.";
+      std::vector<std::uint8_t> count;
+      AppendUint32(count, static_cast<std::uint32_t>(m_facetCount));
+      if (!m_file.Seek(headerSize))
+         throw L"Failed seeking in output file.";
+      WriteRecords(count);
+   }
+
+private:
+   static constexpr size_t headerSize = 80;
+   static constexpr size_t recordSize = 50;
+   static constexpr size_t recordsPerWrite = 4096;
+
+   //--------------------------------------------------------------------
+   // Adds a 50 byte facet record to the buffer:  the normal and the
+   // three corners as 32-bit floats, then the attribute bytes.
+   //--------------------------------------------------------------------
+   void AppendRecord(const Point &normal, const Point *points, std::uint16_t attribute)
+   {
+      AppendFloat(m_records, static_cast<float>(normal.x));
+      AppendFloat(m_records, static_cast<float>(normal.y));
+      AppendFloat(m_records, static_cast<float>(normal.z));
+      for (int i = 0; i < 3; ++i)
+      {
+         AppendFloat(m_records, static_cast<float>(points[i].x));
+         AppendFloat(m_records, static_cast<float>(points[i].y));
+         AppendFloat(m_records, static_cast<float>(points[i].z));
+      }
+      m_records.push_back(static_cast<std::uint8_t>(attribute));
+      m_records.push_back(static_cast<std::uint8_t>(attribute >> 8));
+      ++m_facetCount;
+
+      if (m_records.size() >= recordsPerWrite * recordSize)
+      {
+         WriteRecords(m_records);
+         m_records.clear();
+      }
+   }
+
+   void WriteRecords(const std::vector<std::uint8_t> &data)
+   {
+      if (!data.empty() && !m_file.Write(data.data(), data.size()))
+         throw writeError;
+   }
+
+   // Facet records waiting to be written, and the number of facets.
+   std::vector<std::uint8_t> m_records;
+   size_t m_facetCount = 0;
+};
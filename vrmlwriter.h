@@ -0,0 +1,467 @@
+//--------------------------------------------------------------------
+// vrmlwriter.h - Classes that write a 3D model as VRML 2.0 (.WRL)
+// text, or as X3D in its classic VRML encoding (.X3DV), which has
+// the same syntax.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * https://tecfa.unige.ch/guides/vrml/vrmlman/node6.html
+//  * http://www2.cmp.uea.ac.uk/~jrk/wwwvrml.dir/public-vrml/VRMLLECTURE/
+//  * https://www.web3d.org/documents/specifications/19776-2/V3.3/
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "meshsink.h"
+#include <algorithm>
+
+//--------------------------------------------------------------------
+// VrmlWriter:  This class may be used to write a simple 3D model,
+// consisting of polygons, to a VRML .WRL file.  The member functions
+// of this class generally throw a string in the event of an error.
+//--------------------------------------------------------------------
+class VrmlWriter : public MeshSink
+{
+public:
+   VrmlWriter() = delete;
+   VrmlWriter(const VrmlWriter &) = delete;
+   explicit VrmlWriter(File &file) : MeshSink(file) { }
+   VrmlWriter(const VrmlWriter &settings, File &file) : MeshSink(settings, file) { }
+
+   //--------------------------------------------------------------------
+   // The first and last lines of a fragment, which is the middle of a
+   // WRL file holding a slice of the model's facets.  The last line
+   // gives the bounds of the slice.  Fragments are joined into a whole
+   // WRL file by writing the start of one, then the middle of each
+   // fragment, then the end for the bounds of all of them.
+   //--------------------------------------------------------------------
+   static const char *FragmentStart() { return "#stl2vrml fragment 1\r\n"; }
+   static const char *FragmentBounds() { return "#stl2vrml bounds"; }
+
+   // Makes the writer write a fragment instead of a whole WRL file.
+   void SetFragment(bool fragment) { m_fragment = fragment; }
+
+   //--------------------------------------------------------------------
+   // Writes the beginning portion of the WRL file.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (!m_file.Printf("%s", m_fragment ? FragmentStart() :
+                         "#VRML V2.0 utf8\r\n# Model converted by stl2vrml.\r\n"))
+         throw writeError;
+   }
+
+protected:
+
+   // Each face set is written on its own, so they can be formatted on
+   // separate threads.
+   std::unique_ptr<MeshSink> NewFaceSetFormatter(File &file) const override
+      { return std::unique_ptr<MeshSink>(new VrmlWriter(*this, file)); }
+
+   //--------------------------------------------------------------------
+   // Writes a piece of a mesh to the WRL file as a Shape object with an
+   // IndexedFaceSet inside.
+   //--------------------------------------------------------------------
+   void WriteFaceSet(const Mesh &faceSet) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (faceSet.NumFaces() < 1)
+         return;  // Nothing to write.
+
+      WriteStartOfShapeToWrl();
+      WriteCoordListToWrl(faceSet.m_points);
+      WriteMiddleOfShapeToWrl();
+      WriteFaceIndexesToWrl(faceSet);
+      WriteEndOfIndexesToWrl();
+      WriteNormalsToWrl(faceSet);
+      WriteHintsToWrl();
+      WriteEndOfShapeToWrl();
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the start of a Transform object that moves its children,
+   // and one that also scales them.
+   //--------------------------------------------------------------------
+   void BeginTransform(const Point &translation) override
+   {
+      std::string text = "\r\nTransform {\r\n"
+                         "  translation ";
+      AppendTranslation(text, translation);
+      text += "\r\n"
+              "  children [\r\n";
+      WriteText(text);
+   }
+
+   void BeginScaledTransform(const Point &translation, double scale) override
+   {
+      std::string text = "\r\nTransform {\r\n"
+                         "  translation ";
+      AppendTranslation(text, translation);
+      text += "\r\n"
+              "  scale ";
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), "%.15G %.15G %.15G", scale, scale, scale);
+      text += buffer;
+      text += "\r\n"
+              "  children [\r\n";
+      WriteText(text);
+   }
+
+   void EndTransform() override
+   {
+      if (!m_file.Printf("  ]\r\n"
+                         "}\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the start of a Group object with a bounding box.
+   //--------------------------------------------------------------------
+   void BeginBoundedGroup(const Point &center, const Point &size) override
+   {
+      if (!m_file.Printf("\r\nGroup {\r\n"
+                         "  bboxCenter %.15G %.15G %.15G\r\n"
+                         "  bboxSize %.15G %.15G %.15G\r\n"
+                         "  children [\r\n",
+                         center.x, center.y, center.z, size.x, size.y, size.z))
+         throw writeError;
+   }
+
+   void EndBoundedGroup() override
+   {
+      if (!m_file.Printf("  ]\r\n"
+                         "}\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the start of a Group object named with DEF, so that it can
+   // be reused with USE.
+   //--------------------------------------------------------------------
+   void BeginPartDefinition(size_t partNumber) override
+   {
+      if (!m_file.Printf("    DEF Part%zu Group {\r\n"
+                         "      children [\r\n", partNumber))
+         throw writeError;
+   }
+
+   void EndPartDefinition() override
+   {
+      if (!m_file.Printf("      ]\r\n"
+                         "    }\r\n"))
+         throw writeError;
+   }
+
+   void UsePart(size_t partNumber) override
+   {
+      if (!m_file.Printf("    USE Part%zu\r\n", partNumber))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the remainder of the WRL file after the model:  the camera,
+   // background and navigation settings.
+   //--------------------------------------------------------------------
+   void WriteTrailer(const Point &emin, const Point &emax) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+
+      // A fragment ends with its bounds, exactly, for the camera of the
+      // file it's joined into.
+      if (m_fragment)
+      {
+         if (!m_file.Printf("%s %.17G %.17G %.17G %.17G %.17G %.17G\r\n", FragmentBounds(),
+                            emin.x, emin.y, emin.z, emax.x, emax.y, emax.z))
+            throw writeError;
+         return;
+      }
+
+      // Point the camera at the model.
+      if (!m_file.Printf("\r\nViewpoint {\r\n"
+                    "  description \"View_1\"\r\n"
+                    "  orientation 1 0 0 0\r\n"))
+         throw writeError;
+      if (!m_file.Printf("  position %G %G %G\n",
+            emin.x + (emax.x - emin.x) / 2.,
+            emin.y + (emax.y - emin.y) / 2.,
+            emin.z + (emax.z - emin.z) / 2 + std::max(emax.x - emin.x, emax.y - emin.y)))
+         throw writeError;
+      if (!m_file.Printf("}\r\n"))
+         throw writeError;
+
+      // Set a dark gray background.
+      if (!m_file.Printf("Background { skyColor 0.4 0.4 0.4 }\r\n"))
+         throw writeError;
+
+      // Default to "examine" mode when the VRML viewer opens the WRL file.
+      if (!m_file.Printf("NavigationInfo { type [ \"EXAMINE\" \"ANY\" ] }\r\n\r\n"))
+         throw writeError;
+   }
+
+private:
+
+   //--------------------------------------------------------------------
+   // Writes a list of coordinates values for an IndexedFaceSet in a WRL.
+   //--------------------------------------------------------------------
+   void WriteCoordListToWrl(const std::vector<Point> &points)
+   {
+      // Each line contains one XYZ coordinate with spaces
+      // between the fields.
+      // All but the last line ends with a comma.
+      std::string text;
+      text.reserve(points.size() * 48);
+      for (size_t i = 0; i < points.size(); ++i)
+      {
+         text += "        ";
+         AppendCoordinate(text, points[i]);
+         if (i < points.size() - 1)
+            text += ", ";
+         text += "\r\n";
+      }
+      WriteText(text);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes a list of vectors, such as normals, in the same layout as
+   // WriteCoordListToWrl, with the given number of significant digits.
+   //--------------------------------------------------------------------
+   void WriteVectorListToWrl(const std::vector<Point> &vectors, int digits)
+   {
+      std::string text;
+      text.reserve(vectors.size() * 40);
+      for (size_t i = 0; i < vectors.size(); ++i)
+      {
+         text += "        ";
+         AppendVector(text, vectors[i], digits);
+         if (i < vectors.size() - 1)
+            text += ", ";
+         text += "\r\n";
+      }
+      WriteText(text);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes a list of coordinate indexes for an IndexedFaceSet in a WRL
+   // from the faces of a mesh.  The indexes to write default to the
+   // mesh's vertex indexes, but a different list with one index per
+   // corner (such as indexes of normals) may be given instead.
+   //--------------------------------------------------------------------
+   void WriteFaceIndexesToWrl(const Mesh &mesh, const std::vector<std::uint32_t> *indexes = nullptr)
+   {
+      if (indexes == nullptr)
+         indexes = &mesh.m_indexes;
+
+      // Each line contains the indexes for one face, which refer to
+      // points in the previously written coordinate list.  The format
+      // of each line of coordinate indexes is:
+      //        index1, index2, index3, -1
+      //
+      // All but the last line should also have a comma at the end.
+      const size_t numFaces = mesh.NumFaces();
+      std::string text;
+      text.reserve(indexes->size() * 8 + numFaces * 12);
+      for (size_t face = 0; face < numFaces; ++face)
+      {
+         text += "      ";
+         const std::uint32_t *v = indexes->data() + mesh.m_faceStart[face];
+         for (size_t i = 0; i < mesh.FaceSize(face); ++i)
+         {
+            AppendInteger(text, v[i]);
+            text += ", ";
+         }
+
+         text += "-1";
+         if (face < numFaces - 1)
+            text += ',';
+         text += "\r\n";
+      }
+      WriteText(text);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the portion of a Shape object that comes before the list
+   // of coordinates of its IndexedFaceSet.
+   //--------------------------------------------------------------------
+   void WriteStartOfShapeToWrl()
+   {
+      // We don't have any color information about this model,
+      // so we're using a light gray color for the triangles
+      // in the WRL file.
+
+      if (!m_file.Printf("\r\nShape {\r\n"
+                         "  appearance Appearance {\r\n"
+                         "    material Material {\r\n"
+                         "      diffuseColor 0.8 0.8 0.8\r\n"
+                         "    }\r\n"
+                         "  }\r\n"
+                         "  geometry IndexedFaceSet {\r\n"
+                         "    coord Coordinate {\r\n"
+                         "      point [\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the portion of a Shape object that comes between the list
+   // of coordinates and the list of coordinate indexes.
+   //--------------------------------------------------------------------
+   void WriteMiddleOfShapeToWrl()
+   {
+      if (!m_file.Printf("      ]\r\n"
+                         "    }\r\n"
+                         "    coordIndex [\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the end of a list of indexes in an IndexedFaceSet.
+   //--------------------------------------------------------------------
+   void WriteEndOfIndexesToWrl()
+   {
+      if (!m_file.Printf("    ]\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the normals of a face set, if it has any, to the WRL file.
+   // Face normals are written in the same order as the faces.  Corner
+   // normals are written as a list of unique normals, followed by an
+   // index into that list for each corner.
+   //--------------------------------------------------------------------
+   void WriteNormalsToWrl(const Mesh &faceSet)
+   {
+      constexpr int normalDigits = 7;
+      if (!faceSet.m_cornerNormals.empty())
+      {
+         std::vector<Point> normals;
+         std::vector<std::uint32_t> normalIndexes;
+         UniqueNormals(faceSet, normals, normalIndexes);
+
+         if (!m_file.Printf("    normal Normal {\r\n"
+                            "      vector [\r\n"))
+            throw writeError;
+         WriteVectorListToWrl(normals, normalDigits);
+         if (!m_file.Printf("      ]\r\n"
+                            "    }\r\n"
+                            "    normalIndex [\r\n"))
+            throw writeError;
+         WriteFaceIndexesToWrl(faceSet, &normalIndexes);
+         WriteEndOfIndexesToWrl();
+         if (!m_file.Printf("    creaseAngle %.7G\r\n", m_creaseAngle))
+            throw writeError;
+      }
+      else if (!faceSet.m_faceNormals.empty())
+      {
+         if (!m_file.Printf("    normal Normal {\r\n"
+                            "      vector [\r\n"))
+            throw writeError;
+         WriteVectorListToWrl(faceSet.m_faceNormals, normalDigits);
+         if (!m_file.Printf("      ]\r\n"
+                            "    }\r\n"
+                            "    normalPerVertex FALSE\r\n"))
+            throw writeError;
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the solid, ccw and convex hints for a face set, if the
+   // writer has been told about them.  The faces we write are always
+   // convex, but the winding can only be vouched for when the model
+   // passed the orientation check.
+   //--------------------------------------------------------------------
+   void WriteHintsToWrl()
+   {
+      if (!m_writeHints)
+         return;
+      if (m_solid)
+      {
+         if (!m_file.Printf("    solid TRUE\r\n"
+                            "    ccw TRUE\r\n"
+                            "    convex TRUE\r\n"))
+            throw writeError;
+      }
+      else
+      {
+         if (!m_file.Printf("    solid FALSE\r\n"
+                            "    convex TRUE\r\n"))
+            throw writeError;
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the portion of a Shape object that comes after the lists
+   // of coordinate indexes and normals.
+   //--------------------------------------------------------------------
+   void WriteEndOfShapeToWrl()
+   {
+      if (!m_file.Printf("  }\r\n"
+                         "}\r\n"))
+         throw writeError;
+   }
+
+   bool m_fragment = false;
+};
+
+//--------------------------------------------------------------------
+// X3dClassicWriter:  Writes a 3D model as an X3D file in the classic
+// VRML encoding (.X3DV).  The nodes we use are written exactly as in
+// VRML 2.0, so only the header differs.
+//--------------------------------------------------------------------
+class X3dClassicWriter : public VrmlWriter
+{
+public:
+   X3dClassicWriter() = delete;
+   X3dClassicWriter(const X3dClassicWriter &) = delete;
+   explicit X3dClassicWriter(File &file) : VrmlWriter(file) { }
+
+   //--------------------------------------------------------------------
+   // Writes the beginning portion of the X3DV file.  All of the nodes
+   // we write are in the Interchange profile.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (!m_file.Printf("#X3D V3.0 utf8\r\n"
+                         "PROFILE Interchange\r\n"
+                         "# Model converted by stl2vrml.\r\n"))
+         throw writeError;
+   }
+};
@@ -0,0 +1,326 @@
+//--------------------------------------------------------------------
+// workerprocess.h - Helpers for running jobs in worker processes,
+// which are fed through pipes and restarted if they crash.
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+
+#pragma once
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+//--------------------------------------------------------------------
+// PipeChannel:  The two ends of a pair of pipes, one to read messages
+// from and one to write them to.  Messages are sent as raw bytes, so
+// both ends must be the same program.
+//--------------------------------------------------------------------
+class PipeChannel
+{
+public:
+   PipeChannel() = default;
+   PipeChannel(int in, int out) : m_in(in), m_out(out) {}
+
+   // Reads exactly size bytes.  Returns false at the end of the pipe,
+   // which is where the other end was closed or its process stopped.
+   bool Read(void *data, size_t size)
+   {
+      char *p = static_cast<char *>(data);
+      while (size > 0)
+      {
+         const int got = _read(m_in, p, static_cast<unsigned>(std::min<size_t>(size, 65536)));
+         if (got <= 0)
+            return false;
+         p += got;
+         size -= static_cast<size_t>(got);
+      }
+      return true;
+   }
+
+   // Writes exactly size bytes.  Returns false if the other end is gone.
+   bool Write(const void *data, size_t size)
+   {
+      const char *p = static_cast<const char *>(data);
+      while (size > 0)
+      {
+         const int put = _write(m_out, p, static_cast<unsigned>(std::min<size_t>(size, 65536)));
+         if (put <= 0)
+            return false;
+         p += put;
+         size -= static_cast<size_t>(put);
+      }
+      return true;
+   }
+
+   // Closes both ends.
+   void Close()
+   {
+      if (m_in != -1)
+         _close(m_in);
+      if (m_out != -1)
+         _close(m_out);
+      m_in = m_out = -1;
+   }
+
+private:
+   int m_in = -1;
+   int m_out = -1;
+};
+
+//--------------------------------------------------------------------
+// Writes a list of strings to a channel, each preceded by its length.
+// A channel is any class with Read and Write functions like those of
+// PipeChannel.
+//--------------------------------------------------------------------
+template <class Channel>
+bool WriteStrings(Channel &channel, const std::vector<std::wstring> &strings)
+{
+   const std::uint32_t count = static_cast<std::uint32_t>(strings.size());
+   if (!channel.Write(&count, sizeof(count)))
+      return false;
+   for (const auto &s : strings)
+   {
+      const std::uint32_t length = static_cast<std::uint32_t>(s.size());
+      if (!channel.Write(&length, sizeof(length)) ||
+          !channel.Write(s.data(), length * sizeof(wchar_t)))
+         return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// Reads a list of strings written by WriteStrings.  Returns false at
+// the end of the channel, or if the lengths are too big to be real.
+//--------------------------------------------------------------------
+template <class Channel>
+bool ReadStrings(Channel &channel, std::vector<std::wstring> &strings)
+{
+   std::uint32_t count = 0;
+   if (!channel.Read(&count, sizeof(count)) || count > 65536)
+      return false;
+   strings.resize(count);
+   for (auto &s : strings)
+   {
+      std::uint32_t length = 0;
+      if (!channel.Read(&length, sizeof(length)) || length > 65536)
+         return false;
+      s.resize(length);
+      if (length > 0 && !channel.Read(&s[0], length * sizeof(wchar_t)))
+         return false;
+   }
+   return true;
+}
+
+//--------------------------------------------------------------------
+// WorkerProcess:  A child process that's started with a pair of pipes
+// to talk to it through.  The numbers of the child's ends of the pipes
+// are added to the end of its command line.  Only those two ends are
+// inherited by the child; the parent's ends aren't, so that when
+// either process stops, the other sees the end of its pipe instead of
+// waiting forever.
+//--------------------------------------------------------------------
+class WorkerProcess
+{
+public:
+   WorkerProcess() = default;
+   WorkerProcess(const WorkerProcess &) = delete;
+   WorkerProcess &operator=(const WorkerProcess &) = delete;
+   ~WorkerProcess() { Stop(); }
+
+   bool IsRunning() const { return m_process != -1; }
+   PipeChannel &Channel() { return m_channel; }
+
+   //--------------------------------------------------------------------
+   // Starts the program with the given arguments, followed by the
+   // numbers of the child's read and write ends of its pipes.  Returns
+   // false if the pipes can't be made or the program can't be started.
+   //--------------------------------------------------------------------
+   bool Start(const wchar_t *program, std::vector<std::wstring> args)
+   {
+      Stop();
+
+      // Workers started on other threads at the same moment mustn't
+      // inherit this one's pipes, so only one is started at a time.
+      std::lock_guard<std::mutex> lock(StartMutex());
+      int toWorker[2], fromWorker[2];
+      if (_pipe(toWorker, 65536, _O_BINARY | _O_NOINHERIT) != 0)
+         return false;
+      if (_pipe(fromWorker, 65536, _O_BINARY | _O_NOINHERIT) != 0)
+      {
+         _close(toWorker[0]);
+         _close(toWorker[1]);
+         return false;
+      }
+
+      // Duplicates are inheritable, so the child gets just these two.
+      const int childIn = _dup(toWorker[0]);
+      const int childOut = _dup(fromWorker[1]);
+      _close(toWorker[0]);
+      _close(fromWorker[1]);
+      args.push_back(std::to_wstring(childIn));
+      args.push_back(std::to_wstring(childOut));
+
+      std::vector<std::wstring> quoted;
+      quoted.push_back(QuoteArgument(program));
+      for (const auto &arg : args)
+         quoted.push_back(QuoteArgument(arg));
+      std::vector<const wchar_t *> argv;
+      for (const auto &arg : quoted)
+         argv.push_back(arg.c_str());
+      argv.push_back(nullptr);
+
+      // Anything buffered for the console goes out before the child's
+      // own output does.
+      fflush(stdout);
+      if (childIn != -1 && childOut != -1)
+         m_process = _wspawnv(_P_NOWAIT, program, argv.data());
+      if (childIn != -1)
+         _close(childIn);
+      if (childOut != -1)
+         _close(childOut);
+      if (m_process == -1)
+      {
+         _close(toWorker[1]);
+         _close(fromWorker[0]);
+         return false;
+      }
+      m_channel = PipeChannel(fromWorker[0], toWorker[1]);
+      return true;
+   }
+
+   //--------------------------------------------------------------------
+   // Reads exactly size bytes of the worker's reply.  If it hasn't come
+   // within the given number of seconds, the process is ended, which
+   // closes its end of the pipe, and timedOut is set.  A limit of zero
+   // means no limit.  Returns false if there's no reply.
+   //--------------------------------------------------------------------
+   bool ReadReply(void *data, size_t size, double seconds, bool *timedOut)
+   {
+      *timedOut = false;
+      if (seconds <= 0.)
+         return m_channel.Read(data, size);
+
+      std::mutex mutex;
+      std::condition_variable replied;
+      bool done = false;
+      std::thread timer([&]()
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         if (!replied.wait_for(lock, std::chrono::duration<double>(seconds),
+                               [&]() { return done; }))
+         {
+            *timedOut = true;
+            TerminateProcess(reinterpret_cast<HANDLE>(m_process), EXIT_FAILURE);
+         }
+      });
+      const bool ok = m_channel.Read(data, size);
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         done = true;
+      }
+      replied.notify_one();
+      timer.join();
+      return ok && !*timedOut;
+   }
+
+   //--------------------------------------------------------------------
+   // Closes the pipes, which tells a waiting worker to finish, and
+   // waits for the process to end.  Returns its exit code, which is
+   // the exception code on Windows if it crashed.
+   //--------------------------------------------------------------------
+   int Stop()
+   {
+      m_channel.Close();
+      int status = 0;
+      if (m_process != -1)
+         _cwait(&status, m_process, _WAIT_CHILD);
+      m_process = -1;
+      return status;
+   }
+
+private:
+   //--------------------------------------------------------------------
+   // Puts double quotes around an argument that has spaces or quotes in
+   // it, since _wspawnv joins the arguments into one command line.
+   // Backslashes are doubled only where they come before a quote, as
+   // the C runtime expects when it splits the line up again.
+   //--------------------------------------------------------------------
+   static std::wstring QuoteArgument(const std::wstring &arg)
+   {
+      if (!arg.empty() && arg.find_first_of(L" \t\"") == std::wstring::npos)
+         return arg;
+      std::wstring result = L"\"";
+      size_t backslashes = 0;
+      for (const wchar_t c : arg)
+      {
+         if (c == L'\\')
+         {
+            ++backslashes;
+            continue;
+         }
+         result.append(c == L'"' ? backslashes * 2 + 1 : backslashes, L'\\');
+         backslashes = 0;
+         result += c;
+      }
+      result.append(backslashes * 2, L'\\');
+      result += L'"';
+      return result;
+   }
+
+   static std::mutex &StartMutex()
+   {
+      static std::mutex mutex;
+      return mutex;
+   }
+
+   intptr_t m_process = -1;
+   PipeChannel m_channel;
+};
@@ -0,0 +1,278 @@
+//--------------------------------------------------------------------
+// x3dwriter.h - Class that writes a 3D model as an X3D file in the
+// XML encoding (.X3D).
+//
+// (C) Copyright 2018 Ammon R. Campbell.
+//
+// I wrote this code for use in my own educational and experimental
+// programs, but you may also freely use it in yours as long as you
+// abide by the following terms and conditions.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//   * Redistributions of source code must retain the above copyright
+//     notice, this list of conditions and the following disclaimer.
+//   * Redistributions in binary form must reproduce the above
+//     copyright notice, this list of conditions and the following
+//     disclaimer in the documentation and/or other materials
+//     provided with the distribution.
+//   * The name(s) of the author(s) and contributors (if any) may not
+//     be used to endorse or promote products derived from this
+//     software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+// CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+// INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+// OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
+//--------------------------------------------------------------------
+//
+// Reference Material:
+//
+//  * https://www.web3d.org/documents/specifications/19776-1/V3.3/
+//
+//--------------------------------------------------------------------
+
+#pragma once
+#include "meshsink.h"
+#include <algorithm>
+
+//--------------------------------------------------------------------
+// X3dXmlWriter:  Writes a 3D model as an X3D file in the XML encoding.
+// The nodes are the same ones that VrmlWriter writes, with their fields
+// as XML attributes, so the two files look alike in a viewer.  The
+// member functions of this class generally throw a string in the
+// event of an error.
+//--------------------------------------------------------------------
+class X3dXmlWriter : public MeshSink
+{
+public:
+   X3dXmlWriter() = delete;
+   X3dXmlWriter(const X3dXmlWriter &) = delete;
+   explicit X3dXmlWriter(File &file) : MeshSink(file) { }
+
+   //--------------------------------------------------------------------
+   // Writes the beginning portion of the X3D file.  All of the nodes we
+   // write are in the Interchange profile.
+   //--------------------------------------------------------------------
+   void WriteStart() override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (!m_file.Printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
+                         "<!DOCTYPE X3D PUBLIC \"ISO//Web3D//DTD X3D 3.0//EN\" "
+                         "\"http://www.web3d.org/specifications/x3d-3.0.dtd\">\r\n"
+                         "<!-- Model converted by stl2vrml. -->\r\n"
+                         "<X3D profile='Interchange' version='3.0'>\r\n"
+                         "<Scene>\r\n"))
+         throw writeError;
+   }
+
+protected:
+
+   //--------------------------------------------------------------------
+   // Writes a piece of a mesh to the X3D file as a Shape element with an
+   // IndexedFaceSet inside.
+   //--------------------------------------------------------------------
+   void WriteFaceSet(const Mesh &faceSet) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+      if (faceSet.NumFaces() < 1)
+         return;  // Nothing to write.
+
+      // The corner normals are written as a list of unique normals and
+      // an index into that list for each corner, as in the WRL file.
+      std::vector<Point> normals;
+      std::vector<std::uint32_t> normalIndexes;
+      if (!faceSet.m_cornerNormals.empty())
+         UniqueNormals(faceSet, normals, normalIndexes);
+
+      // We don't have any color information about this model, so we're
+      // using a light gray color, like in the WRL file.
+      std::string text;
+      text.reserve(faceSet.m_points.size() * 48 + faceSet.m_indexes.size() * 8);
+      text += "<Shape>\r\n"
+              "  <Appearance>\r\n"
+              "    <Material diffuseColor='0.8 0.8 0.8'/>\r\n"
+              "  </Appearance>\r\n"
+              "  <IndexedFaceSet coordIndex='";
+      AppendFaceIndexes(text, faceSet, faceSet.m_indexes);
+      text += '\'';
+      if (!normals.empty())
+      {
+         char buffer[64];
+         text += "\r\n    normalIndex='";
+         AppendFaceIndexes(text, faceSet, normalIndexes);
+         snprintf(buffer, sizeof(buffer), "' creaseAngle='%.7G'", m_creaseAngle);
+         text += buffer;
+      }
+      else if (!faceSet.m_faceNormals.empty())
+         text += " normalPerVertex='false'";
+      if (m_writeHints)
+      {
+         // The faces we write are always convex, but the winding can
+         // only be vouched for when the model passed the orientation
+         // check.
+         if (m_solid)
+            text += " solid='true' ccw='true' convex='true'";
+         else
+            text += " solid='false' convex='true'";
+      }
+      text += ">\r\n"
+              "    <Coordinate point='";
+      for (size_t i = 0; i < faceSet.m_points.size(); ++i)
+      {
+         if (i > 0)
+            text += ",\r\n      ";
+         AppendCoordinate(text, faceSet.m_points[i]);
+      }
+      text += "'/>\r\n";
+      if (!normals.empty())
+         AppendNormals(text, normals);
+      else if (!faceSet.m_faceNormals.empty())
+         AppendNormals(text, faceSet.m_faceNormals);
+      text += "  </IndexedFaceSet>\r\n"
+              "</Shape>\r\n";
+      WriteText(text);
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the start of a Transform element that moves its children,
+   // and one that also scales them.
+   //--------------------------------------------------------------------
+   void BeginTransform(const Point &translation) override
+   {
+      std::string text = "<Transform translation='";
+      AppendTranslation(text, translation);
+      text += "'>\r\n";
+      WriteText(text);
+   }
+
+   void BeginScaledTransform(const Point &translation, double scale) override
+   {
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), "' scale='%.15G %.15G %.15G'>\r\n", scale, scale, scale);
+      std::string text = "<Transform translation='";
+      AppendTranslation(text, translation);
+      text += buffer;
+      WriteText(text);
+   }
+
+   void EndTransform() override
+   {
+      if (!m_file.Printf("</Transform>\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the start of a Group element with a bounding box.
+   //--------------------------------------------------------------------
+   void BeginBoundedGroup(const Point &center, const Point &size) override
+   {
+      if (!m_file.Printf("<Group bboxCenter='%.15G %.15G %.15G' bboxSize='%.15G %.15G %.15G'>\r\n",
+                         center.x, center.y, center.z, size.x, size.y, size.z))
+         throw writeError;
+   }
+
+   void EndBoundedGroup() override
+   {
+      if (!m_file.Printf("</Group>\r\n"))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the start of a Group element named with DEF, so that it can
+   // be reused with USE.
+   //--------------------------------------------------------------------
+   void BeginPartDefinition(size_t partNumber) override
+   {
+      if (!m_file.Printf("<Group DEF='Part%zu'>\r\n", partNumber))
+         throw writeError;
+   }
+
+   void EndPartDefinition() override
+   {
+      if (!m_file.Printf("</Group>\r\n"))
+         throw writeError;
+   }
+
+   void UsePart(size_t partNumber) override
+   {
+      if (!m_file.Printf("<Group USE='Part%zu'/>\r\n", partNumber))
+         throw writeError;
+   }
+
+   //--------------------------------------------------------------------
+   // Writes the remainder of the X3D file after the model:  the camera,
+   // background and navigation settings, and the closing tags.
+   //--------------------------------------------------------------------
+   void WriteTrailer(const Point &emin, const Point &emax) override
+   {
+      // cppcheck-suppress assertWithSideEffect
+      assert(m_file.IsOpen());
+
+      // Point the camera at the model.
+      if (!m_file.Printf("<Viewpoint description='View_1' orientation='1 0 0 0' "
+                         "position='%G %G %G'/>\r\n",
+            emin.x + (emax.x - emin.x) / 2.,
+            emin.y + (emax.y - emin.y) / 2.,
+            emin.z + (emax.z - emin.z) / 2 + std::max(emax.x - emin.x, emax.y - emin.y)))
+         throw writeError;
+
+      // Set a dark gray background, and default to "examine" mode.
+      if (!m_file.Printf("<Background skyColor='0.4 0.4 0.4'/>\r\n"
+                         "<NavigationInfo type='\"EXAMINE\" \"ANY\"'/>\r\n"
+                         "</Scene>\r\n"
+                         "</X3D>\r\n"))
+         throw writeError;
+   }
+
+private:
+
+   //--------------------------------------------------------------------
+   // Appends the indexes of the faces of a mesh, each face ending with
+   // -1.  The indexes are either the mesh's vertex indexes, or another
+   // list with one index per corner (such as indexes of normals).
+   //--------------------------------------------------------------------
+   static void AppendFaceIndexes(std::string &text, const Mesh &mesh,
+                                 const std::vector<std::uint32_t> &indexes)
+   {
+      for (size_t face = 0; face < mesh.NumFaces(); ++face)
+      {
+         if (face > 0)
+            text += (face % 8) == 0 ? "\r\n      " : " ";
+         const std::uint32_t *v = indexes.data() + mesh.m_faceStart[face];
+         for (size_t i = 0; i < mesh.FaceSize(face); ++i)
+         {
+            AppendInteger(text, v[i]);
+            text += ' ';
+         }
+         text += "-1";
+      }
+   }
+
+   //--------------------------------------------------------------------
+   // Appends a Normal element with the given list of normals.
+   //--------------------------------------------------------------------
+   static void AppendNormals(std::string &text, const std::vector<Point> &normals)
+   {
+      text += "    <Normal vector='";
+      for (size_t i = 0; i < normals.size(); ++i)
+      {
+         if (i > 0)
+            text += ",\r\n      ";
+         AppendVector(text, normals[i], 7);
+      }
+      text += "'/>\r\n";
+   }
+};